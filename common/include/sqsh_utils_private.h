@@ -82,6 +82,19 @@ sqsh__mutex_init_recursive(sqsh__mutex_t *mutex);
 SQSH_NO_EXPORT SQSH_NO_UNUSED int
 sqsh__mutex_lock(sqsh__mutex_t *mutex, bool *locked);
 
+/**
+ * @brief sqsh__mutex_trylock locks a mutex if it is not locked by another
+ * thread.
+ *
+ * @param mutex the mutex to lock.
+ * @param locked set to true if the mutex was successfully locked.
+ *
+ * @return 0 on success, including the case where the mutex is already
+ * locked, less than 0 on error.
+ */
+SQSH_NO_EXPORT SQSH_NO_UNUSED int
+sqsh__mutex_trylock(sqsh__mutex_t *mutex, bool *locked);
+
 /**
  * @brief sqsh__mutex_unlock unlocks a mutex if locked is true.
  *
@@ -101,6 +114,52 @@ SQSH_NO_EXPORT int sqsh__mutex_unlock(sqsh__mutex_t *mutex, bool *locked);
  */
 SQSH_NO_EXPORT int sqsh__mutex_destroy(sqsh__mutex_t *mutex);
 
+/**
+ * @brief sqsh__cond_t represents a condition variable.
+ */
+typedef pthread_cond_t sqsh__cond_t;
+
+/**
+ * @brief sqsh__cond_init initializes a condition variable.
+ *
+ * @param cond the condition variable to initialize.
+ *
+ * @return 0 on success, less than 0 on error.
+ */
+SQSH_NO_EXPORT SQSH_NO_UNUSED int sqsh__cond_init(sqsh__cond_t *cond);
+
+/**
+ * @brief sqsh__cond_wait waits on a condition variable. The mutex must be
+ * locked by the calling thread and is locked again when this function
+ * returns.
+ *
+ * @param cond the condition variable to wait on.
+ * @param mutex the mutex that protects the condition.
+ *
+ * @return 0 on success, less than 0 on error.
+ */
+SQSH_NO_EXPORT SQSH_NO_UNUSED int
+sqsh__cond_wait(sqsh__cond_t *cond, sqsh__mutex_t *mutex);
+
+/**
+ * @brief sqsh__cond_broadcast wakes up all threads waiting on a condition
+ * variable.
+ *
+ * @param cond the condition variable to signal.
+ *
+ * @return 0 on success, less than 0 on error.
+ */
+SQSH_NO_EXPORT int sqsh__cond_broadcast(sqsh__cond_t *cond);
+
+/**
+ * @brief sqsh__cond_destroy destroys a condition variable.
+ *
+ * @param cond the condition variable to destroy.
+ *
+ * @return 0 on success, less than 0 on error.
+ */
+SQSH_NO_EXPORT int sqsh__cond_destroy(sqsh__cond_t *cond);
+
 /***************************************
  * utils/block.c
  */
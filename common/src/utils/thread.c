@@ -81,6 +81,16 @@ sqsh__mutex_lock(sqsh__mutex_t *mutex, bool *locked) {
 	return 0;
 }
 
+int
+sqsh__mutex_trylock(sqsh__mutex_t *mutex, bool *locked) {
+	int rv = pthread_mutex_trylock(mutex);
+	*locked = rv == 0;
+	if (rv != 0 && rv != EBUSY) {
+		return -SQSH_ERROR_MUTEX_LOCK_FAILED;
+	}
+	return 0;
+}
+
 int
 sqsh__mutex_unlock(sqsh__mutex_t *mutex, bool *locked) {
 	if (!*locked) {
@@ -104,3 +114,39 @@ sqsh__mutex_destroy(sqsh__mutex_t *mutex) {
 		return 0;
 	}
 }
+
+int
+sqsh__cond_init(sqsh__cond_t *cond) {
+	int rv = pthread_cond_init(cond, NULL);
+	if (rv != 0) {
+		return -SQSH_ERROR_MUTEX_INIT_FAILED;
+	}
+	return 0;
+}
+
+int
+sqsh__cond_wait(sqsh__cond_t *cond, sqsh__mutex_t *mutex) {
+	int rv = pthread_cond_wait(cond, mutex);
+	if (rv != 0) {
+		return -SQSH_ERROR_MUTEX_LOCK_FAILED;
+	}
+	return 0;
+}
+
+int
+sqsh__cond_broadcast(sqsh__cond_t *cond) {
+	int rv = pthread_cond_broadcast(cond);
+	if (rv != 0) {
+		return -SQSH_ERROR_MUTEX_LOCK_FAILED;
+	}
+	return 0;
+}
+
+int
+sqsh__cond_destroy(sqsh__cond_t *cond) {
+	int rv = pthread_cond_destroy(cond);
+	if (rv != 0) {
+		return -SQSH_ERROR_MUTEX_DESTROY_FAILED;
+	}
+	return 0;
+}
@@ -378,10 +378,75 @@ sqsh_superblock_fragment_entry_count(const struct SqshSuperblock *context);
  */
 uint64_t sqsh_superblock_bytes_used(const struct SqshSuperblock *context);
 
+/***************************************
+ * extract/cache_context.c
+ */
+
+/**
+ * @brief A cache context limits the memory used by the caches of several
+ * archives. Archives are attached to it through `SqshConfig::cache_context`.
+ */
+struct SqshCacheContext;
+
+/**
+ * @memberof SqshCacheContext
+ * @brief Creates a cache context.
+ *
+ * When the cached blocks of all attached archives exceed the budget, blocks
+ * of the archive that was accessed least recently are evicted first. The
+ * context must outlive all archives that are attached to it.
+ *
+ * @param[in]  budget The maximum number of bytes that the caches of all
+ *                    attached archives may use together.
+ * @param[in]  policy The `enum SqshCachePolicy` of all attached archives.
+ * @param[out] err    Pointer to an int where the error code will be stored.
+ *
+ * @return The cache context on success, NULL on error.
+ */
+SQSH_NO_UNUSED struct SqshCacheContext *
+sqsh_cache_context_new(uint64_t budget, int policy, int *err);
+
+/**
+ * @memberof SqshCacheContext
+ * @brief Retrieves the number of bytes that are currently cached by all
+ * attached archives.
+ *
+ * @param[in] context The cache context.
+ *
+ * @return The number of cached bytes.
+ */
+uint64_t sqsh_cache_context_size(const struct SqshCacheContext *context);
+
+/**
+ * @memberof SqshCacheContext
+ * @brief Frees a cache context.
+ *
+ * @param[in] context The cache context to free.
+ *
+ * @return 0 on success, a negative value on error.
+ */
+int sqsh_cache_context_free(struct SqshCacheContext *context);
+
 /***************************************
  * archive/archive.c
  */
 
+/**
+ * @brief The eviction policies of the caches of decompressed blocks.
+ */
+enum SqshCachePolicy {
+	/**
+	 * @brief Evicts the least recently used block.
+	 */
+	SQSH_CACHE_POLICY_LRU = 0,
+	/**
+	 * @brief Admits blocks into the main cache only after they have been
+	 * accessed twice, so large sequential reads cannot evict frequently used
+	 * blocks. Blocks that are expensive to decompress are evicted last.
+	 */
+	SQSH_CACHE_POLICY_2Q = 1,
+};
+
 /**
  * @brief The SqshConfig struct contains all the configuration options for
  * a sqsh session.
@@ -466,6 +531,118 @@ struct SqshConfig {
 	 */
 	int metablock_lru_size;
 
+	/**
+	 * @brief the directory used to persist chunks of remote archives on
+	 * disk. If unset, chunks are not cached on disk. The cache is shared
+	 * between processes and invalidated when the remote file changes. This
+	 * is only used by `sqsh_mapper_impl_curl`.
+	 */
+	const char *mapper_cache_dir;
+
+	/**
+	 * @brief the maximum size of the disk cache in bytes. Least recently used
+	 * chunks are evicted when the cache grows beyond this size. If unset or 0,
+	 * the size defaults to 256 MiB.
+	 */
+	uint64_t mapper_cache_size;
+
+	/**
+	 * @brief the time in milliseconds a single request of a remote mapper may
+	 * take before it is aborted. If unset or 0, the timeout defaults to 30
+	 * seconds. If set to -1, requests never time out. This is only used by
+	 * `sqsh_mapper_impl_curl`.
+	 */
+	int mapper_timeout_ms;
+
+	/**
+	 * @brief the number of times a failed request of a remote mapper is
+	 * retried with an exponential backoff. If unset or 0, requests are
+	 * retried 3 times. If set to -1, requests are not retried. This is only
+	 * used by `sqsh_mapper_impl_curl`.
+	 */
+	int mapper_retries;
+
+	/**
+	 * @brief the time in milliseconds after which a remote mapper issues a
+	 * second, identical request if the first one has not completed yet. The
+	 * response that arrives first is used. If unset or 0, no hedged requests
+	 * are issued. This is only used by `sqsh_mapper_impl_curl`.
+	 */
+	int mapper_hedge_ms;
+
+	/**
+	 * @brief a combination of `enum SqshMapperAdvice` flags that is applied
+	 * to every block mapped by `sqsh_mapper_impl_mmap`. Note that the mmap
+	 * mapper maps large blocks, so `SQSH_MAPPER_ADVICE_POPULATE` and
+	 * `SQSH_MAPPER_ADVICE_LOCK` apply to large parts of the archive. Use
+	 * sqsh_archive_advise() to advise specific ranges instead. If unset or
+	 * 0, no advice is given.
+	 */
+	int mapper_advice;
+
+	/**
+	 * @brief the memory budget in bytes of the LRU cache of mapped chunks.
+	 * If set, the number of cached chunks is derived from the budget and the
+	 * mapper block size and `mapper_lru_size` is ignored unless it is -1.
+	 */
+	uint64_t mapper_lru_bytes;
+
+	/**
+	 * @brief the memory budget in bytes of the LRU cache of decompressed data
+	 * blocks. If set, the number of cached blocks is derived from the budget
+	 * and the block size of the archive and `data_lru_size` is ignored unless
+	 * it is -1.
+	 */
+	uint64_t data_lru_bytes;
+
+	/**
+	 * @brief the memory budget in bytes of the LRU cache of decompressed
+	 * metablocks. If set, the number of cached metablocks is derived from the
+	 * budget and `metablock_lru_size` is ignored unless it is -1.
+	 */
+	uint64_t metablock_lru_bytes;
+
+	/**
+	 * @brief the combined memory budget in bytes of all LRU caches of the
+	 * archive. Caches that have neither an entry count nor a byte budget
+	 * configured get a share of it: half for data blocks, a quarter each for
+	 * mapped chunks and metablocks. Each cache keeps at least one entry.
+	 */
+	uint64_t lru_bytes;
+
+	/**
+	 * @brief the `enum SqshCachePolicy` of the caches of decompressed data
+	 * blocks and metablocks. If unset or 0, blocks are evicted in least
+	 * recently used order.
+	 */
+	int cache_policy;
+
+	/**
+	 * @brief a cache context created with sqsh_cache_context_new(). If set,
+	 * the caches of mapped chunks, data blocks and metablocks of the archive
+	 * count against the budget of the context, and `cache_policy` is
+	 * replaced by the policy of the context. The per-cache limits still
+	 * apply. Chunks mapped by `sqsh_mapper_impl_mmap` are not counted, as
+	 * they do not use heap memory.
+	 */
+	struct SqshCacheContext *cache_context;
+
+	/**
+	 * @brief the memory budget in bytes of a second cache that keeps the
+	 * compressed data blocks that were decompressed. Blocks that were evicted
+	 * from the cache of decompressed data blocks are decompressed from there
+	 * instead of being mapped again. This is most useful with remote
+	 * mappers. If unset or 0, compressed blocks are not cached.
+	 */
+	uint64_t compressed_lru_bytes;
+
+	/**
+	 * @brief the number of inodes whose attributes are cached for
+	 * sqsh_file_attributes_by_ref(). If unset or 0, 4096 inodes are cached.
+	 * If set to -1, the cache is disabled.
+	 */
+	int inode_cache_size;
+
 	/**
 	 * @privatesection
 	 */
@@ -593,6 +770,29 @@ SQSH_NO_UNUSED int sqsh_archive_fragment_table(
 SQSH_NO_UNUSED int sqsh_archive_xattr_table(
 		struct SqshArchive *archive, struct SqshXattrTable **xattr_table);
 
+/**
+ * @memberof SqshArchive
+ * @brief gives the kernel hints about how a range of the archive will be
+ * accessed. This can be used to keep the metadata tables in memory or to
+ * read ahead data that is about to be extracted.
+ *
+ * The advice only has an effect if the archive is mapped with
+ * `sqsh_mapper_impl_mmap`, for other mappers this is a no-op. The affected
+ * blocks are mapped if they are not mapped yet. Locked memory is unlocked
+ * once the block is evicted from the mapper cache.
+ *
+ * @param[in] archive The archive context.
+ * @param[in] offset  The offset of the range relative to the start of the
+ *                    archive.
+ * @param[in] size    The size of the range.
+ * @param[in] advice  A combination of `enum SqshMapperAdvice` flags.
+ *
+ * @return 0 on success, less than 0 on error.
+ */
+int sqsh_archive_advise(
+		struct SqshArchive *archive, uint64_t offset, uint64_t size,
+		int advice);
+
 /**
  * @memberof SqshArchive
  * @brief Frees the resources used by a Sqsh instance.
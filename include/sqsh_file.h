@@ -145,6 +145,21 @@ struct SqshFileIterator;
 SQSH_NO_UNUSED struct SqshFileIterator *
 sqsh_file_iterator_new(const struct SqshFile *file, int *err);
 
+/**
+ * @brief Creates a copy of a SqshFileIterator.
+ * @memberof SqshFileIterator
+ *
+ * The copy is positioned at the same chunk as the original and keeps the data
+ * of that chunk available, even if the original iterator is advanced or freed.
+ *
+ * @param[in] iterator The file iterator to copy.
+ * @param[out] err Pointer to an int where the error code will be stored.
+ *
+ * @return A pointer to the copy of the iterator.
+ */
+SQSH_NO_UNUSED struct SqshFileIterator *
+sqsh_file_iterator_dup(const struct SqshFileIterator *iterator, int *err);
+
 /**
  * @brief Reads a certain amount of data from the file iterator.
  * @memberof SqshFileIterator
@@ -322,6 +337,55 @@ enum SqshFileType {
 	SQSH_FILE_TYPE_SOCKET
 };
 
+/**
+ * @brief The attributes of an inode that are needed to stat a file. They
+ * can be retrieved without keeping a SqshFile open, see
+ * sqsh_file_attributes_by_ref().
+ */
+struct SqshFileAttributes {
+	/**
+	 * @brief the reference of the inode.
+	 */
+	uint64_t inode_ref;
+	/**
+	 * @brief the type of the file.
+	 */
+	enum SqshFileType type;
+	/**
+	 * @brief the permission bits of the file.
+	 */
+	uint16_t permission;
+	/**
+	 * @brief the inode number of the file.
+	 */
+	uint32_t inode_number;
+	/**
+	 * @brief the number of hard links to the file.
+	 */
+	uint32_t hard_link_count;
+	/**
+	 * @brief the user id of the file.
+	 */
+	uint32_t uid;
+	/**
+	 * @brief the group id of the file.
+	 */
+	uint32_t gid;
+	/**
+	 * @brief the modification time in seconds since epoch.
+	 */
+	uint32_t modified_time;
+	/**
+	 * @brief the size of the file.
+	 */
+	uint64_t size;
+	/**
+	 * @brief the start of the file content. UINT64_MAX if the type is not
+	 * SQSH_FILE_TYPE_FILE.
+	 */
+	uint64_t blocks_start;
+};
+
 /**
  * @memberof SqshFile
  * @brief Initialize the file context from a path.
@@ -362,6 +426,33 @@ sqsh_lopen(struct SqshArchive *archive, const char *path, int *err);
 SQSH_NO_UNUSED struct SqshFile *
 sqsh_open_by_ref(struct SqshArchive *archive, uint64_t inode_ref, int *err);
 
+/**
+ * @brief Retrieves the attributes of an inode without opening it.
+ *
+ * The attributes are kept in a cache of the archive, so repeated calls for
+ * the same inode do not need to parse the inode table again. The size of the
+ * cache is configured with SqshConfig::inode_cache_size.
+ *
+ * @param[in]  archive    The sqsh archive context.
+ * @param[in]  inode_ref  The inode reference of the file.
+ * @param[out] attributes The attributes of the inode.
+ *
+ * @return 0 on success, less than 0 on error.
+ */
+SQSH_NO_UNUSED int sqsh_file_attributes_by_ref(
+		struct SqshArchive *archive, uint64_t inode_ref,
+		struct SqshFileAttributes *attributes);
+
+/**
+ * @memberof SqshFile
+ * @brief Retrieves the attributes of an open file.
+ *
+ * @param[in]  context    The file context.
+ * @param[out] attributes The attributes of the file.
+ */
+void sqsh_file_attributes(
+		const struct SqshFile *context, struct SqshFileAttributes *attributes);
+
 /**
  * @memberof SqshFile
  * @brief returns whether the file is an extended structure.
@@ -593,6 +684,33 @@ uint32_t sqsh_file_directory_parent_inode(const struct SqshFile *context);
  */
 bool sqsh_file_has_fragment(const struct SqshFile *context);
 
+/**
+ * @memberof SqshFile
+ * @brief Reads a range of the file content into a buffer provided by the
+ * caller.
+ *
+ * Blocks are decompressed directly into the buffer and are not added to the
+ * block cache. This is meant for consumers that read each block only once,
+ * like unpacking a file, and that would otherwise evict blocks other readers
+ * still need. Fragments are still read through the cache, as they are
+ * shared between files.
+ *
+ * The function is thread-safe as long as the ranges of concurrent calls do
+ * not overlap in the buffer.
+ *
+ * @param[in]  context The file context.
+ * @param[in]  offset  The offset in the file to start reading from.
+ * @param[out] buffer  The buffer to store the content in. It must be at least
+ *                     size bytes large.
+ * @param[in]  size    The number of bytes to read.
+ *
+ * @return 0 on success, less than 0 on error. Reading beyond the end of the
+ * file returns -SQSH_ERROR_OUT_OF_BOUNDS.
+ */
+SQSH_NO_UNUSED int sqsh_file_read_into(
+		const struct SqshFile *context, uint64_t offset, void *buffer,
+		size_t size);
+
 /**
  * @memberof SqshFile
  * @brief returns the type of the file.
@@ -736,6 +854,19 @@ uint64_t sqsh_file_inode_ref(const struct SqshFile *context);
  */
 uint32_t sqsh_file_xattr_index(const struct SqshFile *context);
 
+/**
+ * @memberof SqshFile
+ * @brief gives the kernel hints about how the data blocks of a file will be
+ * accessed. See sqsh_archive_advise() for details. The fragment of the file
+ * is not affected.
+ *
+ * @param[in] file   The file context.
+ * @param[in] advice A combination of `enum SqshMapperAdvice` flags.
+ *
+ * @return 0 on success, less than 0 on error.
+ */
+int sqsh_file_advise(const struct SqshFile *file, int advice);
+
 /**
  * @memberof SqshFile
  * @brief cleans up an file context and frees the memory.
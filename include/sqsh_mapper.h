@@ -165,11 +165,42 @@ extern const struct SqshMemoryMapperImpl *const sqsh_mapper_impl_curl;
  * mapper/mmap_mapper.c
  */
 
+/**
+ * @brief Hints about how mapped data will be accessed. The flags can be
+ * combined. They are only applied by `sqsh_mapper_impl_mmap`.
+ */
+enum SqshMapperAdvice {
+	SQSH_MAPPER_ADVICE_NORMAL = 0x0000,
+	/** Data will be read sequentially, the kernel reads ahead aggressively. */
+	SQSH_MAPPER_ADVICE_SEQUENTIAL = 0x0001,
+	/** Data will be read in random order, read ahead is disabled. */
+	SQSH_MAPPER_ADVICE_RANDOM = 0x0002,
+	/** Data will be needed soon, the kernel starts reading it in. */
+	SQSH_MAPPER_ADVICE_WILLNEED = 0x0004,
+	/** Data is read in before the call returns. */
+	SQSH_MAPPER_ADVICE_POPULATE = 0x0008,
+	/** Data is locked into memory for as long as it is mapped. */
+	SQSH_MAPPER_ADVICE_LOCK = 0x0010,
+};
+
 /**
  * @brief a mapper that uses mmap to map the file into memory.
  */
 extern const struct SqshMemoryMapperImpl *const sqsh_mapper_impl_mmap;
 
+/***************************************
+ * posix/pread_mapper.c
+ */
+
+/**
+ * @brief a mapper that reads the file with pread() into buffers. Unlike
+ * `sqsh_mapper_impl_mmap`, reads never block on page faults, and blocks
+ * following a sequential read are requested ahead of time. If libsqsh is
+ * built with io_uring support, these reads are submitted asynchronously in
+ * batches.
+ */
+extern const struct SqshMemoryMapperImpl *const sqsh_mapper_impl_pread;
+
 /***************************************
  * mapper/static_mapper.c
  */
@@ -42,6 +42,7 @@
 extern "C" {
 #endif
 
+struct SqshArchive;
 struct SqshFile;
 struct SqshFileIterator;
 
@@ -78,6 +79,48 @@ SQSH_NO_UNUSED int sqsh_file_to_stream_mt(
 		const struct SqshFile *file, struct SqshThreadpool *threadpool,
 		FILE *stream, sqsh_file_to_stream_mt_cb cb, void *data);
 
+/**
+ * @memberof SqshFile
+ * @brief writes data to a stream in file order while decompressing blocks in
+ * parallel.
+ *
+ * Unlike sqsh_file_to_stream_mt(), the stream does not need to be seekable,
+ * so pipes and sockets can be used. Only a bounded number of blocks is
+ * decompressed ahead of the block currently written.
+ *
+ * @param[in] file The file context.
+ * @param[in] threadpool The threadpool to use.
+ * @param[in] stream The stream to write the file contents to.
+ * @param[in] cb The callback to call when the operation is done.
+ * @param[in] data The data to pass to the callback.
+ *
+ * @return 0 on success, less than 0 on error.
+ */
+SQSH_NO_UNUSED int sqsh_file_to_stream_ordered_mt(
+		const struct SqshFile *file, struct SqshThreadpool *threadpool,
+		FILE *stream, sqsh_file_to_stream_mt_cb cb, void *data);
+
+/**
+ * @brief retrieves the content of a file while decompressing its blocks in
+ * parallel.
+ *
+ * Works like sqsh_easy_file_content(), but the blocks are decoded on the
+ * threadpool directly into the returned buffer. The calling thread takes
+ * part in decoding and the function returns once the whole file is read, so
+ * it makes progress even while all threads of the pool are busy.
+ *
+ * @param[in] archive    The sqsh archive context.
+ * @param[in] path       The path the file or directory.
+ * @param[in] threadpool The threadpool to use.
+ * @param[out] err       Pointer to an int where the error code will be
+ *                       stored.
+ *
+ * @return The content of the file on success, NULL on error.
+ */
+uint8_t *sqsh_easy_file_content_mt(
+		struct SqshArchive *archive, const char *path,
+		struct SqshThreadpool *threadpool, int *err);
+
 /**
  * @memberof SqshFile
  * @brief creates a file descriptor from a file and calls a callback for each
@@ -94,6 +137,27 @@ int sqsh_file_iterator_mt(
 		const struct SqshFile *file, struct SqshThreadpool *threadpool,
 		sqsh_file_iterator_mt_cb cb, void *data);
 
+/**
+ * @memberof SqshFileIterator
+ * @brief enables readahead on a file iterator.
+ *
+ * While the iterator is consumed sequentially, the next `block_count` blocks
+ * are decompressed on the threadpool in the background. Readahead pauses after
+ * a seek until the iterator is consumed sequentially again. Scheduled tasks
+ * may outlive the iterator, so the archive must not be closed before the
+ * threadpool finished its work.
+ *
+ * @param[in,out] iterator The file iterator.
+ * @param[in] threadpool The threadpool to use.
+ * @param[in] block_count The number of blocks to read ahead. Use 0 to disable
+ * readahead.
+ *
+ * @return 0 on success, less than 0 on error.
+ */
+int sqsh_file_iterator_readahead(
+		struct SqshFileIterator *iterator, struct SqshThreadpool *threadpool,
+		size_t block_count);
+
 /**
  * @memberof SqshThreadpool
  * @brief creates a new threadpool.
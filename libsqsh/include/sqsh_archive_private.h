@@ -139,6 +139,88 @@ sqsh__inode_map_init(struct SqshInodeMap *map, struct SqshArchive *archive);
  */
 SQSH_NO_EXPORT int sqsh__inode_map_cleanup(struct SqshInodeMap *map);
 
+/***************************************
+ * archive/inode_cache.c
+ */
+
+/**
+ * @brief A slot of the inode cache.
+ */
+struct SqshInodeCacheEntry {
+	/**
+	 * @privatesection
+	 */
+	bool used;
+	struct SqshFileAttributes attributes;
+};
+
+/**
+ * @brief The inode cache keeps the attributes of recently used inodes, keyed
+ * by their inode reference. Each reference maps to exactly one slot, so an
+ * inode replaces whatever was stored in its slot before.
+ */
+struct SqshInodeCache {
+	/**
+	 * @privatesection
+	 */
+	sqsh__mutex_t lock;
+	struct SqshInodeCacheEntry *entries;
+	size_t slot_mask;
+};
+
+/**
+ * @internal
+ * @memberof SqshInodeCache
+ * @brief Initializes an inode cache.
+ *
+ * @param[out] cache    The cache to initialize.
+ * @param[in]  capacity The number of inodes to cache. It is rounded up to
+ *                      the next power of two. If 0, the cache is disabled.
+ *
+ * @return 0 on success, a negative value on error.
+ */
+SQSH_NO_UNUSED SQSH_NO_EXPORT int
+sqsh__inode_cache_init(struct SqshInodeCache *cache, size_t capacity);
+
+/**
+ * @internal
+ * @memberof SqshInodeCache
+ * @brief Looks up the attributes of an inode.
+ *
+ * @param[in]  cache      The cache to use.
+ * @param[in]  inode_ref  The inode reference to look up.
+ * @param[out] attributes The cached attributes.
+ *
+ * @return true if the inode was cached, false otherwise.
+ */
+SQSH_NO_EXPORT bool sqsh__inode_cache_get(
+		struct SqshInodeCache *cache, uint64_t inode_ref,
+		struct SqshFileAttributes *attributes);
+
+/**
+ * @internal
+ * @memberof SqshInodeCache
+ * @brief Stores the attributes of an inode.
+ *
+ * @param[in] cache      The cache to use.
+ * @param[in] attributes The attributes to store. The key is
+ *                       SqshFileAttributes::inode_ref.
+ */
+SQSH_NO_EXPORT void sqsh__inode_cache_put(
+		struct SqshInodeCache *cache,
+		const struct SqshFileAttributes *attributes);
+
+/**
+ * @internal
+ * @memberof SqshInodeCache
+ * @brief Cleans up an inode cache.
+ *
+ * @param[in] cache The cache to clean up.
+ *
+ * @return 0 on success, a negative value on error.
+ */
+SQSH_NO_EXPORT int sqsh__inode_cache_cleanup(struct SqshInodeCache *cache);
+
 /***************************************
  * archive/superblock.c
  */
@@ -236,6 +318,7 @@ struct SqshArchive {
 	struct SqshXattrTable xattr_table;
 	struct SqshFragmentTable fragment_table;
 	struct SqshInodeMap inode_map;
+	struct SqshInodeCache inode_cache;
 	uint8_t initialized;
 	struct SqshConfig config;
 	sqsh__mutex_t lock;
@@ -257,6 +340,25 @@ SQSH_NO_EXPORT SQSH_NO_UNUSED int sqsh__archive_init(
 		struct SqshArchive *sqsh, const void *source,
 		const struct SqshConfig *config);
 
+/**
+ * @internal
+ * @brief Computes the number of entries of an LRU cache from the
+ * configuration. A byte budget takes precedence over the entry count. If
+ * neither is set, the share of the archive wide budget is used. If that is
+ * not set either, the default entry count is used.
+ *
+ * @param lru_size     The configured entry count, -1 disables the cache.
+ * @param lru_bytes    The configured byte budget of the cache.
+ * @param shared_bytes The share of the archive wide byte budget.
+ * @param entry_size   The maximum size of a single entry.
+ * @param default_size The default entry count.
+ *
+ * @return the number of entries of the cache.
+ */
+SQSH_NO_EXPORT size_t sqsh__config_lru_size(
+		int lru_size, uint64_t lru_bytes, uint64_t shared_bytes,
+		size_t entry_size, size_t default_size);
+
 /**
  * @internal
  * @memberof SqshArchive
@@ -272,6 +374,20 @@ SQSH_NO_EXPORT int sqsh__archive_data_extract_manager(
 		struct SqshArchive *archive,
 		struct SqshExtractManager **data_extract_manager);
 
+/**
+ * @internal
+ * @memberof SqshArchive
+ * @brief sqsh__archive_inode_cache retrieves the cache of inode attributes
+ * used by sqsh_file_attributes_by_ref().
+ *
+ * @param archive the SqshArchive to retrieve the SqshInodeCache from.
+ * @param inode_cache the SqshInodeCache to retrieve.
+ *
+ * @return 0 on success, less than 0 on error.
+ */
+SQSH_NO_EXPORT int sqsh__archive_inode_cache(
+		struct SqshArchive *archive, struct SqshInodeCache **inode_cache);
+
 /**
  * @internal
  * @memberof SqshArchive
@@ -67,6 +67,11 @@ extern const struct SqshExtractorImpl *const volatile sqsh__impl_lzo;
  * @internal
  * @brief The SqshExtractorImpl struct is used to implement a extractor
  * that is then used by the SqshExtractor.
+ *
+ * Implementations that live outside of libsqsh, like sqsh__impl_lzo, may be
+ * built against a version of this struct that ends after finish(). All
+ * members after finish() are therefore only read for the builtin
+ * implementations. See sqsh__extractor_impl_is_builtin().
  */
 struct SqshExtractorImpl {
 	/**
@@ -83,6 +88,37 @@ struct SqshExtractorImpl {
 	 * @brief Function that is called to finish the extraction.
 	 */
 	int (*finish)(void *context, uint8_t *target, size_t *target_size);
+	/**
+	 * @brief Optional. Allocates a decoder that can be reused for several
+	 * extractions. Implementations that leave this NULL allocate their state
+	 * in init() and release it in finish().
+	 */
+	int (*decoder_new)(void **decoder);
+	/**
+	 * @brief Optional. Frees a decoder allocated by decoder_new().
+	 */
+	void (*decoder_free)(void *decoder);
+	/**
+	 * @brief Optional. Like init(), but resets and uses a decoder that was
+	 * allocated by decoder_new(). finish() will not free the decoder.
+	 */
+	int (*init_with_decoder)(
+			void *context, void *decoder, uint8_t *target,
+			size_t target_size);
+	/**
+	 * @brief Optional. Decompresses a complete, contiguous block in a single
+	 * call using a decoder allocated by decoder_new(). On input target_size
+	 * is the capacity of target, on output the size of the decompressed
+	 * data.
+	 */
+	int (*decompress)(
+			void *decoder, uint8_t *target, size_t *target_size,
+			const uint8_t *compressed, const size_t compressed_size);
+	/**
+	 * @brief The relative cost to decode one byte of output. It is used to
+	 * keep blocks that are expensive to decode in the cache for longer.
+	 */
+	uint32_t decode_cost;
 };
 
 /**
@@ -99,6 +135,20 @@ struct SqshExtractor {
 	size_t block_size;
 };
 
+/**
+ * @brief A pool of reusable decoders for a single extractor implementation.
+ */
+struct SqshExtractorPool {
+	/**
+	 * @privatesection
+	 */
+	const struct SqshExtractorImpl *impl;
+	void **decoders;
+	size_t decoder_count;
+	size_t decoder_capacity;
+	sqsh__mutex_t lock;
+};
+
 /**
  * @internal
  * @memberof SqshExtractor
@@ -112,6 +162,32 @@ struct SqshExtractor {
 SQSH_NO_EXPORT const struct SqshExtractorImpl *
 sqsh__extractor_impl_from_id(enum SqshSuperblockCompressionId id);
 
+/**
+ * @internal
+ * @memberof SqshExtractor
+ * @brief Checks if an extractor implementation is part of libsqsh and
+ * therefore provides the optional members of SqshExtractorImpl.
+ *
+ * @param[in]  impl The extractor implementation.
+ *
+ * @return true if the implementation is builtin, false otherwise.
+ */
+SQSH_NO_EXPORT bool
+sqsh__extractor_impl_is_builtin(const struct SqshExtractorImpl *impl);
+
+/**
+ * @internal
+ * @memberof SqshExtractor
+ * @brief Returns the relative cost to decode one byte of output.
+ *
+ * @param[in]  impl The extractor implementation.
+ *
+ * @return The decode cost of the implementation, 1 if it does not provide
+ * one.
+ */
+SQSH_NO_EXPORT uint32_t
+sqsh__extractor_impl_decode_cost(const struct SqshExtractorImpl *impl);
+
 /**
  * @internal
  * @memberof SqshExtractor
@@ -128,6 +204,25 @@ SQSH_NO_EXPORT SQSH_NO_UNUSED int sqsh__extractor_init(
 		struct SqshExtractor *extractor, struct CxBuffer *buffer,
 		const struct SqshExtractorImpl *impl, size_t block_size);
 
+/**
+ * @internal
+ * @memberof SqshExtractor
+ * @brief Initializes a extractor context that uses a reusable decoder.
+ *
+ * @param[out] extractor      The context to initialize.
+ * @param[out] buffer         The buffer to store the decompressed data.
+ * @param[in]  impl           The implementation of the extraction algorithm.
+ * @param[in]  block_size     The block size to use for the extraction.
+ * @param[in]  decoder        A decoder retrieved from
+ *                            sqsh__extractor_pool_acquire() or NULL.
+ *
+ * @return 0 on success, a negative value on error.
+ */
+SQSH_NO_EXPORT SQSH_NO_UNUSED int sqsh__extractor_init_with_decoder(
+		struct SqshExtractor *extractor, struct CxBuffer *buffer,
+		const struct SqshExtractorImpl *impl, size_t block_size,
+		void *decoder);
+
 /**
  * @internal
  * @memberof SqshExtractor
@@ -165,10 +260,292 @@ SQSH_NO_EXPORT int sqsh__extractor_finish(struct SqshExtractor *extractor);
  */
 SQSH_NO_EXPORT int sqsh__extractor_cleanup(struct SqshExtractor *extractor);
 
+/**
+ * @internal
+ * @memberof SqshExtractor
+ * @brief Decompresses a complete block in a single call, bypassing the
+ * streaming interface. Only usable if the implementation provides
+ * SqshExtractorImpl::decompress.
+ *
+ * @param[out] buffer          The buffer to append the decompressed data to.
+ * @param[in]  impl            The implementation of the extraction algorithm.
+ * @param[in]  block_size      The block size to use for the extraction.
+ * @param[in]  decoder         A decoder retrieved from
+ *                             sqsh__extractor_pool_acquire().
+ * @param[in]  compressed      The compressed data.
+ * @param[in]  compressed_size The size of the compressed data.
+ *
+ * @return 0 on success, a negative value on error.
+ */
+SQSH_NO_EXPORT SQSH_NO_UNUSED int sqsh__extractor_decompress(
+		struct CxBuffer *buffer, const struct SqshExtractorImpl *impl,
+		size_t block_size, void *decoder, const uint8_t *compressed,
+		size_t compressed_size);
+
+/**
+ * @internal
+ * @memberof SqshExtractorPool
+ * @brief Initializes a decoder pool.
+ *
+ * @param[out] pool  The pool to initialize.
+ * @param[in]  impl  The implementation the decoders are created for.
+ *
+ * @return 0 on success, a negative value on error.
+ */
+SQSH_NO_EXPORT SQSH_NO_UNUSED int sqsh__extractor_pool_init(
+		struct SqshExtractorPool *pool, const struct SqshExtractorImpl *impl);
+
+/**
+ * @internal
+ * @memberof SqshExtractorPool
+ * @brief Takes a decoder out of the pool, or creates a new one if the pool
+ * is empty.
+ *
+ * @param[in]  pool     The pool to take the decoder from.
+ * @param[out] decoder  The decoder. Set to NULL if the implementation does
+ *                      not support reusable decoders.
+ *
+ * @return 0 on success, a negative value on error.
+ */
+SQSH_NO_EXPORT SQSH_NO_UNUSED int
+sqsh__extractor_pool_acquire(struct SqshExtractorPool *pool, void **decoder);
+
+/**
+ * @internal
+ * @memberof SqshExtractorPool
+ * @brief Returns a decoder to the pool.
+ *
+ * @param[in] pool     The pool to return the decoder to.
+ * @param[in] decoder  The decoder to return. May be NULL.
+ */
+SQSH_NO_EXPORT void
+sqsh__extractor_pool_release(struct SqshExtractorPool *pool, void *decoder);
+
+/**
+ * @internal
+ * @memberof SqshExtractorPool
+ * @brief Frees all decoders in the pool.
+ *
+ * @param[in] pool The pool to clean up.
+ *
+ * @return 0 on success, a negative value on error.
+ */
+SQSH_NO_EXPORT int sqsh__extractor_pool_cleanup(struct SqshExtractorPool *pool);
+
+/***************************************
+ * extract/cache_context.c
+ */
+
+struct SqshExtractCache;
+
+/**
+ * @brief A byte budget that is shared by the caches of several archives.
+ */
+struct SqshCacheContext {
+	/**
+	 * @privatesection
+	 */
+	sqsh__mutex_t lock;
+	uint64_t budget;
+	int policy;
+	uint64_t size;
+	uint64_t clock;
+	struct SqshExtractCache *caches;
+};
+
+/**
+ * @internal
+ * @memberof SqshCacheContext
+ * @brief Adds a cache to the context.
+ *
+ * @param[in] context The context to add the cache to.
+ * @param[in] cache   The cache to add.
+ *
+ * @return 0 on success, a negative value on error.
+ */
+SQSH_NO_EXPORT int sqsh__cache_context_add(
+		struct SqshCacheContext *context, struct SqshExtractCache *cache);
+
+/**
+ * @internal
+ * @memberof SqshCacheContext
+ * @brief Evicts blocks of the least recently used caches of the context
+ * until the context is within its budget again.
+ *
+ * @param[in] context The context to shrink.
+ * @param[in] current The cache that triggered the eviction. Its lock must
+ *                    be held by the caller.
+ *
+ * @return 0 on success, a negative value on error.
+ */
+SQSH_NO_EXPORT int sqsh__cache_context_shrink(
+		struct SqshCacheContext *context, struct SqshExtractCache *current);
+
+/**
+ * @internal
+ * @memberof SqshCacheContext
+ * @brief Removes a cache from the context.
+ *
+ * @param[in] context The context to remove the cache from.
+ * @param[in] cache   The cache to remove.
+ *
+ * @return 0 on success, a negative value on error.
+ */
+SQSH_NO_EXPORT int sqsh__cache_context_remove(
+		struct SqshCacheContext *context, struct SqshExtractCache *cache);
+
+/***************************************
+ * extract/extract_cache.c
+ */
+
+struct SqshExtractCacheEntry;
+
+/**
+ * @brief A doubly linked list of cache entries, linked by their index.
+ */
+struct SqshExtractCacheList {
+	/**
+	 * @privatesection
+	 */
+	size_t head;
+	size_t tail;
+	/* Modified with the lock of the cache held, but read atomically by the
+	 * cache context without it. */
+	size_t count;
+};
+
+/**
+ * @brief Decides which blocks stay in a SqshExtractManager or in a shard of
+ * a SqshMapManager. The cache holds a reference in the backing map for every
+ * resident block and releases it once the block is evicted.
+ *
+ * With SQSH_CACHE_POLICY_LRU, the least recently used block is evicted.
+ *
+ * With SQSH_CACHE_POLICY_2Q, blocks that are accessed for the first time
+ * enter a small FIFO queue. Only blocks that are accessed again shortly after
+ * they were evicted from that queue are promoted to the main LRU queue. A
+ * single scan therefore only cycles through the FIFO queue. When evicting
+ * from the main queue, the block with the lowest cost among the least
+ * recently used ones is chosen.
+ */
+struct SqshExtractCache {
+	/**
+	 * @privatesection
+	 */
+	struct CxRcHashMap *backend;
+	int policy;
+	size_t capacity;
+	size_t recent_capacity;
+	size_t ghost_capacity;
+	struct SqshExtractCacheEntry *entries;
+	size_t entry_count;
+	size_t free_entry;
+	size_t *buckets;
+	size_t bucket_mask;
+	struct SqshExtractCacheList recent;
+	struct SqshExtractCacheList frequent;
+	struct SqshExtractCacheList ghosts;
+	uint64_t size;
+	uint64_t max_size;
+	struct SqshCacheContext *context;
+	sqsh__mutex_t *lock;
+	uint64_t last_access;
+	struct SqshExtractCache *context_prev;
+	struct SqshExtractCache *context_next;
+};
+
+/**
+ * @internal
+ * @memberof SqshExtractCache
+ * @brief Initializes a cache.
+ *
+ * @param[out] cache    The cache to initialize.
+ * @param[in]  capacity The maximum number of resident blocks. 0 disables
+ *                      the cache.
+ * @param[in]  policy   The `enum SqshCachePolicy` to use.
+ * @param[in]  backend  The map that holds the blocks.
+ *
+ * @return 0 on success, a negative value on error.
+ */
+SQSH_NO_EXPORT SQSH_NO_UNUSED int sqsh__extract_cache_init(
+		struct SqshExtractCache *cache, size_t capacity, int policy,
+		struct CxRcHashMap *backend);
+
+/**
+ * @internal
+ * @memberof SqshExtractCache
+ * @brief Limits the total size of the resident blocks in addition to their
+ * number. The most recently touched block is always kept.
+ *
+ * @param[in] cache    The cache to limit.
+ * @param[in] max_size The maximum size in bytes, or 0 for no limit.
+ */
+SQSH_NO_EXPORT void sqsh__extract_cache_limit_size(
+		struct SqshExtractCache *cache, uint64_t max_size);
+
+/**
+ * @internal
+ * @memberof SqshExtractCache
+ * @brief Attaches a cache to a shared cache context. Blocks of the cache
+ * then count against the budget of the context and may be evicted by other
+ * caches of the context.
+ *
+ * @param[in] cache   The cache to attach.
+ * @param[in] context The context to attach to.
+ * @param[in] lock    The lock that protects the cache and its backend.
+ *
+ * @return 0 on success, a negative value on error.
+ */
+SQSH_NO_EXPORT int sqsh__extract_cache_attach(
+		struct SqshExtractCache *cache, struct SqshCacheContext *context,
+		sqsh__mutex_t *lock);
+
+/**
+ * @internal
+ * @memberof SqshExtractCache
+ * @brief Marks a block as accessed. If the block is not resident yet, the
+ * cache retains it in the backend and evicts other blocks if needed.
+ *
+ * @param[in] cache   The cache to use.
+ * @param[in] address The address of the block.
+ * @param[in] size    The size of the block in memory.
+ * @param[in] cost    The cost to load the block, or 0 if the block was
+ *                    not loaded for this access.
+ *
+ * @return 0 on success, a negative value on error.
+ */
+SQSH_NO_EXPORT int sqsh__extract_cache_touch(
+		struct SqshExtractCache *cache, uint64_t address, size_t size,
+		uint64_t cost);
+
+/**
+ * @internal
+ * @memberof SqshExtractCache
+ * @brief Releases all resident blocks and cleans up the cache.
+ *
+ * @param[in] cache The cache to clean up.
+ *
+ * @return 0 on success, a negative value on error.
+ */
+SQSH_NO_EXPORT int sqsh__extract_cache_cleanup(struct SqshExtractCache *cache);
+
+/**
+ * @internal
+ * @memberof SqshExtractCache
+ * @brief Evicts the next block of the cache.
+ *
+ * @param[in] cache The cache to evict a block from.
+ *
+ * @return 0 on success, a negative value on error.
+ */
+SQSH_NO_EXPORT int sqsh__extract_cache_evict(struct SqshExtractCache *cache);
+
 /***************************************
  * extract/extract_manager.c
  */
 
+struct SqshExtractInflight;
+
 /**
  * @brief Manages chunks of compressed areas from an archive.
  */
@@ -180,8 +557,28 @@ struct SqshExtractManager {
 	struct SqshMapManager *map_manager;
 	struct CxRcHashMap cache;
 	uint32_t block_size;
-	struct CxLru lru;
+	struct SqshExtractCache lru;
 	sqsh__mutex_t lock;
+	/**
+	 * Blocks that are currently decompressed by a thread. Other threads
+	 * requesting the same address wait for this decompression instead of
+	 * starting their own.
+	 */
+	struct SqshExtractInflight *inflight;
+	struct SqshExtractorPool decoder_pool;
+	/**
+	 * Buffers of evicted blocks. They are reused for the next blocks that
+	 * are decompressed instead of allocating new ones.
+	 */
+	struct CxBuffer *buffer_pool;
+	size_t buffer_pool_count;
+	/**
+	 * Copies of compressed blocks, so that blocks that were evicted from
+	 * the cache can be decompressed again without mapping them.
+	 */
+	bool keep_compressed;
+	struct CxRcHashMap compressed;
+	struct SqshExtractCache compressed_lru;
 };
 
 /**
@@ -200,6 +597,21 @@ SQSH_NO_EXPORT SQSH_NO_UNUSED int sqsh__extract_manager_init(
 		struct SqshExtractManager *manager, struct SqshArchive *archive,
 		uint32_t block_size, size_t lru_size);
 
+/**
+ * @internal
+ * @memberof SqshExtractManager
+ * @brief Enables a second cache that keeps the compressed blocks that were
+ * decompressed by the manager.
+ *
+ * @param[in]     manager     The manager to use.
+ * @param[in]     max_size    The maximum size of the compressed blocks in
+ *                            bytes. If 0, the cache stays disabled.
+ *
+ * @return 0 on success, a negative value on error.
+ */
+SQSH_NO_EXPORT SQSH_NO_UNUSED int sqsh__extract_manager_init_compressed_cache(
+		struct SqshExtractManager *manager, uint64_t max_size);
+
 /**
  * @internal
  * @memberof SqshExtractManager
@@ -215,6 +627,42 @@ SQSH_NO_EXPORT int sqsh__extract_manager_uncompress(
 		struct SqshExtractManager *manager, const struct SqshMapReader *reader,
 		struct CxBuffer **target);
 
+/**
+ * @internal
+ * @memberof SqshExtractManager
+ * @brief Retrieves a decompressed block without mapping it. This succeeds if
+ * the block is still cached, either decompressed or compressed.
+ *
+ * @param[in]     manager     The manager to use.
+ * @param[in]     address     The address of the compressed block.
+ * @param[out]    target      The buffer to store the decompressed data.
+ *
+ * @return 1 if the block was found, 0 if it needs to be mapped and
+ * decompressed with sqsh__extract_manager_uncompress(), a negative value on
+ * error.
+ */
+SQSH_NO_EXPORT int sqsh__extract_manager_lookup(
+		struct SqshExtractManager *manager, uint64_t address,
+		struct CxBuffer **target);
+
+/**
+ * @internal
+ * @memberof SqshExtractManager
+ * @brief Decompresses a block into memory owned by the caller. The block is
+ * neither looked up in nor added to the cache.
+ *
+ * @param[in]     manager     The manager to use.
+ * @param[in]     reader      The reader that maps the compressed block.
+ * @param[out]    target      The memory to store the decompressed data in.
+ * @param[in,out] target_size On input the capacity of target, on output
+ *                            the size of the decompressed data.
+ *
+ * @return 0 on success, a negative value on error.
+ */
+SQSH_NO_EXPORT SQSH_NO_UNUSED int sqsh__extract_manager_decompress_into(
+		struct SqshExtractManager *manager, const struct SqshMapReader *reader,
+		uint8_t *target, size_t *target_size);
+
 /**
  * @internal
  * @memberof SqshExtractManager
@@ -285,6 +733,23 @@ SQSH_NO_EXPORT SQSH_NO_UNUSED int sqsh__extract_view_init(
 		struct SqshExtractView *view, struct SqshExtractManager *manager,
 		const struct SqshMapReader *reader);
 
+/**
+ * @internal
+ * @memberof SqshExtractView
+ * @brief Initializes a extractor view from a block that is still cached by
+ * the manager. See sqsh__extract_manager_lookup().
+ *
+ * @param[in]     view        The view to initialize.
+ * @param[in]     manager     The manager to use.
+ * @param[in]     address     The address of the compressed block.
+ *
+ * @return 1 if the view was initialized, 0 if the block needs to be mapped
+ * and passed to sqsh__extract_view_init(), a negative value on error.
+ */
+SQSH_NO_EXPORT SQSH_NO_UNUSED int sqsh__extract_view_lookup(
+		struct SqshExtractView *view, struct SqshExtractManager *manager,
+		uint64_t address);
+
 /**
  * @internal
  * @memberof SqshExtractView
@@ -148,6 +148,23 @@ struct SqshIteratorState {
 	uint64_t compressed_offset;
 };
 
+/**
+ * @brief Hooks that allow a file iterator to decompress the blocks following
+ * the current one ahead of time.
+ */
+struct SqshFileIteratorReadaheadImpl {
+	/**
+	 * Called after the iterator mapped the data block `block_index`.
+	 * `next_block_index` is the block the iterator will map next.
+	 */
+	void (*block_mapped)(
+			void *readahead, uint64_t block_index, uint64_t next_block_index);
+	/**
+	 * Called when the iterator is cleaned up or the readahead is replaced.
+	 */
+	void (*cleanup)(void *readahead);
+};
+
 /**
  * @brief An iterator over the contents of a file.
  */
@@ -158,6 +175,11 @@ struct SqshFileIterator {
 	const struct SqshFile *file;
 	struct SqshExtractManager *compression_manager;
 	struct SqshMapReader map_reader;
+	/**
+	 * The size of the blocks that were taken from the cache of the extract
+	 * manager without advancing the map reader over them.
+	 */
+	uint64_t pending_offset;
 	struct SqshExtractView extract_view;
 	struct SqshFragmentView fragment_view;
 	size_t sparse_size;
@@ -165,6 +187,8 @@ struct SqshFileIterator {
 	uint64_t block_index;
 	const uint8_t *data;
 	size_t size;
+	const struct SqshFileIteratorReadaheadImpl *readahead_impl;
+	void *readahead;
 };
 
 /**
@@ -212,6 +236,21 @@ SQSH_NO_EXPORT SQSH_NO_UNUSED int sqsh__file_iterator_init_with_state(
 SQSH_NO_EXPORT SQSH_NO_UNUSED int sqsh__file_iterator_copy(
 		struct SqshFileIterator *target, const struct SqshFileIterator *source);
 
+/**
+ * @internal
+ * @memberof SqshFileIterator
+ * @brief Attaches a readahead implementation to a file iterator. A previously
+ * attached readahead is cleaned up. The copy of an iterator does not inherit
+ * the readahead.
+ *
+ * @param[in,out] iterator The file iterator.
+ * @param[in] impl The readahead implementation or NULL to disable readahead.
+ * @param[in] readahead The readahead context that is passed to `impl`.
+ */
+SQSH_NO_EXPORT void sqsh__file_iterator_set_readahead(
+		struct SqshFileIterator *iterator,
+		const struct SqshFileIteratorReadaheadImpl *impl, void *readahead);
+
 /**
  * @internal
  * @memberof SqshFileIterator
@@ -310,6 +349,12 @@ struct SqshFile {
 	struct SqshMetablockReader metablock;
 	struct SqshArchive *archive;
 	uint64_t parent_inode_ref;
+	/**
+	 * Lazily built prefix sums of the compressed block sizes. Entry `i` holds
+	 * the offset of block `i` relative to the start of the file's data
+	 * blocks. Published atomically, as files may be shared between threads.
+	 */
+	uint64_t *block_offsets;
 };
 
 /**
@@ -353,6 +398,38 @@ SQSH_NO_EXPORT void sqsh__file_set_parent_inode_ref(
 SQSH_NO_EXPORT uint64_t
 sqsh__file_parent_inode_ref(struct SqshFile *context, int *err);
 
+/**
+ * @internal
+ * @memberof SqshFile
+ * @brief Retrieves the offset of a data block relative to the start of the
+ * file's data blocks. The offsets of all blocks are computed on the first
+ * call and cached in the file context, so subsequent lookups are O(1).
+ *
+ * @param[in]  file        The file context.
+ * @param[in]  block_index The index of the block. May be equal to the block
+ *                         count to retrieve the end of the last block.
+ * @param[out] offset      The compressed offset of the block.
+ *
+ * @return 0 on success, less than 0 on error.
+ */
+SQSH_NO_EXPORT SQSH_NO_UNUSED int sqsh__file_block_offset(
+		const struct SqshFile *file, uint64_t block_index, uint64_t *offset);
+
+/**
+ * @internal
+ * @memberof SqshFile
+ * @brief Retrieves the size of a data block once it is decompressed. This is
+ * the block size of the archive, except for the last block of a file without
+ * a fragment, which only holds the remainder of the file.
+ *
+ * @param[in] file        The file context.
+ * @param[in] block_index The index of the block.
+ *
+ * @return the decompressed size of the block.
+ */
+SQSH_NO_EXPORT size_t sqsh__file_block_decompressed_size(
+		const struct SqshFile *file, uint64_t block_index);
+
 /**
  * @internal
  * @memberof SqshFile
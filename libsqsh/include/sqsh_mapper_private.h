@@ -36,6 +36,7 @@
 
 #include <sqsh_mapper.h>
 
+#include "sqsh_extract_private.h"
 #include "sqsh_reader_private.h"
 #include "sqsh_utils_private.h"
 
@@ -63,6 +64,11 @@ struct SqshMapper {
 	size_t block_size;
 	uint64_t archive_size;
 	void *user_data;
+	/**
+	 * The configuration of the archive. Only valid while the init callback
+	 * of the implementation runs.
+	 */
+	const struct SqshConfig *config;
 };
 
 /**
@@ -91,6 +97,91 @@ SQSH_NO_EXPORT SQSH_NO_UNUSED int sqsh__mapper_init(
  */
 SQSH_NO_EXPORT int sqsh__mapper_cleanup(struct SqshMapper *mapper);
 
+/***************************************
+ * mapper/disk_cache.c
+ */
+
+/**
+ * @brief A persistent cache that stores chunks of a remote archive as files in
+ * a directory. Entries are keyed by the name of the archive and its version,
+ * so they are invalidated once the version changes.
+ */
+struct SqshDiskCache {
+	/**
+	 * @privatesection
+	 */
+	char *path;
+	char name_prefix[32];
+	char prefix[64];
+	uint64_t max_size;
+	uint64_t size;
+	sqsh__mutex_t lock;
+};
+
+/**
+ * @internal
+ * @memberof SqshDiskCache
+ * @brief Initializes a disk cache. The directory is created if it does not
+ * exist. Entries of other versions of the same archive are removed.
+ *
+ * @param[out] cache    The cache to initialize.
+ * @param[in]  path     The directory to store the entries in.
+ * @param[in]  name     The name of the archive, e.g. its URL.
+ * @param[in]  version  The version of the archive, e.g. its modification
+ *                      time.
+ * @param[in]  max_size The maximum size of the cache in bytes.
+ *
+ * @return 0 on success, a negative value on error.
+ */
+SQSH_NO_EXPORT SQSH_NO_UNUSED int sqsh__disk_cache_init(
+		struct SqshDiskCache *cache, const char *path, const char *name,
+		uint64_t version, uint64_t max_size);
+
+/**
+ * @internal
+ * @memberof SqshDiskCache
+ * @brief Reads a chunk from the cache.
+ *
+ * @param[in]  cache  The cache to read from.
+ * @param[in]  offset The offset of the chunk in the archive.
+ * @param[in]  size   The size of the chunk.
+ * @param[out] target The buffer to read the chunk into. Must be at least
+ *                    `size` bytes large.
+ *
+ * @return true if the chunk was found in the cache, false otherwise.
+ */
+SQSH_NO_EXPORT SQSH_NO_UNUSED bool sqsh__disk_cache_get(
+		struct SqshDiskCache *cache, uint64_t offset, size_t size,
+		uint8_t *target);
+
+/**
+ * @internal
+ * @memberof SqshDiskCache
+ * @brief Stores a chunk in the cache. Least recently used entries are evicted
+ * if the cache grows beyond its maximum size.
+ *
+ * @param[in] cache  The cache to write to.
+ * @param[in] offset The offset of the chunk in the archive.
+ * @param[in] size   The size of the chunk.
+ * @param[in] data   The data of the chunk.
+ *
+ * @return 0 on success, a negative value on error.
+ */
+SQSH_NO_EXPORT int sqsh__disk_cache_put(
+		struct SqshDiskCache *cache, uint64_t offset, size_t size,
+		const uint8_t *data);
+
+/**
+ * @internal
+ * @memberof SqshDiskCache
+ * @brief Cleans up a disk cache. The entries stay on disk.
+ *
+ * @param[in] cache The cache to clean up.
+ *
+ * @return 0 on success, a negative value on error.
+ */
+SQSH_NO_EXPORT int sqsh__disk_cache_cleanup(struct SqshDiskCache *cache);
+
 /***************************************
  * mapper/map_slice.c
  */
@@ -162,6 +253,20 @@ SQSH_NO_EXPORT SQSH_NO_UNUSED int sqsh__map_slice_init(
  * mapper/map_manager.c
  */
 
+/**
+ * @brief A shard of the map manager. Each shard owns a disjoint subset of the
+ * map slices, selected by the slice index, so that concurrent readers that
+ * access different slices do not contend on the same lock.
+ */
+struct SqshMapManagerShard {
+	/**
+	 * @privatesection
+	 */
+	struct SqshExtractCache lru;
+	struct CxRcHashMap maps;
+	sqsh__mutex_t lock;
+};
+
 /**
  * @brief The map manager.
  */
@@ -170,11 +275,15 @@ struct SqshMapManager {
 	 * @privatesection
 	 */
 	struct SqshMapper mapper;
-	struct CxLru lru;
-	struct CxRcHashMap maps;
+	struct SqshMapManagerShard *shards;
+	size_t shard_count;
 	uint64_t archive_offset;
 	uint64_t block_count;
-	sqsh__mutex_t lock;
+	/* If the whole archive fits into a single block, it is mapped once
+	 * during initialization and handed out without locking, hashing or
+	 * reference counting. */
+	bool is_direct;
+	struct SqshMapSlice direct;
 };
 
 /**
@@ -511,6 +620,28 @@ SQSH_NO_EXPORT size_t sqsh__map_reader_size(const struct SqshMapReader *reader);
  */
 SQSH_NO_EXPORT int sqsh__map_reader_cleanup(struct SqshMapReader *reader);
 
+/***************************************
+ * posix/mmap_mapper.c
+ */
+
+/**
+ * @internal
+ * @memberof SqshMapper
+ * @brief Gives the kernel hints about how a range of data that was mapped by
+ * `sqsh_mapper_impl_mmap` will be accessed. This is kept out of
+ * SqshMemoryMapperImpl, as custom mappers define that struct statically.
+ *
+ * @param[in] mapper The mapper. Must use `sqsh_mapper_impl_mmap`.
+ * @param[in] data   The start of the range inside of a mapped block.
+ * @param[in] size   The size of the range.
+ * @param[in] advice A combination of `enum SqshMapperAdvice` flags.
+ *
+ * @return 0 on success, less than 0 on error.
+ */
+SQSH_NO_EXPORT int sqsh__mmap_mapper_advise(
+		const struct SqshMapper *mapper, uint8_t *data, size_t size,
+		int advice);
+
 #ifdef __cplusplus
 }
 #endif
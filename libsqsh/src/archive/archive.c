@@ -53,6 +53,7 @@ enum InitializedBitmap {
 	INITIALIZED_FRAGMENT_TABLE = 1 << 3,
 	INITIALIZED_DATA_COMPRESSION_MANAGER = 1 << 4,
 	INITIALIZED_INODE_MAP = 1 << 5,
+	INITIALIZED_INODE_CACHE = 1 << 6,
 };
 
 static bool
@@ -81,6 +82,23 @@ out:
 	return archive;
 }
 
+size_t
+sqsh__config_lru_size(
+		int lru_size, uint64_t lru_bytes, uint64_t shared_bytes,
+		size_t entry_size, size_t default_size) {
+	if (lru_size < 0) {
+		return 0;
+	}
+	if (lru_bytes == 0 && lru_size == 0) {
+		lru_bytes = shared_bytes;
+	}
+	if (lru_bytes == 0) {
+		return lru_size == 0 ? default_size : (size_t)lru_size;
+	}
+	const uint64_t entries = lru_bytes / SQSH_MAX(entry_size, (size_t)1);
+	return (size_t)SQSH_MIN(SQSH_MAX(entries, (uint64_t)1), (uint64_t)SIZE_MAX);
+}
+
 int
 sqsh__archive_init(
 		struct SqshArchive *archive, const void *source,
@@ -112,10 +130,11 @@ sqsh__archive_init(
 	}
 
 	config = sqsh_archive_config(archive);
-	const int default_lru_size =
-			(int)SQSH_CONFIG_DEFAULT(config->compression_lru_size, 128);
-	const size_t metablock_lru_size =
-			SQSH_CONFIG_DEFAULT(config->metablock_lru_size, default_lru_size);
+	const size_t default_lru_size =
+			SQSH_CONFIG_DEFAULT(config->compression_lru_size, 128);
+	const size_t metablock_lru_size = sqsh__config_lru_size(
+			config->metablock_lru_size, config->metablock_lru_bytes,
+			config->lru_bytes / 4, SQSH_METABLOCK_BLOCK_SIZE, default_lru_size);
 
 	rv = sqsh__map_manager_init(&archive->map_manager, source, config);
 	if (rv < 0) {
@@ -171,10 +190,8 @@ sqsh__archive_data_extract_manager(
 		struct SqshExtractManager **data_extract_manager) {
 	int rv = 0;
 	const struct SqshConfig *config = sqsh_archive_config(archive);
-	const int default_lru_size =
-			(int)SQSH_CONFIG_DEFAULT(config->compression_lru_size, 128);
-	const size_t data_lru_size =
-			SQSH_CONFIG_DEFAULT(config->data_lru_size, default_lru_size);
+	const size_t default_lru_size =
+			SQSH_CONFIG_DEFAULT(config->compression_lru_size, 128);
 
 	bool locked = false;
 	rv = sqsh__mutex_lock(&archive->lock, &locked);
@@ -186,6 +203,9 @@ sqsh__archive_data_extract_manager(
 				sqsh_archive_superblock(archive);
 		const uint32_t datablock_blocksize =
 				sqsh_superblock_block_size(superblock);
+		const size_t data_lru_size = sqsh__config_lru_size(
+				config->data_lru_size, config->data_lru_bytes,
+				config->lru_bytes / 2, datablock_blocksize, default_lru_size);
 
 		rv = sqsh__extract_manager_init(
 				&archive->data_extract_manager, archive, datablock_blocksize,
@@ -193,6 +213,12 @@ sqsh__archive_data_extract_manager(
 		if (rv < 0) {
 			goto out;
 		}
+		rv = sqsh__extract_manager_init_compressed_cache(
+				&archive->data_extract_manager, config->compressed_lru_bytes);
+		if (rv < 0) {
+			sqsh__extract_manager_cleanup(&archive->data_extract_manager);
+			goto out;
+		}
 		archive->initialized |= INITIALIZED_DATA_COMPRESSION_MANAGER;
 	}
 	*data_extract_manager = &archive->data_extract_manager;
@@ -306,6 +332,32 @@ out:
 	return rv;
 }
 
+int
+sqsh__archive_inode_cache(
+		struct SqshArchive *archive, struct SqshInodeCache **inode_cache) {
+	int rv = 0;
+	const struct SqshConfig *config = sqsh_archive_config(archive);
+	const size_t cache_size =
+			SQSH_CONFIG_DEFAULT(config->inode_cache_size, 4096);
+
+	bool locked = false;
+	rv = sqsh__mutex_lock(&archive->lock, &locked);
+	if (rv < 0) {
+		goto out;
+	}
+	if (!is_initialized(archive, INITIALIZED_INODE_CACHE)) {
+		rv = sqsh__inode_cache_init(&archive->inode_cache, cache_size);
+		if (rv < 0) {
+			goto out;
+		}
+		archive->initialized |= INITIALIZED_INODE_CACHE;
+	}
+	*inode_cache = &archive->inode_cache;
+out:
+	sqsh__mutex_unlock(&archive->lock, &locked);
+	return rv;
+}
+
 int
 sqsh_archive_xattr_table(
 		struct SqshArchive *archive, struct SqshXattrTable **xattr_table) {
@@ -339,6 +391,49 @@ sqsh_archive_map_manager(struct SqshArchive *archive) {
 	return &archive->map_manager;
 }
 
+int
+sqsh_archive_advise(
+		struct SqshArchive *archive, uint64_t offset, uint64_t size,
+		int advice) {
+	int rv = 0;
+	struct SqshMapManager *map_manager = &archive->map_manager;
+	const struct SqshMapper *mapper = &map_manager->mapper;
+	const uint64_t archive_size = sqsh__map_manager_size(map_manager);
+	const size_t block_size = sqsh__map_manager_block_size(map_manager);
+	uint64_t end;
+
+	/* Other mappers do not map the archive directly, so there is nothing
+	 * to advise. */
+	if (mapper->impl != sqsh_mapper_impl_mmap) {
+		return 0;
+	}
+	if (SQSH_ADD_OVERFLOW(offset, size, &end)) {
+		return -SQSH_ERROR_INTEGER_OVERFLOW;
+	}
+	end = SQSH_MIN(end, archive_size);
+
+	for (uint64_t index = offset / block_size;
+		 rv == 0 && index * block_size < end; index++) {
+		const struct SqshMapSlice *slice = NULL;
+		const uint64_t block_start = index * block_size;
+		const size_t start_in_block =
+				(size_t)(SQSH_MAX(offset, block_start) - block_start);
+		const size_t end_in_block =
+				(size_t)(SQSH_MIN(end, block_start + block_size) - block_start);
+
+		rv = sqsh__map_manager_get(map_manager, (size_t)index, &slice);
+		if (rv < 0) {
+			break;
+		}
+		rv = sqsh__mmap_mapper_advise(
+				mapper, (uint8_t *)&sqsh__map_slice_data(slice)[start_in_block],
+				end_in_block - start_in_block, advice);
+		sqsh__map_manager_release(map_manager, slice);
+	}
+
+	return rv;
+}
+
 const uint8_t *
 sqsh__archive_zero_block(const struct SqshArchive *archive) {
 	return archive->zero_block;
@@ -372,6 +467,9 @@ sqsh__archive_cleanup(struct SqshArchive *archive) {
 	if (is_initialized(archive, INITIALIZED_INODE_MAP)) {
 		sqsh__inode_map_cleanup(&archive->inode_map);
 	}
+	if (is_initialized(archive, INITIALIZED_INODE_CACHE)) {
+		sqsh__inode_cache_cleanup(&archive->inode_cache);
+	}
 	sqsh__extract_manager_cleanup(&archive->metablock_extract_manager);
 	sqsh__superblock_cleanup(&archive->superblock);
 	sqsh__map_manager_cleanup(&archive->map_manager);
@@ -0,0 +1,137 @@
+/******************************************************************************
+ *                                                                            *
+ * Copyright (c) 2023-2024, Enno Boland <g@s01.de>                            *
+ *                                                                            *
+ * Redistribution and use in source and binary forms, with or without         *
+ * modification, are permitted provided that the following conditions are     *
+ * met:                                                                       *
+ *                                                                            *
+ * * Redistributions of source code must retain the above copyright notice,   *
+ *   this list of conditions and the following disclaimer.                    *
+ * * Redistributions in binary form must reproduce the above copyright        *
+ *   notice, this list of conditions and the following disclaimer in the      *
+ *   documentation and/or other materials provided with the distribution.     *
+ *                                                                            *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS    *
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,  *
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR     *
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR          *
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,      *
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,        *
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR         *
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF     *
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING       *
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS         *
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.               *
+ *                                                                            *
+ ******************************************************************************/
+
+/**
+ * @author       Enno Boland (mail@eboland.de)
+ * @file         inode_cache.c
+ */
+
+#include <sqsh_archive_private.h>
+#include <sqsh_error.h>
+
+#include <stdlib.h>
+
+static size_t
+slot_index(const struct SqshInodeCache *cache, uint64_t inode_ref) {
+	/* Inodes that are stored next to each other only differ in the lower
+	 * bits of their reference. Spread them over the whole cache. */
+	const uint64_t hash = inode_ref * UINT64_C(0x9E3779B97F4A7C15);
+	return (size_t)(hash >> 32) & cache->slot_mask;
+}
+
+int
+sqsh__inode_cache_init(struct SqshInodeCache *cache, size_t capacity) {
+	int rv = 0;
+	size_t slot_count = 1;
+
+	cache->entries = NULL;
+	cache->slot_mask = 0;
+	if (capacity == 0) {
+		goto out;
+	}
+
+	while (slot_count < capacity) {
+		if (SQSH_MULT_OVERFLOW(slot_count, 2, &slot_count)) {
+			rv = -SQSH_ERROR_INTEGER_OVERFLOW;
+			goto out;
+		}
+	}
+	cache->entries = calloc(slot_count, sizeof(struct SqshInodeCacheEntry));
+	if (cache->entries == NULL) {
+		rv = -SQSH_ERROR_MALLOC_FAILED;
+		goto out;
+	}
+	cache->slot_mask = slot_count - 1;
+
+	rv = sqsh__mutex_init(&cache->lock);
+	if (rv < 0) {
+		free(cache->entries);
+		cache->entries = NULL;
+		goto out;
+	}
+
+out:
+	return rv;
+}
+
+bool
+sqsh__inode_cache_get(
+		struct SqshInodeCache *cache, uint64_t inode_ref,
+		struct SqshFileAttributes *attributes) {
+	bool found = false;
+	bool locked = false;
+
+	if (cache->entries == NULL) {
+		return false;
+	}
+	const struct SqshInodeCacheEntry *entry =
+			&cache->entries[slot_index(cache, inode_ref)];
+
+	if (sqsh__mutex_lock(&cache->lock, &locked) < 0) {
+		goto out;
+	}
+	if (entry->used && entry->attributes.inode_ref == inode_ref) {
+		*attributes = entry->attributes;
+		found = true;
+	}
+
+out:
+	sqsh__mutex_unlock(&cache->lock, &locked);
+	return found;
+}
+
+void
+sqsh__inode_cache_put(
+		struct SqshInodeCache *cache,
+		const struct SqshFileAttributes *attributes) {
+	bool locked = false;
+
+	if (cache->entries == NULL) {
+		return;
+	}
+	struct SqshInodeCacheEntry *entry =
+			&cache->entries[slot_index(cache, attributes->inode_ref)];
+
+	if (sqsh__mutex_lock(&cache->lock, &locked) < 0) {
+		return;
+	}
+	entry->attributes = *attributes;
+	entry->used = true;
+	sqsh__mutex_unlock(&cache->lock, &locked);
+}
+
+int
+sqsh__inode_cache_cleanup(struct SqshInodeCache *cache) {
+	if (cache->entries != NULL) {
+		sqsh__mutex_destroy(&cache->lock);
+	}
+	free(cache->entries);
+	cache->entries = NULL;
+	cache->slot_mask = 0;
+	return 0;
+}
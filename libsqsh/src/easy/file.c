@@ -37,7 +37,6 @@
 
 #include <pthread.h>
 #include <stdlib.h>
-#include <string.h>
 
 #include <sqsh_error.h>
 #include <sqsh_file_private.h>
@@ -75,7 +74,6 @@ uint8_t *
 sqsh_easy_file_content(
 		struct SqshArchive *archive, const char *path, int *err) {
 	int rv = 0;
-	struct SqshFileIterator iterator = {0};
 	struct SqshFile *file = NULL;
 	uint8_t *content = NULL;
 
@@ -83,9 +81,8 @@ sqsh_easy_file_content(
 	if (rv < 0) {
 		goto out;
 	}
-
-	rv = sqsh__file_iterator_init(&iterator, file);
-	if (rv < 0) {
+	if (sqsh_file_type(file) != SQSH_FILE_TYPE_FILE) {
+		rv = -SQSH_ERROR_NOT_A_FILE;
 		goto out;
 	}
 
@@ -100,15 +97,11 @@ sqsh_easy_file_content(
 		goto out;
 	}
 
-	for (size_t pos = 0; sqsh_file_iterator_next(&iterator, SIZE_MAX, &rv);) {
-		const uint8_t *data = sqsh_file_iterator_data(&iterator);
-		const size_t size = sqsh_file_iterator_size(&iterator);
-		memcpy(&content[pos], data, size);
-		pos += size;
-	}
+	/* The content is read once, so decode it directly into the result
+	 * instead of going through the block cache. */
+	rv = sqsh_file_read_into(file, 0, content, (size_t)file_size);
 
 out:
-	sqsh__file_iterator_cleanup(&iterator);
 	sqsh_close(file);
 	if (rv < 0) {
 		free(content);
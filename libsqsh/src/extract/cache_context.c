@@ -0,0 +1,224 @@
+/******************************************************************************
+ *                                                                            *
+ * Copyright (c) 2023-2024, Enno Boland <g@s01.de>                            *
+ *                                                                            *
+ * Redistribution and use in source and binary forms, with or without         *
+ * modification, are permitted provided that the following conditions are     *
+ * met:                                                                       *
+ *                                                                            *
+ * * Redistributions of source code must retain the above copyright notice,   *
+ *   this list of conditions and the following disclaimer.                    *
+ * * Redistributions in binary form must reproduce the above copyright        *
+ *   notice, this list of conditions and the following disclaimer in the      *
+ *   documentation and/or other materials provided with the distribution.     *
+ *                                                                            *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS    *
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,  *
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR     *
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR          *
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,      *
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,        *
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR         *
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF     *
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING       *
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS         *
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.               *
+ *                                                                            *
+ ******************************************************************************/
+
+/**
+ * @author       Enno Boland (mail@eboland.de)
+ * @file         cache_context.c
+ */
+
+#include <sqsh_extract_private.h>
+
+#include <sqsh_archive.h>
+#include <sqsh_error.h>
+
+#include <stdlib.h>
+
+/* The number of times a shrink skips caches that are locked by other
+ * threads before it gives up. */
+#define SQSH_CACHE_CONTEXT_MAX_BUSY 16
+
+/* Other caches are inspected without holding their lock, so their counts
+ * are only read atomically. */
+static size_t
+resident_count(const struct SqshExtractCache *cache) {
+	return __atomic_load_n(&cache->recent.count, __ATOMIC_RELAXED) +
+			__atomic_load_n(&cache->frequent.count, __ATOMIC_RELAXED);
+}
+
+static bool
+is_over_budget(struct SqshCacheContext *context) {
+	return __atomic_load_n(&context->size, __ATOMIC_RELAXED) > context->budget;
+}
+
+static struct SqshExtractCache *
+oldest_cache(
+		struct SqshCacheContext *context, struct SqshExtractCache *current) {
+	struct SqshExtractCache *oldest = NULL;
+	uint64_t oldest_access = UINT64_MAX;
+	struct SqshExtractCache *cache = context->caches;
+
+	for (; cache != NULL; cache = cache->context_next) {
+		/* Never evict the block that was just inserted. */
+		const size_t keep = cache == current ? 1 : 0;
+		if (resident_count(cache) <= keep) {
+			continue;
+		}
+		const uint64_t last_access =
+				__atomic_load_n(&cache->last_access, __ATOMIC_RELAXED);
+		if (last_access < oldest_access) {
+			oldest = cache;
+			oldest_access = last_access;
+		}
+	}
+	return oldest;
+}
+
+struct SqshCacheContext *
+sqsh_cache_context_new(uint64_t budget, int policy, int *err) {
+	int rv = 0;
+	struct SqshCacheContext *context =
+			calloc(1, sizeof(struct SqshCacheContext));
+	if (context == NULL) {
+		rv = -SQSH_ERROR_MALLOC_FAILED;
+		goto out;
+	}
+	rv = sqsh__mutex_init(&context->lock);
+	if (rv < 0) {
+		free(context);
+		context = NULL;
+		goto out;
+	}
+	context->budget = budget;
+	context->policy = policy;
+out:
+	if (err != NULL) {
+		*err = rv;
+	}
+	return context;
+}
+
+uint64_t
+sqsh_cache_context_size(const struct SqshCacheContext *context) {
+	return __atomic_load_n(&context->size, __ATOMIC_RELAXED);
+}
+
+int
+sqsh__cache_context_add(
+		struct SqshCacheContext *context, struct SqshExtractCache *cache) {
+	bool locked = false;
+	int rv = sqsh__mutex_lock(&context->lock, &locked);
+	if (rv < 0) {
+		goto out;
+	}
+
+	cache->context = context;
+	cache->context_prev = NULL;
+	cache->context_next = context->caches;
+	if (context->caches != NULL) {
+		context->caches->context_prev = cache;
+	}
+	context->caches = cache;
+	__atomic_add_fetch(&context->size, cache->size, __ATOMIC_RELAXED);
+
+out:
+	sqsh__mutex_unlock(&context->lock, &locked);
+	return rv;
+}
+
+int
+sqsh__cache_context_shrink(
+		struct SqshCacheContext *context, struct SqshExtractCache *current) {
+	bool locked = false;
+	size_t busy_count = 0;
+	int rv = sqsh__mutex_lock(&context->lock, &locked);
+	if (rv < 0) {
+		goto out;
+	}
+
+	while (is_over_budget(context)) {
+		struct SqshExtractCache *victim = oldest_cache(context, current);
+		if (victim == NULL) {
+			break;
+		}
+
+		/* The caller holds the lock of the current cache. Other caches are
+		 * only locked if that does not block, as their owners may be
+		 * waiting for the lock of the context while holding it. */
+		bool victim_locked = false;
+		if (victim != current) {
+			rv = sqsh__mutex_trylock(victim->lock, &victim_locked);
+			if (rv < 0) {
+				goto out;
+			}
+			if (victim_locked == false) {
+				/* A cache that is locked is in use. Treat it as recently
+				 * used and look for another one. */
+				const uint64_t clock = __atomic_add_fetch(
+						&context->clock, 1, __ATOMIC_RELAXED);
+				__atomic_store_n(
+						&victim->last_access, clock, __ATOMIC_RELAXED);
+				busy_count++;
+				if (busy_count > SQSH_CACHE_CONTEXT_MAX_BUSY) {
+					break;
+				}
+				continue;
+			}
+		}
+
+		const size_t keep = victim == current ? 1 : 0;
+		while (rv == 0 && is_over_budget(context) &&
+			   resident_count(victim) > keep) {
+			rv = sqsh__extract_cache_evict(victim);
+		}
+		sqsh__mutex_unlock(victim->lock, &victim_locked);
+		if (rv < 0) {
+			goto out;
+		}
+	}
+
+out:
+	sqsh__mutex_unlock(&context->lock, &locked);
+	return rv;
+}
+
+int
+sqsh__cache_context_remove(
+		struct SqshCacheContext *context, struct SqshExtractCache *cache) {
+	bool locked = false;
+	int rv = sqsh__mutex_lock(&context->lock, &locked);
+	if (rv < 0) {
+		goto out;
+	}
+
+	if (cache->context_prev != NULL) {
+		cache->context_prev->context_next = cache->context_next;
+	} else {
+		context->caches = cache->context_next;
+	}
+	if (cache->context_next != NULL) {
+		cache->context_next->context_prev = cache->context_prev;
+	}
+	cache->context_prev = NULL;
+	cache->context_next = NULL;
+	cache->context = NULL;
+	__atomic_sub_fetch(&context->size, cache->size, __ATOMIC_RELAXED);
+
+out:
+	sqsh__mutex_unlock(&context->lock, &locked);
+	return rv;
+}
+
+int
+sqsh_cache_context_free(struct SqshCacheContext *context) {
+	if (context == NULL) {
+		return 0;
+	}
+	int rv = sqsh__mutex_destroy(&context->lock);
+	free(context);
+	return rv;
+}
@@ -0,0 +1,421 @@
+/******************************************************************************
+ *                                                                            *
+ * Copyright (c) 2023-2024, Enno Boland <g@s01.de>                            *
+ *                                                                            *
+ * Redistribution and use in source and binary forms, with or without         *
+ * modification, are permitted provided that the following conditions are     *
+ * met:                                                                       *
+ *                                                                            *
+ * * Redistributions of source code must retain the above copyright notice,   *
+ *   this list of conditions and the following disclaimer.                    *
+ * * Redistributions in binary form must reproduce the above copyright        *
+ *   notice, this list of conditions and the following disclaimer in the      *
+ *   documentation and/or other materials provided with the distribution.     *
+ *                                                                            *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS    *
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,  *
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR     *
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR          *
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,      *
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,        *
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR         *
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF     *
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING       *
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS         *
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.               *
+ *                                                                            *
+ ******************************************************************************/
+
+/**
+ * @author       Enno Boland (mail@eboland.de)
+ * @file         extract_cache.c
+ */
+
+#include <sqsh_extract_private.h>
+
+#include <sqsh_archive.h>
+#include <sqsh_error.h>
+
+#include <cextras/collection.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NO_ENTRY SIZE_MAX
+
+/* The number of least recently used blocks of the main queue that are
+ * considered when choosing a block to evict. */
+#define EVICT_SAMPLE_SIZE 4
+
+enum SqshExtractCacheQueue {
+	QUEUE_NONE,
+	QUEUE_RECENT,
+	QUEUE_FREQUENT,
+	QUEUE_GHOST,
+};
+
+struct SqshExtractCacheEntry {
+	uint64_t address;
+	uint64_t cost;
+	size_t size;
+	size_t prev;
+	size_t next;
+	size_t hash_next;
+	enum SqshExtractCacheQueue queue;
+};
+
+static struct SqshExtractCacheList *
+queue_list(struct SqshExtractCache *cache, enum SqshExtractCacheQueue queue) {
+	switch (queue) {
+	case QUEUE_RECENT:
+		return &cache->recent;
+	case QUEUE_FREQUENT:
+		return &cache->frequent;
+	case QUEUE_GHOST:
+		return &cache->ghosts;
+	default:
+		return NULL;
+	}
+}
+
+static void
+list_init(struct SqshExtractCacheList *list) {
+	list->head = NO_ENTRY;
+	list->tail = NO_ENTRY;
+	list->count = 0;
+}
+
+static void
+list_unlink(struct SqshExtractCache *cache, size_t index) {
+	struct SqshExtractCacheEntry *entry = &cache->entries[index];
+	struct SqshExtractCacheList *list = queue_list(cache, entry->queue);
+
+	if (entry->prev != NO_ENTRY) {
+		cache->entries[entry->prev].next = entry->next;
+	} else {
+		list->head = entry->next;
+	}
+	if (entry->next != NO_ENTRY) {
+		cache->entries[entry->next].prev = entry->prev;
+	} else {
+		list->tail = entry->prev;
+	}
+	__atomic_sub_fetch(&list->count, 1, __ATOMIC_RELAXED);
+	entry->queue = QUEUE_NONE;
+}
+
+static void
+list_push(
+		struct SqshExtractCache *cache, size_t index,
+		enum SqshExtractCacheQueue queue) {
+	struct SqshExtractCacheEntry *entry = &cache->entries[index];
+	struct SqshExtractCacheList *list = queue_list(cache, queue);
+
+	entry->queue = queue;
+	entry->prev = NO_ENTRY;
+	entry->next = list->head;
+	if (list->head != NO_ENTRY) {
+		cache->entries[list->head].prev = index;
+	} else {
+		list->tail = index;
+	}
+	list->head = index;
+	__atomic_add_fetch(&list->count, 1, __ATOMIC_RELAXED);
+}
+
+static size_t
+hash_bucket(const struct SqshExtractCache *cache, uint64_t address) {
+	const uint64_t hash = address * UINT64_C(0x9E3779B97F4A7C15);
+	return (size_t)(hash >> 32) & cache->bucket_mask;
+}
+
+static size_t
+entry_find(const struct SqshExtractCache *cache, uint64_t address) {
+	size_t index = cache->buckets[hash_bucket(cache, address)];
+	while (index != NO_ENTRY && cache->entries[index].address != address) {
+		index = cache->entries[index].hash_next;
+	}
+	return index;
+}
+
+static size_t
+entry_new(struct SqshExtractCache *cache, uint64_t address) {
+	const size_t index = cache->free_entry;
+	struct SqshExtractCacheEntry *entry = &cache->entries[index];
+	const size_t bucket = hash_bucket(cache, address);
+
+	cache->free_entry = entry->next;
+	entry->address = address;
+	entry->cost = 0;
+	entry->queue = QUEUE_NONE;
+	entry->hash_next = cache->buckets[bucket];
+	cache->buckets[bucket] = index;
+	return index;
+}
+
+static void
+entry_free(struct SqshExtractCache *cache, size_t index) {
+	struct SqshExtractCacheEntry *entry = &cache->entries[index];
+	size_t *link = &cache->buckets[hash_bucket(cache, entry->address)];
+
+	while (*link != index) {
+		link = &cache->entries[*link].hash_next;
+	}
+	*link = entry->hash_next;
+
+	entry->next = cache->free_entry;
+	cache->free_entry = index;
+}
+
+static int
+entry_release(struct SqshExtractCache *cache, size_t index) {
+	const struct SqshExtractCacheEntry *entry = &cache->entries[index];
+
+	cache->size -= entry->size;
+	if (cache->context != NULL) {
+		__atomic_sub_fetch(
+				&cache->context->size, entry->size, __ATOMIC_RELAXED);
+	}
+	return cx_rc_hash_map_release_key(cache->backend, entry->address);
+}
+
+static size_t
+choose_victim(struct SqshExtractCache *cache) {
+	size_t victim = cache->frequent.tail;
+	if (cache->policy != SQSH_CACHE_POLICY_2Q) {
+		return victim;
+	}
+
+	/* Pick the cheapest of the least recently used blocks. Blocks that are
+	 * passed over lose half of their cost, so expensive blocks that are not
+	 * accessed anymore are evicted eventually. */
+	size_t index = victim;
+	for (size_t i = 1; i < EVICT_SAMPLE_SIZE; i++) {
+		index = cache->entries[index].prev;
+		if (index == NO_ENTRY) {
+			break;
+		}
+		if (cache->entries[index].cost < cache->entries[victim].cost) {
+			victim = index;
+		}
+	}
+	index = cache->frequent.tail;
+	for (size_t i = 0; i < EVICT_SAMPLE_SIZE && index != NO_ENTRY; i++) {
+		if (index != victim) {
+			cache->entries[index].cost /= 2;
+		}
+		index = cache->entries[index].prev;
+	}
+	return victim;
+}
+
+int
+sqsh__extract_cache_evict(struct SqshExtractCache *cache) {
+	int rv = 0;
+	size_t index;
+
+	if (cache->recent.count == 0 && cache->frequent.count == 0) {
+		return 0;
+	}
+	if (cache->recent.count > 0 &&
+		(cache->recent.count > cache->recent_capacity ||
+		 cache->frequent.count == 0)) {
+		index = cache->recent.tail;
+		list_unlink(cache, index);
+		rv = entry_release(cache, index);
+
+		/* Remember the address for a while. If it is accessed again, it
+		 * goes straight to the main queue. */
+		if (cache->ghost_capacity == 0) {
+			entry_free(cache, index);
+			return rv;
+		}
+		if (cache->ghosts.count == cache->ghost_capacity) {
+			const size_t oldest = cache->ghosts.tail;
+			list_unlink(cache, oldest);
+			entry_free(cache, oldest);
+		}
+		list_push(cache, index, QUEUE_GHOST);
+	} else {
+		index = choose_victim(cache);
+		list_unlink(cache, index);
+		rv = entry_release(cache, index);
+		entry_free(cache, index);
+	}
+	return rv;
+}
+
+int
+sqsh__extract_cache_init(
+		struct SqshExtractCache *cache, size_t capacity, int policy,
+		struct CxRcHashMap *backend) {
+	int rv = 0;
+	memset(cache, 0, sizeof(*cache));
+	cache->backend = backend;
+	cache->policy = policy;
+	cache->capacity = capacity;
+	list_init(&cache->recent);
+	list_init(&cache->frequent);
+	list_init(&cache->ghosts);
+	cache->free_entry = NO_ENTRY;
+	if (capacity == 0) {
+		goto out;
+	}
+
+	if (policy == SQSH_CACHE_POLICY_2Q) {
+		cache->recent_capacity = SQSH_MAX(capacity / 4, (size_t)1);
+		cache->ghost_capacity = SQSH_MAX(capacity / 2, (size_t)1);
+	}
+
+	/* One more entry than can be resident is needed, as a new block is
+	 * inserted before another one is evicted. */
+	size_t entry_count;
+	if (SQSH_ADD_OVERFLOW(capacity, cache->ghost_capacity, &entry_count) ||
+		SQSH_ADD_OVERFLOW(entry_count, 1, &entry_count)) {
+		rv = -SQSH_ERROR_INTEGER_OVERFLOW;
+		goto out;
+	}
+	size_t bucket_count = 1;
+	while (bucket_count < entry_count) {
+		bucket_count *= 2;
+	}
+
+	cache->entries = calloc(entry_count, sizeof(*cache->entries));
+	cache->buckets = calloc(bucket_count, sizeof(*cache->buckets));
+	if (cache->entries == NULL || cache->buckets == NULL) {
+		rv = -SQSH_ERROR_MALLOC_FAILED;
+		goto out;
+	}
+	cache->entry_count = entry_count;
+	cache->bucket_mask = bucket_count - 1;
+	for (size_t i = 0; i < bucket_count; i++) {
+		cache->buckets[i] = NO_ENTRY;
+	}
+	for (size_t i = entry_count; i > 0; i--) {
+		cache->entries[i - 1].next = cache->free_entry;
+		cache->free_entry = i - 1;
+	}
+
+out:
+	if (rv < 0) {
+		sqsh__extract_cache_cleanup(cache);
+	}
+	return rv;
+}
+
+static bool
+is_over_capacity(const struct SqshExtractCache *cache) {
+	const size_t count = cache->recent.count + cache->frequent.count;
+	if (count > cache->capacity) {
+		return true;
+	}
+	return cache->max_size != 0 && cache->size > cache->max_size && count > 1;
+}
+
+void
+sqsh__extract_cache_limit_size(
+		struct SqshExtractCache *cache, uint64_t max_size) {
+	cache->max_size = max_size;
+}
+
+int
+sqsh__extract_cache_attach(
+		struct SqshExtractCache *cache, struct SqshCacheContext *context,
+		sqsh__mutex_t *lock) {
+	if (cache->capacity == 0) {
+		return 0;
+	}
+	cache->lock = lock;
+	return sqsh__cache_context_add(context, cache);
+}
+
+int
+sqsh__extract_cache_touch(
+		struct SqshExtractCache *cache, uint64_t address, size_t size,
+		uint64_t cost) {
+	int rv = 0;
+	if (cache->capacity == 0) {
+		return 0;
+	}
+	if (cache->context != NULL) {
+		const uint64_t clock = __atomic_add_fetch(
+				&cache->context->clock, 1, __ATOMIC_RELAXED);
+		__atomic_store_n(&cache->last_access, clock, __ATOMIC_RELAXED);
+	}
+
+	size_t index = entry_find(cache, address);
+	if (index == NO_ENTRY) {
+		index = entry_new(cache, address);
+	} else if (cache->entries[index].queue == QUEUE_FREQUENT) {
+		list_unlink(cache, index);
+		list_push(cache, index, QUEUE_FREQUENT);
+	}
+	struct SqshExtractCacheEntry *entry = &cache->entries[index];
+	if (cost != 0) {
+		entry->cost = cost;
+	}
+
+	switch (entry->queue) {
+	case QUEUE_RECENT:
+	case QUEUE_FREQUENT:
+		return 0;
+	case QUEUE_GHOST:
+		list_unlink(cache, index);
+		list_push(cache, index, QUEUE_FREQUENT);
+		break;
+	case QUEUE_NONE:
+		if (cache->policy == SQSH_CACHE_POLICY_2Q) {
+			list_push(cache, index, QUEUE_RECENT);
+		} else {
+			list_push(cache, index, QUEUE_FREQUENT);
+		}
+		break;
+	}
+
+	if (cx_rc_hash_map_retain(cache->backend, address) == NULL) {
+		list_unlink(cache, index);
+		entry_free(cache, index);
+		return -SQSH_ERROR_INTERNAL;
+	}
+	entry->size = size;
+	cache->size += size;
+	if (cache->context != NULL) {
+		__atomic_add_fetch(&cache->context->size, size, __ATOMIC_RELAXED);
+	}
+
+	while (rv == 0 && is_over_capacity(cache)) {
+		rv = sqsh__extract_cache_evict(cache);
+	}
+	if (rv == 0 && cache->context != NULL) {
+		rv = sqsh__cache_context_shrink(cache->context, cache);
+	}
+	return rv;
+}
+
+int
+sqsh__extract_cache_cleanup(struct SqshExtractCache *cache) {
+	int rv = 0;
+	const struct SqshExtractCacheList *lists[] = {
+			&cache->recent, &cache->frequent};
+
+	if (cache->context != NULL) {
+		rv = sqsh__cache_context_remove(cache->context, cache);
+	}
+
+	for (size_t i = 0; i < sizeof(lists) / sizeof(lists[0]); i++) {
+		if (cache->entries == NULL) {
+			break;
+		}
+		size_t index = lists[i]->head;
+		for (; index != NO_ENTRY; index = cache->entries[index].next) {
+			int release_rv = cx_rc_hash_map_release_key(
+					cache->backend, cache->entries[index].address);
+			if (release_rv < 0) {
+				rv = release_rv;
+			}
+		}
+	}
+	free(cache->entries);
+	free(cache->buckets);
+	memset(cache, 0, sizeof(*cache));
+	return rv;
+}
@@ -31,6 +31,8 @@
  * @file         extract_manager.c
  */
 
+#define _DEFAULT_SOURCE
+
 #include <sqsh_extract_private.h>
 
 #include <sqsh_archive.h>
@@ -38,19 +40,87 @@
 #include <sqsh_error.h>
 
 #include <cextras/collection.h>
+#include <stdlib.h>
+#include <string.h>
 #include <sqsh_mapper.h>
 #include <sqsh_mapper_private.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/* The number of evicted buffers that are kept for reuse. */
+#define SQSH_EXTRACT_BUFFER_POOL_SIZE 8
+
+/**
+ * The value type of the cache. Callers only see the CxBuffer.
+ */
+struct SqshExtractBuffer {
+	struct CxBuffer buffer;
+	struct SqshExtractManager *manager;
+};
 
 static void
 buffer_cleanup(void *buffer) {
 	cx_buffer_cleanup(buffer);
 }
 
+static void
+buffer_release_pages(const struct CxBuffer *buffer) {
+#ifdef MADV_FREE
+	const long page_size = sysconf(_SC_PAGESIZE);
+	if (page_size <= 0) {
+		return;
+	}
+	const uintptr_t page_mask = (uintptr_t)page_size - 1;
+	uintptr_t start = (uintptr_t)cx_buffer_data(buffer);
+	uintptr_t end = start + cx_buffer_size(buffer);
+	start = (start + page_mask) & ~page_mask;
+	end &= ~page_mask;
+
+	/* Only whole pages inside of the allocation are released. The kernel
+	 * reclaims them lazily, and writing to them cancels that. */
+	if (start < end) {
+		madvise((void *)start, end - start, MADV_FREE);
+	}
+#else
+	(void)buffer;
+#endif
+}
+
+static void
+pooled_buffer_cleanup(void *data) {
+	struct SqshExtractBuffer *buffer = data;
+	struct SqshExtractManager *manager = buffer->manager;
+
+	/* This is called with the lock of the manager held. */
+	if (manager->buffer_pool != NULL &&
+		manager->buffer_pool_count < SQSH_EXTRACT_BUFFER_POOL_SIZE) {
+		buffer_release_pages(&buffer->buffer);
+		manager->buffer_pool[manager->buffer_pool_count] = buffer->buffer;
+		manager->buffer_pool_count++;
+	} else {
+		cx_buffer_cleanup(&buffer->buffer);
+	}
+}
+
+static int
+buffer_pool_take(
+		struct SqshExtractManager *manager, struct SqshExtractBuffer *buffer) {
+	buffer->manager = manager;
+	if (manager->buffer_pool_count == 0) {
+		return cx_buffer_init(&buffer->buffer);
+	}
+	manager->buffer_pool_count--;
+	buffer->buffer = manager->buffer_pool[manager->buffer_pool_count];
+	cx_buffer_drain(&buffer->buffer);
+	return 0;
+}
+
 SQSH_NO_UNUSED int
 sqsh__extract_manager_init(
 		struct SqshExtractManager *manager, struct SqshArchive *archive,
 		uint32_t block_size, size_t lru_size) {
 	int rv;
+	const struct SqshConfig *config = sqsh_archive_config(archive);
 	const struct SqshSuperblock *superblock = sqsh_archive_superblock(archive);
 	enum SqshSuperblockCompressionId compression_id =
 			sqsh_superblock_compression_id(superblock);
@@ -64,16 +134,37 @@ sqsh__extract_manager_init(
 	if (rv < 0) {
 		goto out;
 	}
+	rv = sqsh__extractor_pool_init(
+			&manager->decoder_pool, manager->extractor_impl);
+	if (rv < 0) {
+		goto out;
+	}
+	manager->buffer_pool = calloc(
+			SQSH_EXTRACT_BUFFER_POOL_SIZE, sizeof(struct CxBuffer));
+	if (manager->buffer_pool == NULL) {
+		rv = -SQSH_ERROR_MALLOC_FAILED;
+		goto out;
+	}
 	rv = cx_rc_hash_map_init(
-			&manager->cache, lru_size, sizeof(struct CxBuffer), buffer_cleanup);
+			&manager->cache, lru_size, sizeof(struct SqshExtractBuffer),
+			pooled_buffer_cleanup);
 	if (rv < 0) {
 		goto out;
 	}
-	rv = cx_lru_init(
-			&manager->lru, lru_size, &cx_lru_rc_hash_map, &manager->cache);
+	struct SqshCacheContext *context = config->cache_context;
+	const int policy =
+			context != NULL ? context->policy : config->cache_policy;
+	rv = sqsh__extract_cache_init(
+			&manager->lru, lru_size, policy, &manager->cache);
 	if (rv < 0) {
 		goto out;
 	}
+	if (context != NULL) {
+		rv = sqsh__extract_cache_attach(&manager->lru, context, &manager->lock);
+		if (rv < 0) {
+			goto out;
+		}
+	}
 	manager->map_manager = sqsh_archive_map_manager(archive);
 
 	manager->block_size = block_size;
@@ -85,22 +176,63 @@ out:
 	return rv;
 }
 
+int
+sqsh__extract_manager_init_compressed_cache(
+		struct SqshExtractManager *manager, uint64_t max_size) {
+	int rv = 0;
+	if (max_size == 0) {
+		goto out;
+	}
+
+	/* Assume that blocks compress to an eighth of their size at most to
+	 * size the entry table. The byte limit is what bounds the cache. */
+	const uint64_t entry_size = SQSH_MAX(manager->block_size / 8, 1);
+	const size_t capacity =
+			(size_t)SQSH_MAX(SQSH_DIVIDE_CEIL(max_size, entry_size), 1);
+	rv = cx_rc_hash_map_init(
+			&manager->compressed, capacity, sizeof(struct CxBuffer),
+			buffer_cleanup);
+	if (rv < 0) {
+		goto out;
+	}
+	rv = sqsh__extract_cache_init(
+			&manager->compressed_lru, capacity, SQSH_CACHE_POLICY_LRU,
+			&manager->compressed);
+	if (rv < 0) {
+		cx_rc_hash_map_cleanup(&manager->compressed);
+		goto out;
+	}
+	sqsh__extract_cache_limit_size(&manager->compressed_lru, max_size);
+	manager->keep_compressed = true;
+
+out:
+	return rv;
+}
+
 static int
-extract(struct SqshExtractManager *manager, const struct SqshMapReader *reader,
+extract(struct SqshExtractManager *manager, const uint8_t *data, size_t size,
 		struct CxBuffer *buffer) {
 	int rv = 0;
 	struct SqshExtractor extractor = {0};
+	void *decoder = NULL;
 	const struct SqshExtractorImpl *extractor_impl = manager->extractor_impl;
 	const uint32_t block_size = manager->block_size;
-	const size_t size = sqsh__map_reader_size(reader);
 
-	rv = cx_buffer_init(buffer);
+	rv = sqsh__extractor_pool_acquire(&manager->decoder_pool, &decoder);
 	if (rv < 0) {
 		goto out;
 	}
-	const uint8_t *data = sqsh__map_reader_data(reader);
 
-	rv = sqsh__extractor_init(&extractor, buffer, extractor_impl, block_size);
+	/* The map reader always presents the compressed block as one contiguous
+	 * buffer, so backends that support it can decode it in a single call. */
+	if (decoder != NULL && extractor_impl->decompress != NULL) {
+		rv = sqsh__extractor_decompress(
+				buffer, extractor_impl, block_size, decoder, data, size);
+		goto out;
+	}
+
+	rv = sqsh__extractor_init_with_decoder(
+			&extractor, buffer, extractor_impl, block_size, decoder);
 	if (rv < 0) {
 		goto out;
 	}
@@ -120,58 +252,312 @@ out:
 		cx_buffer_cleanup(buffer);
 	}
 	sqsh__extractor_cleanup(&extractor);
+	sqsh__extractor_pool_release(&manager->decoder_pool, decoder);
 	return rv;
 }
 
-int
-sqsh__extract_manager_uncompress(
-		struct SqshExtractManager *manager, const struct SqshMapReader *reader,
-		struct CxBuffer **target) {
+struct SqshExtractInflight {
+	struct SqshExtractInflight *next;
+	uint64_t address;
+	sqsh__cond_t finished_cond;
+	bool finished;
+	int result;
+	size_t ref_count;
+};
+
+static struct SqshExtractInflight *
+inflight_find(const struct SqshExtractManager *manager, uint64_t address) {
+	struct SqshExtractInflight *inflight = manager->inflight;
+	for (; inflight != NULL; inflight = inflight->next) {
+		if (inflight->address == address) {
+			return inflight;
+		}
+	}
+	return NULL;
+}
+
+static void
+inflight_unlink(
+		struct SqshExtractManager *manager,
+		const struct SqshExtractInflight *inflight) {
+	struct SqshExtractInflight **link = &manager->inflight;
+	for (; *link != NULL; link = &(*link)->next) {
+		if (*link == inflight) {
+			*link = inflight->next;
+			return;
+		}
+	}
+}
+
+static void
+inflight_release(struct SqshExtractInflight *inflight) {
+	inflight->ref_count--;
+	if (inflight->ref_count == 0) {
+		sqsh__cond_destroy(&inflight->finished_cond);
+		free(inflight);
+	}
+}
+
+static int
+keep_compressed(
+		struct SqshExtractManager *manager, uint64_t address,
+		struct CxBuffer *compressed) {
+	int rv = 0;
+	struct CxBuffer *buffer =
+			cx_rc_hash_map_put(&manager->compressed, address, compressed);
+	if (buffer == NULL) {
+		cx_buffer_cleanup(compressed);
+		return -SQSH_ERROR_MALLOC_FAILED;
+	}
+	rv = sqsh__extract_cache_touch(
+			&manager->compressed_lru, address, cx_buffer_size(buffer), 1);
+	cx_rc_hash_map_release_key(&manager->compressed, address);
+	return rv;
+}
+
+/**
+ * Looks up a block in the caches and decompresses it if needed. If reader is
+ * NULL, the block is only decompressed from the compressed cache and target
+ * is set to NULL if it is not found there.
+ */
+static int
+uncompress(
+		struct SqshExtractManager *manager, uint64_t address,
+		const struct SqshMapReader *reader, struct CxBuffer **target) {
 	int rv = 0;
 	bool locked = false;
 	struct CxBuffer *buffer = NULL;
+	struct CxBuffer *compressed = NULL;
+	struct CxBuffer compressed_copy = {0};
+	bool has_compressed_copy = false;
+	struct SqshExtractInflight *inflight = NULL;
+	uint64_t cost = 0;
 
+	*target = NULL;
 	rv = sqsh__mutex_lock(&manager->lock, &locked);
 	if (rv < 0) {
 		goto out;
 	}
 
-	const uint64_t address = sqsh__map_reader_address(reader);
+	while ((buffer = cx_rc_hash_map_retain(&manager->cache, address)) == NULL) {
+		inflight = inflight_find(manager, address);
+		if (inflight == NULL) {
+			break;
+		}
+		if (reader == NULL) {
+			/* Let the caller map the block and wait for it there. */
+			inflight = NULL;
+			goto out;
+		}
 
-	buffer = cx_rc_hash_map_retain(&manager->cache, address);
+		/* Another thread is already decompressing this block. Wait for it to
+		 * finish and look the block up in the cache again. */
+		inflight->ref_count++;
+		while (inflight->finished == false) {
+			rv = sqsh__cond_wait(&inflight->finished_cond, &manager->lock);
+			if (rv < 0) {
+				break;
+			}
+		}
+		if (rv == 0) {
+			rv = inflight->result;
+		}
+		inflight_release(inflight);
+		inflight = NULL;
+		if (rv < 0) {
+			goto out;
+		}
+	}
 
 	if (buffer == NULL) {
-		struct CxBuffer tmp_buffer = {0};
+		struct SqshExtractBuffer tmp_buffer = {0};
+
+		if (manager->keep_compressed) {
+			compressed = cx_rc_hash_map_retain(&manager->compressed, address);
+		}
+		if (compressed == NULL && reader == NULL) {
+			goto out;
+		}
+
+		inflight = calloc(1, sizeof(struct SqshExtractInflight));
+		if (inflight == NULL) {
+			rv = -SQSH_ERROR_MALLOC_FAILED;
+			goto out;
+		}
+		rv = sqsh__cond_init(&inflight->finished_cond);
+		if (rv < 0) {
+			free(inflight);
+			inflight = NULL;
+			goto out;
+		}
+		rv = buffer_pool_take(manager, &tmp_buffer);
+		if (rv < 0) {
+			sqsh__cond_destroy(&inflight->finished_cond);
+			free(inflight);
+			inflight = NULL;
+			goto out;
+		}
+		inflight->address = address;
+		inflight->ref_count = 1;
+		inflight->next = manager->inflight;
+		manager->inflight = inflight;
+
 		rv = sqsh__mutex_unlock(&manager->lock, &locked);
 		if (rv < 0) {
+			cx_buffer_cleanup(&tmp_buffer.buffer);
 			goto out;
 		}
 
-		rv = extract(manager, reader, &tmp_buffer);
+		if (compressed != NULL) {
+			rv = extract(
+					manager, cx_buffer_data(compressed),
+					cx_buffer_size(compressed), &tmp_buffer.buffer);
+		} else {
+			const uint8_t *data = sqsh__map_reader_data(reader);
+			const size_t size = sqsh__map_reader_size(reader);
+			rv = extract(manager, data, size, &tmp_buffer.buffer);
+			/* Keep a copy of the compressed block, so it does not need to be
+			 * mapped again once the decompressed block is evicted. */
+			if (rv == 0 && manager->keep_compressed) {
+				rv = cx_buffer_init(&compressed_copy);
+				has_compressed_copy = rv == 0;
+				if (rv == 0) {
+					rv = cx_buffer_append(&compressed_copy, data, size);
+				}
+				if (rv < 0) {
+					cx_buffer_cleanup(&tmp_buffer.buffer);
+				}
+			}
+		}
 		if (rv < 0) {
 			goto out;
 		}
 
 		rv = sqsh__mutex_lock(&manager->lock, &locked);
 		if (rv < 0) {
+			cx_buffer_cleanup(&tmp_buffer.buffer);
 			goto out;
 		}
 
 		buffer = cx_rc_hash_map_put(&manager->cache, address, &tmp_buffer);
 		if (buffer == NULL) {
-			cx_buffer_cleanup(&tmp_buffer);
+			cx_buffer_cleanup(&tmp_buffer.buffer);
 			rv = -SQSH_ERROR_MALLOC_FAILED;
 			goto out;
 		}
+		if (compressed != NULL) {
+			rv = sqsh__extract_cache_touch(
+					&manager->compressed_lru, address,
+					cx_buffer_size(compressed), 0);
+		} else if (manager->keep_compressed) {
+			has_compressed_copy = false;
+			rv = keep_compressed(manager, address, &compressed_copy);
+		}
+		if (rv < 0) {
+			cx_rc_hash_map_release_key(&manager->cache, address);
+			buffer = NULL;
+			goto out;
+		}
+		cost = (uint64_t)cx_buffer_size(buffer) *
+				sqsh__extractor_impl_decode_cost(manager->extractor_impl);
 	}
-	rv = cx_lru_touch_value(&manager->lru, address, buffer);
+	rv = sqsh__extract_cache_touch(
+			&manager->lru, address, cx_buffer_size(buffer), cost);
 	*target = buffer;
 
 out:
+	if (has_compressed_copy) {
+		cx_buffer_cleanup(&compressed_copy);
+	}
+	if (compressed != NULL) {
+		if (locked == false &&
+			sqsh__mutex_lock(&manager->lock, &locked) < 0) {
+			return rv;
+		}
+		cx_rc_hash_map_release_key(&manager->compressed, address);
+	}
+	if (inflight != NULL) {
+		if (locked == false &&
+			sqsh__mutex_lock(&manager->lock, &locked) < 0) {
+			/* We cannot wake up the waiters without holding the lock.
+			 * Leave the entry in place. */
+			return rv;
+		}
+		inflight_unlink(manager, inflight);
+		inflight->result = rv;
+		inflight->finished = true;
+		sqsh__cond_broadcast(&inflight->finished_cond);
+		inflight_release(inflight);
+	}
 	sqsh__mutex_unlock(&manager->lock, &locked);
 	return rv;
 }
 
+int
+sqsh__extract_manager_uncompress(
+		struct SqshExtractManager *manager, const struct SqshMapReader *reader,
+		struct CxBuffer **target) {
+	const uint64_t address = sqsh__map_reader_address(reader);
+	return uncompress(manager, address, reader, target);
+}
+
+int
+sqsh__extract_manager_lookup(
+		struct SqshExtractManager *manager, uint64_t address,
+		struct CxBuffer **target) {
+	int rv = uncompress(manager, address, NULL, target);
+	if (rv < 0) {
+		return rv;
+	}
+	return *target != NULL ? 1 : 0;
+}
+
+int
+sqsh__extract_manager_decompress_into(
+		struct SqshExtractManager *manager, const struct SqshMapReader *reader,
+		uint8_t *target, size_t *target_size) {
+	int rv = 0;
+	void *decoder = NULL;
+	struct CxBuffer buffer = {0};
+	const struct SqshExtractorImpl *extractor_impl = manager->extractor_impl;
+	const uint8_t *data = sqsh__map_reader_data(reader);
+	const size_t size = sqsh__map_reader_size(reader);
+
+	rv = sqsh__extractor_pool_acquire(&manager->decoder_pool, &decoder);
+	if (rv < 0) {
+		goto out;
+	}
+	if (decoder != NULL && extractor_impl->decompress != NULL) {
+		rv = extractor_impl->decompress(
+				decoder, target, target_size, data, size);
+		goto out;
+	}
+
+	/* Backends that can only stream need a buffer that grows while
+	 * decoding. Decode into a temporary one and copy it out. */
+	sqsh__extractor_pool_release(&manager->decoder_pool, decoder);
+	decoder = NULL;
+	rv = cx_buffer_init(&buffer);
+	if (rv < 0) {
+		goto out;
+	}
+	rv = extract(manager, data, size, &buffer);
+	if (rv < 0) {
+		goto out;
+	}
+	if (cx_buffer_size(&buffer) > *target_size) {
+		rv = -SQSH_ERROR_SIZE_MISMATCH;
+	} else {
+		*target_size = cx_buffer_size(&buffer);
+		memcpy(target, cx_buffer_data(&buffer), *target_size);
+	}
+	cx_buffer_cleanup(&buffer);
+
+out:
+	sqsh__extractor_pool_release(&manager->decoder_pool, decoder);
+	return rv;
+}
+
 int
 sqsh__extract_manager_retain_buffer(
 		struct SqshExtractManager *manager, const struct CxBuffer *buffer) {
@@ -197,8 +583,20 @@ out:
 
 int
 sqsh__extract_manager_cleanup(struct SqshExtractManager *manager) {
-	cx_lru_cleanup(&manager->lru);
+	sqsh__extract_cache_cleanup(&manager->lru);
+	if (manager->keep_compressed) {
+		sqsh__extract_cache_cleanup(&manager->compressed_lru);
+		cx_rc_hash_map_cleanup(&manager->compressed);
+		manager->keep_compressed = false;
+	}
+	for (size_t i = 0; i < manager->buffer_pool_count; i++) {
+		cx_buffer_cleanup(&manager->buffer_pool[i]);
+	}
+	free(manager->buffer_pool);
+	manager->buffer_pool = NULL;
+	manager->buffer_pool_count = 0;
 	cx_rc_hash_map_cleanup(&manager->cache);
+	sqsh__extractor_pool_cleanup(&manager->decoder_pool);
 	sqsh__mutex_destroy(&manager->lock);
 
 	return 0;
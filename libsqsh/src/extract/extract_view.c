@@ -59,6 +59,24 @@ out:
 	return rv;
 }
 
+int
+sqsh__extract_view_lookup(
+		struct SqshExtractView *view, struct SqshExtractManager *manager,
+		uint64_t address) {
+	int rv = 0;
+	memset(view, 0, sizeof(struct SqshExtractView));
+
+	rv = sqsh__extract_manager_lookup(manager, address, &view->buffer);
+	if (rv <= 0) {
+		goto out;
+	}
+	view->address = address;
+	view->manager = manager;
+	view->size = cx_buffer_size(view->buffer);
+out:
+	return rv;
+}
+
 int
 sqsh__extract_view_copy(
 		struct SqshExtractView *target, const struct SqshExtractView *source) {
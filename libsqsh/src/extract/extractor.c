@@ -36,6 +36,7 @@
 #include <cextras/collection.h>
 #include <sqsh_archive.h>
 #include <sqsh_error.h>
+#include <stdlib.h>
 #include <string.h>
 
 // sqsh__impl_lzo needs to be declared `volatile`. Otherwise when compiled with
@@ -64,10 +65,38 @@ sqsh__extractor_impl_from_id(enum SqshSuperblockCompressionId id) {
 	}
 }
 
+bool
+sqsh__extractor_impl_is_builtin(const struct SqshExtractorImpl *impl) {
+	if (impl == NULL) {
+		return false;
+	}
+	return impl == sqsh__impl_zlib || impl == sqsh__impl_lzma ||
+			impl == sqsh__impl_xz || impl == sqsh__impl_lz4 ||
+			impl == sqsh__impl_zstd;
+}
+
+uint32_t
+sqsh__extractor_impl_decode_cost(const struct SqshExtractorImpl *impl) {
+	if (sqsh__extractor_impl_is_builtin(impl) == false ||
+		impl->decode_cost == 0) {
+		return 1;
+	}
+	return impl->decode_cost;
+}
+
 int
 sqsh__extractor_init(
 		struct SqshExtractor *extractor, struct CxBuffer *buffer,
 		const struct SqshExtractorImpl *impl, size_t block_size) {
+	return sqsh__extractor_init_with_decoder(
+			extractor, buffer, impl, block_size, NULL);
+}
+
+int
+sqsh__extractor_init_with_decoder(
+		struct SqshExtractor *extractor, struct CxBuffer *buffer,
+		const struct SqshExtractorImpl *impl, size_t block_size,
+		void *decoder) {
 	int rv = 0;
 	memset(extractor, 0, sizeof(*extractor));
 	extractor->block_size = block_size;
@@ -81,7 +110,13 @@ sqsh__extractor_init(
 		goto out;
 	}
 
-	rv = impl->init(&extractor->context, extractor->target, block_size);
+	if (decoder != NULL && sqsh__extractor_impl_is_builtin(impl) &&
+		impl->init_with_decoder != NULL) {
+		rv = impl->init_with_decoder(
+				&extractor->context, decoder, extractor->target, block_size);
+	} else {
+		rv = impl->init(&extractor->context, extractor->target, block_size);
+	}
 	if (rv < 0) {
 		goto out;
 	}
@@ -148,3 +183,113 @@ sqsh__extractor_cleanup(struct SqshExtractor *extractor) {
 	memset(extractor, 0, sizeof(*extractor));
 	return rv;
 }
+
+int
+sqsh__extractor_decompress(
+		struct CxBuffer *buffer, const struct SqshExtractorImpl *impl,
+		size_t block_size, void *decoder, const uint8_t *compressed,
+		size_t compressed_size) {
+	int rv = 0;
+	uint8_t *target = NULL;
+	size_t size = block_size;
+
+	if (sqsh__extractor_impl_is_builtin(impl) == false ||
+		impl->decompress == NULL || decoder == NULL) {
+		rv = -SQSH_ERROR_COMPRESSION_UNSUPPORTED;
+		goto out;
+	}
+	rv = cx_buffer_add_capacity(buffer, &target, block_size);
+	if (rv < 0) {
+		goto out;
+	}
+
+	rv = impl->decompress(decoder, target, &size, compressed, compressed_size);
+	if (rv < 0) {
+		goto out;
+	}
+
+	rv = cx_buffer_add_size(buffer, size);
+out:
+	return rv;
+}
+
+int
+sqsh__extractor_pool_init(
+		struct SqshExtractorPool *pool, const struct SqshExtractorImpl *impl) {
+	pool->impl = impl;
+	pool->decoders = NULL;
+	pool->decoder_count = 0;
+	pool->decoder_capacity = 0;
+	return sqsh__mutex_init(&pool->lock);
+}
+
+int
+sqsh__extractor_pool_acquire(struct SqshExtractorPool *pool, void **decoder) {
+	int rv = 0;
+	bool locked = false;
+	const struct SqshExtractorImpl *impl = pool->impl;
+	*decoder = NULL;
+
+	if (sqsh__extractor_impl_is_builtin(impl) == false ||
+		impl->decoder_new == NULL) {
+		goto out;
+	}
+
+	rv = sqsh__mutex_lock(&pool->lock, &locked);
+	if (rv < 0) {
+		goto out;
+	}
+	if (pool->decoder_count > 0) {
+		pool->decoder_count--;
+		*decoder = pool->decoders[pool->decoder_count];
+	}
+	sqsh__mutex_unlock(&pool->lock, &locked);
+
+	if (*decoder == NULL) {
+		rv = impl->decoder_new(decoder);
+	}
+
+out:
+	return rv;
+}
+
+void
+sqsh__extractor_pool_release(struct SqshExtractorPool *pool, void *decoder) {
+	bool locked = false;
+
+	if (decoder == NULL) {
+		return;
+	}
+
+	if (sqsh__mutex_lock(&pool->lock, &locked) < 0) {
+		pool->impl->decoder_free(decoder);
+		return;
+	}
+	if (pool->decoder_count == pool->decoder_capacity) {
+		size_t capacity = SQSH_MAX(pool->decoder_capacity * 2, (size_t)4);
+		void **decoders =
+				realloc(pool->decoders, capacity * sizeof(void *));
+		if (decoders == NULL) {
+			sqsh__mutex_unlock(&pool->lock, &locked);
+			pool->impl->decoder_free(decoder);
+			return;
+		}
+		pool->decoders = decoders;
+		pool->decoder_capacity = capacity;
+	}
+	pool->decoders[pool->decoder_count] = decoder;
+	pool->decoder_count++;
+	sqsh__mutex_unlock(&pool->lock, &locked);
+}
+
+int
+sqsh__extractor_pool_cleanup(struct SqshExtractorPool *pool) {
+	for (size_t i = 0; i < pool->decoder_count; i++) {
+		pool->impl->decoder_free(pool->decoders[i]);
+	}
+	free(pool->decoders);
+	pool->decoders = NULL;
+	pool->decoder_count = 0;
+	pool->decoder_capacity = 0;
+	return sqsh__mutex_destroy(&pool->lock);
+}
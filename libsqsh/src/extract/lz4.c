@@ -37,6 +37,7 @@
 
 #ifdef CONFIG_LZ4
 
+#	include <limits.h>
 #	include <lz4.h>
 
 struct SqshLz4Context {
@@ -44,6 +45,7 @@ struct SqshLz4Context {
 	uint8_t *target;
 	size_t target_size;
 	size_t offset;
+	bool borrowed;
 };
 
 SQSH_STATIC_ASSERT(
@@ -56,6 +58,37 @@ sqsh_lz4_init(void *context, uint8_t *target, size_t target_size) {
 	if (ctx->stream == NULL) {
 		return -SQSH_ERROR_COMPRESSION_INIT;
 	}
+	ctx->borrowed = false;
+	ctx->target = target;
+	ctx->target_size = target_size;
+	ctx->offset = 0;
+
+	return 0;
+}
+
+static int
+sqsh_lz4_decoder_new(void **decoder) {
+	*decoder = LZ4_createStreamDecode();
+	if (*decoder == NULL) {
+		return -SQSH_ERROR_COMPRESSION_INIT;
+	}
+	return 0;
+}
+
+static void
+sqsh_lz4_decoder_free(void *decoder) {
+	LZ4_freeStreamDecode(decoder);
+}
+
+static int
+sqsh_lz4_init_with_decoder(
+		void *context, void *decoder, uint8_t *target, size_t target_size) {
+	struct SqshLz4Context *ctx = context;
+	if (LZ4_setStreamDecode(decoder, NULL, 0) == 0) {
+		return -SQSH_ERROR_COMPRESSION_INIT;
+	}
+	ctx->stream = decoder;
+	ctx->borrowed = true;
 	ctx->target = target;
 	ctx->target_size = target_size;
 	ctx->offset = 0;
@@ -80,11 +113,32 @@ sqsh_lz4_decompress(
 	return 0;
 }
 
+static int
+sqsh_lz4_decompress_once(
+		void *decoder, uint8_t *target, size_t *target_size,
+		const uint8_t *compressed, const size_t compressed_size) {
+	(void)decoder;
+	if (compressed_size > INT_MAX || *target_size > INT_MAX) {
+		return -SQSH_ERROR_INTEGER_OVERFLOW;
+	}
+	int size = LZ4_decompress_safe(
+			(const char *)compressed, (char *)target, (int)compressed_size,
+			(int)*target_size);
+	if (size < 0) {
+		*target_size = 0;
+		return -SQSH_ERROR_COMPRESSION_DECOMPRESS;
+	}
+	*target_size = (size_t)size;
+	return 0;
+}
+
 static int
 sqsh_lz4_finish(void *context, uint8_t *target, size_t *target_size) {
 	(void)target;
 	struct SqshLz4Context *ctx = context;
-	LZ4_freeStreamDecode(ctx->stream);
+	if (ctx->borrowed == false) {
+		LZ4_freeStreamDecode(ctx->stream);
+	}
 	*target_size = ctx->offset;
 	return 0;
 }
@@ -93,6 +147,11 @@ static const struct SqshExtractorImpl impl_lz4 = {
 		.init = sqsh_lz4_init,
 		.write = sqsh_lz4_decompress,
 		.finish = sqsh_lz4_finish,
+		.decoder_new = sqsh_lz4_decoder_new,
+		.decoder_free = sqsh_lz4_decoder_free,
+		.init_with_decoder = sqsh_lz4_init_with_decoder,
+		.decompress = sqsh_lz4_decompress_once,
+		.decode_cost = 1,
 };
 
 const struct SqshExtractorImpl *const sqsh__impl_lz4 = &impl_lz4;
@@ -38,9 +38,16 @@
 #ifdef CONFIG_LZMA
 
 #	include <lzma.h>
+#	include <stdlib.h>
 #	include <string.h>
 
-SQSH_STATIC_ASSERT(sizeof(sqsh__extractor_context_t) >= sizeof(lzma_stream));
+struct SqshLzmaContext {
+	lzma_stream *stream;
+	lzma_stream own_stream;
+};
+
+SQSH_STATIC_ASSERT(
+		sizeof(sqsh__extractor_context_t) >= sizeof(struct SqshLzmaContext));
 
 #	define SQSH_LZMA_MEMLIMIT (64u * 1024u * 1024u)
 
@@ -52,12 +59,9 @@ enum SqshLzmaType {
 };
 
 static int
-sqsh_lzma_init(
-		void *context, uint8_t *target, size_t target_size,
+sqsh_lzma_init_stream(
+		lzma_stream *stream, uint8_t *target, size_t target_size,
 		enum SqshLzmaType type) {
-	lzma_stream *stream = context;
-	memcpy(stream, &proto_stream, sizeof(lzma_stream));
-
 	lzma_ret ret;
 	if (type == LZMA_TYPE_ALONE) {
 		ret = lzma_alone_decoder(stream, SQSH_LZMA_MEMLIMIT);
@@ -75,6 +79,17 @@ sqsh_lzma_init(
 	return 0;
 }
 
+static int
+sqsh_lzma_init(
+		void *context, uint8_t *target, size_t target_size,
+		enum SqshLzmaType type) {
+	struct SqshLzmaContext *ctx = context;
+	ctx->stream = &ctx->own_stream;
+	memcpy(ctx->stream, &proto_stream, sizeof(lzma_stream));
+
+	return sqsh_lzma_init_stream(ctx->stream, target, target_size, type);
+}
+
 static int
 sqsh_lzma_init_xz(void *context, uint8_t *target, size_t target_size) {
 	return sqsh_lzma_init(context, target, target_size, LZMA_TYPE_XZ);
@@ -85,11 +100,49 @@ sqsh_lzma_init_alone(void *context, uint8_t *target, size_t target_size) {
 	return sqsh_lzma_init(context, target, target_size, LZMA_TYPE_ALONE);
 }
 
+static int
+sqsh_lzma_decoder_new(void **decoder) {
+	lzma_stream *stream = malloc(sizeof(lzma_stream));
+	if (stream == NULL) {
+		return -SQSH_ERROR_MALLOC_FAILED;
+	}
+	memcpy(stream, &proto_stream, sizeof(lzma_stream));
+	*decoder = stream;
+	return 0;
+}
+
+static void
+sqsh_lzma_decoder_free(void *decoder) {
+	lzma_end(decoder);
+	free(decoder);
+}
+
+/* Reinitializing a decoder on an existing lzma_stream lets liblzma reuse the
+ * memory it allocated for the previous block. */
+static int
+sqsh_lzma_init_with_decoder_xz(
+		void *context, void *decoder, uint8_t *target, size_t target_size) {
+	struct SqshLzmaContext *ctx = context;
+	ctx->stream = decoder;
+	return sqsh_lzma_init_stream(
+			ctx->stream, target, target_size, LZMA_TYPE_XZ);
+}
+
+static int
+sqsh_lzma_init_with_decoder_alone(
+		void *context, void *decoder, uint8_t *target, size_t target_size) {
+	struct SqshLzmaContext *ctx = context;
+	ctx->stream = decoder;
+	return sqsh_lzma_init_stream(
+			ctx->stream, target, target_size, LZMA_TYPE_ALONE);
+}
+
 static int
 sqsh_lzma_decompress(
 		void *context, const uint8_t *compressed,
 		const size_t compressed_size) {
-	lzma_stream *stream = context;
+	struct SqshLzmaContext *ctx = context;
+	lzma_stream *stream = ctx->stream;
 
 	stream->next_in = compressed;
 	stream->avail_in = compressed_size;
@@ -102,17 +155,59 @@ sqsh_lzma_decompress(
 	return 0;
 }
 
+static int
+sqsh_lzma_decompress_once(
+		void *decoder, uint8_t *target, size_t *target_size,
+		const uint8_t *compressed, const size_t compressed_size,
+		enum SqshLzmaType type) {
+	lzma_stream *stream = decoder;
+	int rv = sqsh_lzma_init_stream(stream, target, *target_size, type);
+	if (rv < 0) {
+		return rv;
+	}
+	stream->next_in = compressed;
+	stream->avail_in = compressed_size;
+
+	if (lzma_code(stream, LZMA_FINISH) != LZMA_STREAM_END) {
+		*target_size = 0;
+		return -SQSH_ERROR_COMPRESSION_DECOMPRESS;
+	}
+	*target_size = (size_t)stream->total_out;
+	return 0;
+}
+
+static int
+sqsh_lzma_decompress_once_xz(
+		void *decoder, uint8_t *target, size_t *target_size,
+		const uint8_t *compressed, const size_t compressed_size) {
+	return sqsh_lzma_decompress_once(
+			decoder, target, target_size, compressed, compressed_size,
+			LZMA_TYPE_XZ);
+}
+
+static int
+sqsh_lzma_decompress_once_alone(
+		void *decoder, uint8_t *target, size_t *target_size,
+		const uint8_t *compressed, const size_t compressed_size) {
+	return sqsh_lzma_decompress_once(
+			decoder, target, target_size, compressed, compressed_size,
+			LZMA_TYPE_ALONE);
+}
+
 static int
 sqsh_lzma_finish(void *context, uint8_t *target, size_t *target_size) {
 	(void)target;
-	lzma_stream *stream = context;
+	struct SqshLzmaContext *ctx = context;
+	lzma_stream *stream = ctx->stream;
 	stream->next_in = NULL;
 	stream->avail_in = 0;
 
 	lzma_ret ret = lzma_code(stream, LZMA_FINISH);
 
 	*target_size = (size_t)stream->total_out;
-	lzma_end(stream);
+	if (stream == &ctx->own_stream) {
+		lzma_end(stream);
+	}
 
 	if (ret == LZMA_STREAM_END) {
 		return 0;
@@ -126,6 +221,11 @@ static const struct SqshExtractorImpl impl_xz = {
 		.init = sqsh_lzma_init_xz,
 		.write = sqsh_lzma_decompress,
 		.finish = sqsh_lzma_finish,
+		.decoder_new = sqsh_lzma_decoder_new,
+		.decoder_free = sqsh_lzma_decoder_free,
+		.init_with_decoder = sqsh_lzma_init_with_decoder_xz,
+		.decompress = sqsh_lzma_decompress_once_xz,
+		.decode_cost = 8,
 };
 
 const struct SqshExtractorImpl *const sqsh__impl_xz = &impl_xz;
@@ -134,6 +234,11 @@ static const struct SqshExtractorImpl impl_lzma = {
 		.init = sqsh_lzma_init_alone,
 		.write = sqsh_lzma_decompress,
 		.finish = sqsh_lzma_finish,
+		.decoder_new = sqsh_lzma_decoder_new,
+		.decoder_free = sqsh_lzma_decoder_free,
+		.init_with_decoder = sqsh_lzma_init_with_decoder_alone,
+		.decompress = sqsh_lzma_decompress_once_alone,
+		.decode_cost = 8,
 };
 
 const struct SqshExtractorImpl *const sqsh__impl_lzma = &impl_lzma;
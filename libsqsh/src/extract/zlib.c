@@ -37,16 +37,28 @@
 
 #ifdef CONFIG_ZLIB
 
+#	include <limits.h>
+#	include <stdlib.h>
 #	include <zlib.h>
 
-SQSH_STATIC_ASSERT(sizeof(sqsh__extractor_context_t) >= sizeof(z_stream));
+struct SqshZlibContext {
+	z_stream *stream;
+	z_stream own_stream;
+};
+
+SQSH_STATIC_ASSERT(
+		sizeof(sqsh__extractor_context_t) >= sizeof(struct SqshZlibContext));
 
 static int
 sqsh_zlib_init(void *context, uint8_t *target, size_t target_size) {
-	z_stream *stream = context;
+	struct SqshZlibContext *ctx = context;
+	z_stream *stream = &ctx->own_stream;
+	ctx->stream = stream;
 	stream->zalloc = Z_NULL;
 	stream->zfree = Z_NULL;
 	stream->opaque = Z_NULL;
+	stream->next_in = Z_NULL;
+	stream->avail_in = 0;
 	stream->next_out = target;
 	stream->avail_out = (uInt)target_size;
 
@@ -57,12 +69,53 @@ sqsh_zlib_init(void *context, uint8_t *target, size_t target_size) {
 	return 0;
 }
 
+static int
+sqsh_zlib_decoder_new(void **decoder) {
+	z_stream *stream = calloc(1, sizeof(z_stream));
+	if (stream == NULL) {
+		return -SQSH_ERROR_MALLOC_FAILED;
+	}
+	stream->zalloc = Z_NULL;
+	stream->zfree = Z_NULL;
+	stream->opaque = Z_NULL;
+	if (inflateInit(stream) != Z_OK) {
+		free(stream);
+		return -SQSH_ERROR_COMPRESSION_INIT;
+	}
+	*decoder = stream;
+	return 0;
+}
+
+static void
+sqsh_zlib_decoder_free(void *decoder) {
+	inflateEnd(decoder);
+	free(decoder);
+}
+
+static int
+sqsh_zlib_init_with_decoder(
+		void *context, void *decoder, uint8_t *target, size_t target_size) {
+	struct SqshZlibContext *ctx = context;
+	z_stream *stream = decoder;
+	if (inflateReset(stream) != Z_OK) {
+		return -SQSH_ERROR_COMPRESSION_INIT;
+	}
+	ctx->stream = stream;
+	stream->next_in = Z_NULL;
+	stream->avail_in = 0;
+	stream->next_out = target;
+	stream->avail_out = (uInt)target_size;
+
+	return 0;
+}
+
 static int
 sqsh_zlib_decompress(
 		void *context, const uint8_t *compressed,
 		const size_t compressed_size) {
 	int rv;
-	z_stream *stream = context;
+	struct SqshZlibContext *ctx = context;
+	z_stream *stream = ctx->stream;
 	stream->next_in = (Bytef *)compressed;
 	stream->avail_in = (uInt)compressed_size;
 	rv = inflate(stream, Z_NO_FLUSH);
@@ -73,12 +126,37 @@ sqsh_zlib_decompress(
 	return 0;
 }
 
+static int
+sqsh_zlib_decompress_once(
+		void *decoder, uint8_t *target, size_t *target_size,
+		const uint8_t *compressed, const size_t compressed_size) {
+	z_stream *stream = decoder;
+	if (compressed_size > UINT_MAX || *target_size > UINT_MAX) {
+		return -SQSH_ERROR_INTEGER_OVERFLOW;
+	}
+	if (inflateReset(stream) != Z_OK) {
+		return -SQSH_ERROR_COMPRESSION_INIT;
+	}
+	stream->next_in = (Bytef *)compressed;
+	stream->avail_in = (uInt)compressed_size;
+	stream->next_out = target;
+	stream->avail_out = (uInt)*target_size;
+
+	if (inflate(stream, Z_FINISH) != Z_STREAM_END) {
+		*target_size = 0;
+		return -SQSH_ERROR_COMPRESSION_DECOMPRESS;
+	}
+	*target_size = stream->total_out;
+	return 0;
+}
+
 static int
 sqsh_zlib_finish(void *context, uint8_t *target, size_t *target_size) {
 	(void)target;
 
 	int rv = 0;
-	z_stream *stream = context;
+	struct SqshZlibContext *ctx = context;
+	z_stream *stream = ctx->stream;
 	stream->next_in = Z_NULL;
 	stream->avail_in = 0;
 
@@ -91,7 +169,9 @@ sqsh_zlib_finish(void *context, uint8_t *target, size_t *target_size) {
 	*target_size = stream->total_out;
 
 out:
-	inflateEnd(stream);
+	if (stream == &ctx->own_stream) {
+		inflateEnd(stream);
+	}
 	return rv;
 }
 
@@ -99,6 +179,11 @@ static const struct SqshExtractorImpl impl_zlib = {
 		.init = sqsh_zlib_init,
 		.write = sqsh_zlib_decompress,
 		.finish = sqsh_zlib_finish,
+		.decoder_new = sqsh_zlib_decoder_new,
+		.decoder_free = sqsh_zlib_decoder_free,
+		.init_with_decoder = sqsh_zlib_init_with_decoder,
+		.decompress = sqsh_zlib_decompress_once,
+		.decode_cost = 4,
 };
 
 const struct SqshExtractorImpl *const sqsh__impl_zlib = &impl_zlib;
@@ -42,36 +42,70 @@
 struct SqshZstdContext {
 	ZSTD_DCtx *stream;
 	ZSTD_outBuffer output;
+	bool borrowed;
 };
 
 SQSH_STATIC_ASSERT(
 		sizeof(sqsh__extractor_context_t) >= sizeof(struct SqshZstdContext));
 
+static ZSTD_DCtx *
+create_dctx(void) {
+	ZSTD_DCtx *stream = ZSTD_createDCtx();
+	if (stream == NULL) {
+		return NULL;
+	}
+	size_t zstd_rv = ZSTD_DCtx_setParameter(stream, ZSTD_d_windowLogMax, 20);
+	if (ZSTD_isError(zstd_rv)) {
+		ZSTD_freeDCtx(stream);
+		return NULL;
+	}
+	return stream;
+}
+
 static int
 sqsh_zstd_init(void *context, uint8_t *target, size_t target_size) {
-	int rv = 0;
-	(void)target;
-	(void)target_size;
 	struct SqshZstdContext *ctx = context;
-	ctx->stream = ZSTD_createDCtx();
+	ctx->stream = create_dctx();
 	if (ctx->stream == NULL) {
 		return -SQSH_ERROR_COMPRESSION_INIT;
 	}
-	size_t zstd_rv =
-			ZSTD_DCtx_setParameter(ctx->stream, ZSTD_d_windowLogMax, 20);
+	ctx->borrowed = false;
+	ctx->output.dst = target;
+	ctx->output.size = target_size;
+	ctx->output.pos = 0;
+
+	return 0;
+}
+
+static int
+sqsh_zstd_decoder_new(void **decoder) {
+	*decoder = create_dctx();
+	if (*decoder == NULL) {
+		return -SQSH_ERROR_COMPRESSION_INIT;
+	}
+	return 0;
+}
+
+static void
+sqsh_zstd_decoder_free(void *decoder) {
+	ZSTD_freeDCtx(decoder);
+}
+
+static int
+sqsh_zstd_init_with_decoder(
+		void *context, void *decoder, uint8_t *target, size_t target_size) {
+	struct SqshZstdContext *ctx = context;
+	size_t zstd_rv = ZSTD_DCtx_reset(decoder, ZSTD_reset_session_only);
 	if (ZSTD_isError(zstd_rv)) {
-		rv = -SQSH_ERROR_COMPRESSION_INIT;
-		goto out;
+		return -SQSH_ERROR_COMPRESSION_INIT;
 	}
+	ctx->stream = decoder;
+	ctx->borrowed = true;
 	ctx->output.dst = target;
 	ctx->output.size = target_size;
 	ctx->output.pos = 0;
 
-out:
-	if (rv < 0) {
-		ZSTD_freeDCtx(ctx->stream);
-	}
-	return rv;
+	return 0;
 }
 
 static int
@@ -96,11 +130,27 @@ sqsh_zstd_decompress(
 	return 0;
 }
 
+static int
+sqsh_zstd_decompress_once(
+		void *decoder, uint8_t *target, size_t *target_size,
+		const uint8_t *compressed, const size_t compressed_size) {
+	size_t rv = ZSTD_decompressDCtx(
+			decoder, target, *target_size, compressed, compressed_size);
+	if (ZSTD_isError(rv)) {
+		*target_size = 0;
+		return -SQSH_ERROR_COMPRESSION_DECOMPRESS;
+	}
+	*target_size = rv;
+	return 0;
+}
+
 static int
 sqsh_zstd_finish(void *context, uint8_t *target, size_t *target_size) {
 	(void)target;
 	struct SqshZstdContext *ctx = context;
-	ZSTD_freeDCtx(ctx->stream);
+	if (ctx->borrowed == false) {
+		ZSTD_freeDCtx(ctx->stream);
+	}
 	*target_size = ctx->output.pos;
 	return 0;
 }
@@ -109,6 +159,11 @@ static const struct SqshExtractorImpl impl_zstd = {
 		.init = sqsh_zstd_init,
 		.write = sqsh_zstd_decompress,
 		.finish = sqsh_zstd_finish,
+		.decoder_new = sqsh_zstd_decoder_new,
+		.decoder_free = sqsh_zstd_decoder_free,
+		.init_with_decoder = sqsh_zstd_init_with_decoder,
+		.decompress = sqsh_zstd_decompress_once,
+		.decode_cost = 2,
 };
 
 const struct SqshExtractorImpl *const sqsh__impl_zstd = &impl_zstd;
@@ -35,6 +35,7 @@
 
 #include <cextras/memory.h>
 #include <sqsh_archive.h>
+#include <sqsh_archive_private.h>
 #include <sqsh_common_private.h>
 #include <sqsh_error.h>
 #include <sqsh_table.h>
@@ -42,6 +43,8 @@
 #include <sqsh_data_private.h>
 #include <sqsh_tree_private.h>
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 
 #define SQSH_DEFAULT_MAX_SYMLINKS_FOLLOWED 100
 
@@ -129,6 +132,8 @@ sqsh__file_init(
 	int rv = 0;
 	const struct SqshSuperblock *superblock = sqsh_archive_superblock(archive);
 
+	inode->block_offsets = NULL;
+
 	const uint64_t inode_table_start =
 			sqsh_superblock_inode_table_start(superblock);
 
@@ -182,6 +187,49 @@ sqsh_open_by_ref(struct SqshArchive *archive, uint64_t inode_ref, int *err) {
 	SQSH_NEW_IMPL(sqsh__file_init, struct SqshFile, archive, inode_ref);
 }
 
+void
+sqsh_file_attributes(
+		const struct SqshFile *file, struct SqshFileAttributes *attributes) {
+	attributes->inode_ref = sqsh_file_inode_ref(file);
+	attributes->type = sqsh_file_type(file);
+	attributes->permission = sqsh_file_permission(file);
+	attributes->inode_number = sqsh_file_inode(file);
+	attributes->hard_link_count = sqsh_file_hard_link_count(file);
+	attributes->uid = sqsh_file_uid(file);
+	attributes->gid = sqsh_file_gid(file);
+	attributes->modified_time = sqsh_file_modified_time(file);
+	attributes->size = sqsh_file_size(file);
+	attributes->blocks_start = sqsh_file_blocks_start(file);
+}
+
+int
+sqsh_file_attributes_by_ref(
+		struct SqshArchive *archive, uint64_t inode_ref,
+		struct SqshFileAttributes *attributes) {
+	int rv = 0;
+	struct SqshInodeCache *inode_cache = NULL;
+	struct SqshFile file = {0};
+
+	rv = sqsh__archive_inode_cache(archive, &inode_cache);
+	if (rv < 0) {
+		goto out;
+	}
+	if (sqsh__inode_cache_get(inode_cache, inode_ref, attributes)) {
+		goto out;
+	}
+
+	rv = sqsh__file_init(&file, archive, inode_ref);
+	if (rv < 0) {
+		goto out;
+	}
+	sqsh_file_attributes(&file, attributes);
+	sqsh__file_cleanup(&file);
+
+	sqsh__inode_cache_put(inode_cache, attributes);
+out:
+	return rv;
+}
+
 void
 sqsh__file_set_parent_inode_ref(
 		struct SqshFile *file, uint64_t parent_inode_ref) {
@@ -515,8 +563,265 @@ sqsh_file_xattr_index(const struct SqshFile *context) {
 	return get_impl(context)->xattr_index(get_inode(context));
 }
 
+static int
+build_block_offsets(const struct SqshFile *file, uint64_t **target) {
+	const uint64_t block_count = sqsh_file_block_count2(file);
+	uint64_t offset = 0;
+	size_t alloc_size;
+
+	if (SQSH_ADD_OVERFLOW(block_count, 1, &alloc_size) ||
+		SQSH_MULT_OVERFLOW(alloc_size, sizeof(uint64_t), &alloc_size)) {
+		return -SQSH_ERROR_INTEGER_OVERFLOW;
+	}
+	uint64_t *offsets = malloc(alloc_size);
+	if (offsets == NULL) {
+		return -SQSH_ERROR_MALLOC_FAILED;
+	}
+
+	for (uint64_t i = 0; i < block_count; i++) {
+		offsets[i] = offset;
+		offset += sqsh_file_block_size2(file, i);
+	}
+	offsets[block_count] = offset;
+
+	*target = offsets;
+	return 0;
+}
+
+int
+sqsh__file_block_offset(
+		const struct SqshFile *file, uint64_t block_index, uint64_t *offset) {
+	int rv = 0;
+	/* The offsets are a cache that is filled on demand. Modifying it does
+	 * not change the observable state of the file, so cast the const away. */
+	uint64_t **block_offsets = (uint64_t **)&file->block_offsets;
+	uint64_t *offsets = __atomic_load_n(block_offsets, __ATOMIC_ACQUIRE);
+
+	if (block_index > sqsh_file_block_count2(file)) {
+		rv = -SQSH_ERROR_OUT_OF_BOUNDS;
+		goto out;
+	}
+
+	if (offsets == NULL) {
+		uint64_t *expected = NULL;
+		rv = build_block_offsets(file, &offsets);
+		if (rv < 0) {
+			goto out;
+		}
+		if (!__atomic_compare_exchange_n(
+					block_offsets, &expected, offsets, false, __ATOMIC_ACQ_REL,
+					__ATOMIC_ACQUIRE)) {
+			/* Another thread was faster. Use its offsets instead. */
+			free(offsets);
+			offsets = expected;
+		}
+	}
+
+	*offset = offsets[block_index];
+out:
+	return rv;
+}
+
+size_t
+sqsh__file_block_decompressed_size(
+		const struct SqshFile *file, uint64_t block_index) {
+	const struct SqshSuperblock *superblock =
+			sqsh_archive_superblock(file->archive);
+	const uint16_t block_log = sqsh_superblock_block_log(superblock);
+
+	if (block_index + 1 == sqsh_file_block_count2(file) &&
+		!sqsh_file_has_fragment(file)) {
+		const size_t remainder = (size_t)sqsh_block_remainder(
+				sqsh_file_size(file), block_log);
+		if (remainder != 0) {
+			return remainder;
+		}
+	}
+	return (size_t)1 << block_log;
+}
+
+static int
+read_block_into(
+		const struct SqshFile *file, uint64_t block_index, size_t offset,
+		uint8_t *target, size_t size, uint8_t **scratch) {
+	int rv = 0;
+	struct SqshArchive *archive = file->archive;
+	const struct SqshSuperblock *superblock = sqsh_archive_superblock(archive);
+	struct SqshMapManager *map_manager = sqsh_archive_map_manager(archive);
+	struct SqshExtractManager *extract_manager = NULL;
+	struct SqshMapReader reader = {0};
+	const uint32_t data_size = sqsh_file_block_size2(file, block_index);
+	const size_t max_block_size = sqsh_superblock_block_size(superblock);
+	const size_t block_size =
+			sqsh__file_block_decompressed_size(file, block_index);
+	uint8_t *decode_target = target;
+	size_t decoded_size = block_size;
+	uint64_t address;
+
+	if (data_size == 0) {
+		memset(target, 0, size);
+		goto out;
+	}
+
+	rv = sqsh__file_block_offset(file, block_index, &address);
+	if (rv < 0) {
+		goto out;
+	}
+	if (SQSH_ADD_OVERFLOW(sqsh_file_blocks_start(file), address, &address)) {
+		rv = -SQSH_ERROR_INTEGER_OVERFLOW;
+		goto out;
+	}
+	rv = sqsh__map_reader_init(
+			&reader, map_manager, address,
+			sqsh_superblock_bytes_used(superblock));
+	if (rv < 0) {
+		goto out;
+	}
+	rv = sqsh__map_reader_advance(&reader, 0, data_size);
+	if (rv < 0) {
+		goto out;
+	}
+
+	if (!sqsh_file_block_is_compressed2(file, block_index)) {
+		const uint8_t *data = sqsh__map_reader_data(&reader);
+		size_t copy_size = 0;
+
+		if (data_size > max_block_size) {
+			rv = -SQSH_ERROR_SIZE_MISMATCH;
+			goto out;
+		}
+		/* Uncompressed blocks that are shorter than the block size are
+		 * padded with zeros. */
+		if (offset < data_size) {
+			copy_size = SQSH_MIN(data_size - offset, size);
+			memcpy(target, &data[offset], copy_size);
+		}
+		memset(&target[copy_size], 0, size - copy_size);
+		goto out;
+	}
+
+	rv = sqsh__archive_data_extract_manager(archive, &extract_manager);
+	if (rv < 0) {
+		goto out;
+	}
+	/* Only the first and the last block of a range can be partial. These
+	 * are decoded to a scratch buffer, all others go straight to target. */
+	if (offset != 0 || size != block_size) {
+		if (*scratch == NULL) {
+			*scratch = malloc(max_block_size);
+			if (*scratch == NULL) {
+				rv = -SQSH_ERROR_MALLOC_FAILED;
+				goto out;
+			}
+		}
+		decode_target = *scratch;
+	}
+	rv = sqsh__extract_manager_decompress_into(
+			extract_manager, &reader, decode_target, &decoded_size);
+	if (rv < 0) {
+		goto out;
+	}
+	if (decoded_size != block_size) {
+		rv = -SQSH_ERROR_SIZE_MISMATCH;
+		goto out;
+	}
+	if (decode_target != target) {
+		memcpy(target, &decode_target[offset], size);
+	}
+
+out:
+	sqsh__map_reader_cleanup(&reader);
+	return rv;
+}
+
+static int
+read_fragment_into(
+		const struct SqshFile *file, size_t offset, uint8_t *target,
+		size_t size) {
+	int rv = 0;
+	struct SqshFragmentView view = {0};
+	size_t end;
+
+	if (!sqsh_file_has_fragment(file)) {
+		rv = -SQSH_ERROR_SIZE_MISMATCH;
+		goto out;
+	}
+	rv = sqsh__fragment_view_init(&view, file);
+	if (rv < 0) {
+		goto out;
+	}
+	if (SQSH_ADD_OVERFLOW(offset, size, &end)) {
+		rv = -SQSH_ERROR_INTEGER_OVERFLOW;
+		goto out;
+	}
+	if (end > sqsh__fragment_view_size(&view)) {
+		rv = -SQSH_ERROR_SIZE_MISMATCH;
+		goto out;
+	}
+	memcpy(target, &sqsh__fragment_view_data(&view)[offset], size);
+
+out:
+	sqsh__fragment_view_cleanup(&view);
+	return rv;
+}
+
+int
+sqsh_file_read_into(
+		const struct SqshFile *file, uint64_t offset, void *buffer,
+		size_t size) {
+	int rv = 0;
+	uint8_t *target = buffer;
+	uint8_t *scratch = NULL;
+	uint64_t end;
+
+	if (sqsh_file_type(file) != SQSH_FILE_TYPE_FILE) {
+		rv = -SQSH_ERROR_NOT_A_FILE;
+		goto out;
+	}
+	if (SQSH_ADD_OVERFLOW(offset, size, &end)) {
+		rv = -SQSH_ERROR_INTEGER_OVERFLOW;
+		goto out;
+	}
+	if (end > sqsh_file_size(file)) {
+		rv = -SQSH_ERROR_OUT_OF_BOUNDS;
+		goto out;
+	}
+
+	const struct SqshSuperblock *superblock =
+			sqsh_archive_superblock(file->archive);
+	const uint16_t block_log = sqsh_superblock_block_log(superblock);
+	const size_t block_size = (size_t)1 << block_log;
+	const uint64_t block_count = sqsh_file_block_count2(file);
+
+	while (offset < end) {
+		const uint64_t block_index = offset >> block_log;
+		const size_t block_offset = (size_t)(offset & (block_size - 1));
+		const size_t chunk_size =
+				(size_t)SQSH_MIN(block_size - block_offset, end - offset);
+
+		if (block_index < block_count) {
+			rv = read_block_into(
+					file, block_index, block_offset, target, chunk_size,
+					&scratch);
+		} else {
+			rv = read_fragment_into(file, block_offset, target, chunk_size);
+		}
+		if (rv < 0) {
+			goto out;
+		}
+		offset += chunk_size;
+		target += chunk_size;
+	}
+
+out:
+	free(scratch);
+	return rv;
+}
+
 int
 sqsh__file_cleanup(struct SqshFile *inode) {
+	free(inode->block_offsets);
+	inode->block_offsets = NULL;
 	return sqsh__metablock_reader_cleanup(&inode->metablock);
 }
 
@@ -574,6 +879,18 @@ sqsh_lopen(struct SqshArchive *archive, const char *path, int *err) {
 	return open_file(archive, path, err, false);
 }
 
+int
+sqsh_file_advise(const struct SqshFile *file, int advice) {
+	uint64_t size = 0;
+	const uint64_t block_count = sqsh_file_block_count2(file);
+
+	for (uint64_t i = 0; i < block_count; i++) {
+		size += sqsh_file_block_size2(file, i);
+	}
+	return sqsh_archive_advise(
+			file->archive, sqsh_file_blocks_start(file), size, advice);
+}
+
 int
 sqsh_close(struct SqshFile *file) {
 	SQSH_FREE_IMPL(sqsh__file_cleanup, file);
@@ -41,39 +41,13 @@
 
 #define BLOCK_INDEX_FINISHED UINT64_MAX
 
-static bool
-is_last_block(const struct SqshFileIterator *iterator) {
-	const struct SqshFile *file = iterator->file;
-	const bool has_fragment = sqsh_file_has_fragment(file);
-	const uint64_t block_index = iterator->block_index;
-	const uint64_t block_count = sqsh_file_block_count2(file);
-
-	if (has_fragment) {
-		return block_index == block_count;
-	} else {
-		return block_index == block_count - 1;
-	}
-}
-
-static size_t
-get_block_size(const struct SqshFileIterator *iterator) {
-	const uint16_t block_log = iterator->block_log;
-	const size_t block_size = (size_t)1 << block_log;
-	if (is_last_block(iterator) && !sqsh_file_has_fragment(iterator->file)) {
-		const size_t remainder = (size_t)sqsh_block_remainder(
-				sqsh_file_size(iterator->file), block_log);
-		if (remainder != 0) {
-			return remainder;
-		}
-	}
-	return block_size;
-}
-
 int
 sqsh__file_iterator_init_with_state(
 		struct SqshFileIterator *iterator, const struct SqshFile *file,
 		const struct SqshIteratorState *state) {
 	int rv = 0;
+	iterator->readahead_impl = NULL;
+	iterator->readahead = NULL;
 	enum SqshFileType file_type = sqsh_file_type(file);
 	if (file_type != SQSH_FILE_TYPE_FILE) {
 		rv = -SQSH_ERROR_NOT_A_FILE;
@@ -103,6 +77,7 @@ sqsh__file_iterator_init_with_state(
 		goto out;
 	}
 
+	iterator->pending_offset = 0;
 	iterator->block_index = state->block_index;
 	iterator->block_log = sqsh_superblock_block_log(superblock);
 	iterator->file = file;
@@ -123,6 +98,8 @@ sqsh__file_iterator_copy(
 		struct SqshFileIterator *target,
 		const struct SqshFileIterator *source) {
 	int rv = 0;
+	target->readahead_impl = NULL;
+	target->readahead = NULL;
 	target->file = source->file;
 	target->compression_manager = source->compression_manager;
 	rv = sqsh__map_reader_copy(&target->map_reader, &source->map_reader);
@@ -138,11 +115,24 @@ sqsh__file_iterator_copy(
 	if (rv < 0) {
 		goto out;
 	}
+	target->pending_offset = source->pending_offset;
 	target->sparse_size = source->sparse_size;
 	target->block_log = source->block_log;
 	target->block_index = source->block_index;
-	target->data = source->data;
 	target->size = source->size;
+
+	/* Data that is presented from the map reader or the fragment view may
+	 * live in a buffer owned by the source, so point to the copy instead. */
+	if (source->data != NULL &&
+		source->data == sqsh__map_reader_data(&source->map_reader)) {
+		target->data = sqsh__map_reader_data(&target->map_reader);
+	} else if (
+			source->data != NULL &&
+			source->data == sqsh__fragment_view_data(&source->fragment_view)) {
+		target->data = sqsh__fragment_view_data(&target->fragment_view);
+	} else {
+		target->data = source->data;
+	}
 out:
 	if (rv < 0) {
 		sqsh__file_iterator_cleanup(target);
@@ -150,13 +140,29 @@ out:
 	return rv;
 }
 
+struct SqshFileIterator *
+sqsh_file_iterator_dup(const struct SqshFileIterator *iterator, int *err) {
+	SQSH_NEW_IMPL(sqsh__file_iterator_copy, struct SqshFileIterator, iterator);
+}
+
+void
+sqsh__file_iterator_set_readahead(
+		struct SqshFileIterator *iterator,
+		const struct SqshFileIteratorReadaheadImpl *impl, void *readahead) {
+	if (iterator->readahead_impl != NULL) {
+		iterator->readahead_impl->cleanup(iterator->readahead);
+	}
+	iterator->readahead_impl = impl;
+	iterator->readahead = readahead;
+}
+
 struct SqshFileIterator *
 sqsh_file_iterator_new(const struct SqshFile *file, int *err) {
 	SQSH_NEW_IMPL(sqsh__file_iterator_init, struct SqshFileIterator, file);
 }
 
 static int
-map_block_compressed(struct SqshFileIterator *iterator, size_t next_offset) {
+map_block_compressed(struct SqshFileIterator *iterator, uint64_t next_offset) {
 	int rv = 0;
 	struct SqshExtractManager *compression_manager =
 			iterator->compression_manager;
@@ -164,21 +170,41 @@ map_block_compressed(struct SqshFileIterator *iterator, size_t next_offset) {
 	struct SqshExtractView *extract_view = &iterator->extract_view;
 	const uint64_t block_index = iterator->block_index;
 	const uint32_t data_block_size = sqsh_file_block_size2(file, block_index);
+	uint64_t address;
 
-	rv = sqsh__map_reader_advance(
-			&iterator->map_reader, next_offset, data_block_size);
-	if (rv < 0) {
+	if (SQSH_ADD_OVERFLOW(
+				sqsh__map_reader_address(&iterator->map_reader), next_offset,
+				&address)) {
+		rv = -SQSH_ERROR_INTEGER_OVERFLOW;
 		goto out;
 	}
-	rv = sqsh__extract_view_init(
-			extract_view, compression_manager, &iterator->map_reader);
+
+	/* Blocks that are still cached do not need to be mapped. The map
+	 * reader catches up once a block needs to be mapped again. */
+	rv = sqsh__extract_view_lookup(extract_view, compression_manager, address);
 	if (rv < 0) {
 		goto out;
+	} else if (rv > 0) {
+		iterator->pending_offset += data_block_size;
+	} else {
+		rv = sqsh__map_reader_advance(
+				&iterator->map_reader, next_offset, data_block_size);
+		if (rv < 0) {
+			goto out;
+		}
+		iterator->pending_offset = 0;
+		rv = sqsh__extract_view_init(
+				extract_view, compression_manager, &iterator->map_reader);
+		if (rv < 0) {
+			goto out;
+		}
 	}
+	rv = 0;
 	iterator->data = sqsh__extract_view_data(extract_view);
 	iterator->size = sqsh__extract_view_size(extract_view);
 
-	if (iterator->size != get_block_size(iterator)) {
+	if (iterator->size !=
+		sqsh__file_block_decompressed_size(file, block_index)) {
 		rv = -SQSH_ERROR_SIZE_MISMATCH;
 		goto out;
 	}
@@ -194,7 +220,7 @@ out:
 
 static int
 map_block_uncompressed(
-		struct SqshFileIterator *iterator, size_t next_offset,
+		struct SqshFileIterator *iterator, uint64_t next_offset,
 		size_t desired_size) {
 	int rv = 0;
 	const struct SqshFile *file = iterator->file;
@@ -215,7 +241,8 @@ map_block_uncompressed(
 		const uint32_t data_block_size =
 				sqsh_file_block_size2(file, block_index);
 		iterator->block_index = block_index;
-		if (data_block_size > get_block_size(iterator)) {
+		if (data_block_size >
+			sqsh__file_block_decompressed_size(file, block_index)) {
 			rv = -SQSH_ERROR_SIZE_MISMATCH;
 			goto out;
 		} else if (block_index + 1 != block_count) {
@@ -244,6 +271,7 @@ map_block_uncompressed(
 	if (rv < 0) {
 		goto out;
 	}
+	iterator->pending_offset = 0;
 	iterator->data = sqsh__map_reader_data(reader);
 	iterator->size = outer_size;
 	iterator->block_index = block_index;
@@ -280,10 +308,13 @@ map_block(struct SqshFileIterator *iterator, size_t desired_size) {
 	const bool is_compressed =
 			sqsh_file_block_is_compressed2(file, block_index);
 	const size_t data_block_size = sqsh_file_block_size2(file, block_index);
-	const size_t next_offset = sqsh__map_reader_size(&iterator->map_reader);
+	const uint64_t next_offset =
+			sqsh__map_reader_size(&iterator->map_reader) +
+			iterator->pending_offset;
 
 	if (data_block_size == 0) {
-		iterator->sparse_size = get_block_size(iterator);
+		iterator->sparse_size =
+				sqsh__file_block_decompressed_size(file, block_index);
 		rv = map_zero_block(iterator);
 		iterator->block_index++;
 	} else if (is_compressed) {
@@ -291,6 +322,10 @@ map_block(struct SqshFileIterator *iterator, size_t desired_size) {
 	} else {
 		rv = map_block_uncompressed(iterator, next_offset, desired_size);
 	}
+	if (rv == 0 && iterator->readahead_impl != NULL) {
+		iterator->readahead_impl->block_mapped(
+				iterator->readahead, block_index, iterator->block_index);
+	}
 	return rv;
 }
 
@@ -372,55 +407,99 @@ sqsh_file_iterator_skip(
 	return rv;
 }
 
+/**
+ * Returns the position of the current chunk inside of the file.
+ */
+static uint64_t
+chunk_position(const struct SqshFileIterator *iterator) {
+	const struct SqshFile *file = iterator->file;
+	const uint16_t block_log = iterator->block_log;
+	const uint64_t file_size = sqsh_file_size(file);
+	const uint64_t block_index = iterator->block_index;
+	uint64_t end;
+
+	if (block_index == BLOCK_INDEX_FINISHED) {
+		end = file_size;
+	} else if (iterator->sparse_size > 0) {
+		/* Sparse data is always emitted for the block preceding block_index.
+		 */
+		const uint64_t sparse_block = block_index - 1;
+		const uint64_t block_start = sparse_block << block_log;
+		end = SQSH_MIN(block_start + ((uint64_t)1 << block_log), file_size) -
+				iterator->sparse_size;
+	} else {
+		end = SQSH_MIN(block_index << block_log, file_size);
+	}
+	return end - iterator->size;
+}
+
 int
 sqsh_file_iterator_skip2(
 		struct SqshFileIterator *iterator, uint64_t *offset,
 		size_t desired_size) {
 	int rv = 0;
+	const struct SqshFile *file = iterator->file;
 	const uint16_t block_log = iterator->block_log;
-	const size_t current_block_size = sqsh_file_iterator_size(iterator);
+	const size_t current_size = sqsh_file_iterator_size(iterator);
+	const uint64_t block_count = sqsh_file_block_count2(file);
+	uint64_t position;
 
-	if (*offset < current_block_size) {
+	if (*offset < current_size) {
 		goto out;
 	}
 
-	*offset -= current_block_size;
-
-	uint64_t skip_index = sqsh_block_count(*offset, block_log);
-	if (current_block_size != 0) {
-		skip_index += 1;
+	if (SQSH_ADD_OVERFLOW(chunk_position(iterator), *offset, &position)) {
+		rv = -SQSH_ERROR_INTEGER_OVERFLOW;
+		goto out;
 	}
-
-	*offset = sqsh_block_remainder(*offset, block_log);
-
-	if (skip_index == 0 && iterator->block_index != 0) {
+	if (position >= sqsh_file_size(file)) {
+		rv = -SQSH_ERROR_OUT_OF_BOUNDS;
 		goto out;
 	}
 
-	uint64_t reader_forward = 0;
-	uint64_t block_index = iterator->block_index;
-	const uint64_t block_count = sqsh_file_block_count2(iterator->file);
-	for (uint64_t i = 0; i < skip_index && block_index < block_count; i++) {
-		reader_forward += sqsh_file_block_size2(iterator->file, block_index);
-		block_index += 1;
-	}
-	rv = sqsh__map_reader_advance(&iterator->map_reader, reader_forward, 0);
-	if (rv < 0) {
-		goto out;
+	const uint64_t block_index = sqsh_block_count(position, block_log);
+	*offset = sqsh_block_remainder(position, block_log);
+
+	/* Look up the compressed address of the target block in the block
+	 * offset index instead of summing up the sizes of all skipped blocks.
+	 * The fragment is not read through the map reader, so there is no need to
+	 * move it in that case. */
+	if (block_index < block_count) {
+		uint64_t block_offset;
+		uint64_t address;
+		rv = sqsh__file_block_offset(file, block_index, &block_offset);
+		if (rv < 0) {
+			goto out;
+		}
+		if (SQSH_ADD_OVERFLOW(
+					sqsh_file_blocks_start(file), block_offset, &address)) {
+			rv = -SQSH_ERROR_INTEGER_OVERFLOW;
+			goto out;
+		}
+		const uint64_t current_address =
+				sqsh__map_reader_address(&iterator->map_reader);
+		if (address < current_address) {
+			rv = -SQSH_ERROR_INTERNAL;
+			goto out;
+		}
+		rv = sqsh__map_reader_advance(
+				&iterator->map_reader, address - current_address, 0);
+		if (rv < 0) {
+			goto out;
+		}
+		iterator->pending_offset = 0;
 	}
+	sqsh__extract_view_cleanup(&iterator->extract_view);
 	iterator->sparse_size = 0;
 	iterator->block_index = block_index;
+	iterator->data = NULL;
+	iterator->size = 0;
 
-	/* In general we will get directly the block containing the offset, but if
+	/* In general the next chunk is the block containing the offset, but if
 	 * the offset points to a block with sparse sections, we iterate over them
 	 * until we reach the desired offset.
-	 *
-	 * TODO: We could analyze iterator->sparse_size and directly skip to the
-	 *       desired block.
 	 */
-	size_t current_size = sqsh_file_iterator_size(iterator);
-	while (current_size <= *offset) {
-		*offset -= current_size;
+	for (;;) {
 		bool has_next = sqsh_file_iterator_next(iterator, desired_size, &rv);
 		if (rv < 0) {
 			goto out;
@@ -428,7 +507,11 @@ sqsh_file_iterator_skip2(
 			rv = -SQSH_ERROR_OUT_OF_BOUNDS;
 			goto out;
 		}
-		current_size = sqsh_file_iterator_size(iterator);
+		const size_t size = sqsh_file_iterator_size(iterator);
+		if (*offset < size) {
+			break;
+		}
+		*offset -= size;
 	}
 
 	rv = 0;
@@ -454,6 +537,7 @@ sqsh_file_iterator_size(const struct SqshFileIterator *iterator) {
 
 int
 sqsh__file_iterator_cleanup(struct SqshFileIterator *iterator) {
+	sqsh__file_iterator_set_readahead(iterator, NULL, NULL);
 	sqsh__map_reader_cleanup(&iterator->map_reader);
 	sqsh__extract_view_cleanup(&iterator->extract_view);
 	sqsh__fragment_view_cleanup(&iterator->fragment_view);
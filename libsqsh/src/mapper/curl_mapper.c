@@ -38,22 +38,66 @@
 
 #	include <sqsh_mapper_private.h>
 
+#	include <sqsh_archive.h>
 #	include <sqsh_data_private.h>
 #	include <sqsh_error.h>
 #	include <sqsh_common_private.h>
 
 #	include <curl/curl.h>
+#	include <errno.h>
 #	include <inttypes.h>
+#	include <stdatomic.h>
 #	include <string.h>
+#	include <time.h>
 
 #	define CONTENT_RANGE "Content-Range"
 #	define CONTENT_RANGE_FORMAT "bytes %" PRIu64 "-%" PRIu64 "/%" PRIu64
+#	define DEFAULT_CACHE_SIZE (256 * 1024 * 1024)
+#	define DEFAULT_TIMEOUT_MS 30000
+#	define DEFAULT_RETRIES 3
+#	define RETRY_BACKOFF_MS 100
+#	define RETRY_BACKOFF_MAX_MS 2000
+/* The maximum number of blocks that are fetched with a single request. */
+#	define COALESCE_MAX_BLOCKS 32
+#	define PREFETCH_CAPACITY (2 * COALESCE_MAX_BLOCKS)
+
+struct SqshCurlChunk {
+	uint64_t offset;
+	size_t size;
+	uint8_t *data;
+};
 
 struct SqshCurlMapper {
 	char *url;
 	uint64_t expected_time;
-	void *handle;
 	uint8_t *header_cache;
+	long timeout_ms;
+	unsigned int retries;
+	long hedge_ms;
+	bool has_disk_cache;
+	struct SqshDiskCache disk_cache;
+	/* Sequential access is detected by comparing the requested offset with
+	 * the end of the previous request. On each sequential miss, the number
+	 * of blocks fetched with one request doubles, random access resets it
+	 * to a single block. Blocks that were fetched ahead are kept in a ring
+	 * until they are mapped. */
+	uint64_t next_offset;
+	size_t fetch_blocks;
+	struct SqshCurlChunk prefetched[PREFETCH_CAPACITY];
+	size_t prefetch_next;
+	/* Handles that are currently not used by a transfer. A transfer takes a
+	 * handle from this list, so multiple transfers run in parallel without
+	 * holding the lock. */
+	CURL **idle_handles;
+	size_t idle_count;
+	size_t idle_capacity;
+	/* DNS cache, TLS sessions and connections are shared between all
+	 * handles. */
+	CURLSH *share;
+	sqsh__mutex_t share_locks[CURL_LOCK_DATA_LAST];
+	/* The share lock callback cannot fail, so a failure to lock is recorded
+	 * here and reported by the transfer. */
+	atomic_int share_rv;
 	sqsh__mutex_t lock;
 };
 
@@ -64,6 +108,16 @@ struct SqshCurlWriteInfo {
 	int rv;
 };
 
+struct SqshCurlTransfer {
+	CURL *handle;
+	struct SqshCurlWriteInfo write_info;
+	/* The actual max-size this string should ever use is 42, but we
+	 * add some padding to be a nice number. Not that 42 isn't nice.
+	 */
+	char range[64];
+	bool retryable;
+};
+
 static size_t
 write_data(void *ptr, size_t size, size_t nmemb, void *userdata) {
 	size_t byte_size;
@@ -133,12 +187,115 @@ get_file_time(CURL *handle, uint64_t *file_time) {
 	return 0;
 }
 
+static void
+share_lock(
+		CURL *handle, curl_lock_data data, curl_lock_access access,
+		void *userptr) {
+	(void)handle;
+	(void)access;
+	struct SqshCurlMapper *mapper = userptr;
+	bool locked = false;
+	const int rv = sqsh__mutex_lock(&mapper->share_locks[data], &locked);
+	if (rv < 0) {
+		atomic_store(&mapper->share_rv, rv);
+	}
+}
+
+static void
+share_unlock(CURL *handle, curl_lock_data data, void *userptr) {
+	(void)handle;
+	struct SqshCurlMapper *mapper = userptr;
+	bool locked = true;
+	sqsh__mutex_unlock(&mapper->share_locks[data], &locked);
+}
+
+static int
+init_share(struct SqshCurlMapper *mapper) {
+	int rv = 0;
+	for (size_t i = 0; i < CURL_LOCK_DATA_LAST; i++) {
+		rv = sqsh__mutex_init(&mapper->share_locks[i]);
+		if (rv < 0) {
+			return rv;
+		}
+	}
+
+	mapper->share = curl_share_init();
+	if (mapper->share == NULL) {
+		return -SQSH_ERROR_MAPPER_INIT;
+	}
+	curl_share_setopt(mapper->share, CURLSHOPT_LOCKFUNC, share_lock);
+	curl_share_setopt(mapper->share, CURLSHOPT_UNLOCKFUNC, share_unlock);
+	curl_share_setopt(mapper->share, CURLSHOPT_USERDATA, mapper);
+	curl_share_setopt(mapper->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+	curl_share_setopt(
+			mapper->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+	curl_share_setopt(mapper->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+	return 0;
+}
+
 static CURL *
-configure_handle(struct SqshCurlMapper *mapper) {
-	CURL *handle = mapper->handle;
+acquire_handle(struct SqshCurlMapper *mapper, int *err) {
+	int rv = 0;
+	bool locked = false;
+	CURL *handle = NULL;
+
+	rv = sqsh__mutex_lock(&mapper->lock, &locked);
+	if (rv < 0) {
+		goto out;
+	}
+	if (mapper->idle_count > 0) {
+		mapper->idle_count--;
+		handle = mapper->idle_handles[mapper->idle_count];
+	}
+	sqsh__mutex_unlock(&mapper->lock, &locked);
+
+	if (handle == NULL) {
+		handle = curl_easy_init();
+		if (handle == NULL) {
+			rv = -SQSH_ERROR_MAPPER_MAP;
+			goto out;
+		}
+	}
+
+out:
+	*err = rv;
+	return handle;
+}
+
+static void
+release_handle(struct SqshCurlMapper *mapper, CURL *handle) {
+	bool locked = false;
+
+	if (handle == NULL) {
+		return;
+	}
+	if (sqsh__mutex_lock(&mapper->lock, &locked) < 0) {
+		curl_easy_cleanup(handle);
+		return;
+	}
+	if (mapper->idle_count == mapper->idle_capacity) {
+		size_t capacity = SQSH_MAX(mapper->idle_capacity * 2, 4);
+		CURL **idle_handles =
+				realloc(mapper->idle_handles, capacity * sizeof(CURL *));
+		if (idle_handles == NULL) {
+			sqsh__mutex_unlock(&mapper->lock, &locked);
+			curl_easy_cleanup(handle);
+			return;
+		}
+		mapper->idle_handles = idle_handles;
+		mapper->idle_capacity = capacity;
+	}
+	mapper->idle_handles[mapper->idle_count] = handle;
+	mapper->idle_count++;
+	sqsh__mutex_unlock(&mapper->lock, &locked);
+}
+
+static void
+configure_handle(struct SqshCurlMapper *mapper, CURL *handle) {
 	const long tls_versions =
 			CURL_SSLVERSION_TLSv1_2 | CURL_SSLVERSION_MAX_DEFAULT;
 	curl_easy_reset(handle);
+	curl_easy_setopt(handle, CURLOPT_SHARE, mapper->share);
 	curl_easy_setopt(handle, CURLOPT_URL, mapper->url);
 	curl_easy_setopt(handle, CURLOPT_NOPROGRESS, 1L);
 	curl_easy_setopt(handle, CURLOPT_TCP_KEEPALIVE, 1L);
@@ -147,77 +304,360 @@ configure_handle(struct SqshCurlMapper *mapper) {
 	curl_easy_setopt(handle, CURLOPT_FILETIME, 1L);
 	curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, write_data);
 	curl_easy_setopt(handle, CURLOPT_SSLVERSION, tls_versions);
-	return handle;
+	if (mapper->timeout_ms > 0) {
+		curl_easy_setopt(handle, CURLOPT_TIMEOUT_MS, mapper->timeout_ms);
+	}
 }
 
-static int
-curl_download(
-		CURL *handle, uint64_t offset, size_t size, uint8_t **data,
-		uint64_t *file_size, uint64_t *file_time) {
-	*data = calloc(size, sizeof(uint8_t));
-	if (*data == NULL) {
-		return -SQSH_ERROR_MALLOC_FAILED;
-	}
+static uint64_t
+now_ms(void) {
+	struct timespec ts = {0};
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
 
-	struct SqshCurlWriteInfo write_info = {
-			.size = size,
-			.buffer = *data,
+static void
+backoff(unsigned int attempt) {
+	uint64_t delay_ms = RETRY_BACKOFF_MAX_MS;
+	if (attempt < 16) {
+		delay_ms = SQSH_MIN(
+				(uint64_t)RETRY_BACKOFF_MS << attempt, RETRY_BACKOFF_MAX_MS);
+	}
+	struct timespec ts = {
+			.tv_sec = (time_t)(delay_ms / 1000),
+			.tv_nsec = (long)(delay_ms % 1000) * 1000000,
 	};
+	while (nanosleep(&ts, &ts) < 0 && errno == EINTR) {
+	}
+}
 
-	CURLcode code;
+static int
+transfer_init(
+		struct SqshCurlMapper *mapper, struct SqshCurlTransfer *transfer,
+		uint64_t offset, size_t size) {
 	int rv = 0;
-	/* The actual max-size this string should ever use is 42, but we
-	 * add some padding to be a nice number. Not that 42 isn't nice.
-	 */
-	char range_buffer[64] = {0};
 	const uint64_t end_offset = offset + size - 1;
-	long http_code = 0;
 
-	rv = snprintf(
-			range_buffer, sizeof(range_buffer), "%" PRIu64 "-%" PRIu64, offset,
-			end_offset);
-	if (rv >= (int)sizeof(range_buffer)) {
-		rv = -SQSH_ERROR_MAPPER_MAP;
+	transfer->handle = acquire_handle(mapper, &rv);
+	if (rv < 0) {
 		goto out;
 	}
-	curl_easy_setopt(handle, CURLOPT_RANGE, range_buffer);
-	curl_easy_setopt(handle, CURLOPT_WRITEDATA, &write_info);
+	configure_handle(mapper, transfer->handle);
 
-	code = curl_easy_perform(handle);
-	if (code != CURLE_OK) {
-		rv = -SQSH_ERROR_MAPPER_MAP;
+	transfer->write_info.buffer = calloc(size, sizeof(uint8_t));
+	if (transfer->write_info.buffer == NULL) {
+		rv = -SQSH_ERROR_MALLOC_FAILED;
 		goto out;
 	}
+	transfer->write_info.size = size;
 
-	code = curl_easy_getinfo(handle, CURLINFO_RESPONSE_CODE, &http_code);
-	if (http_code != 206 || code != CURLE_OK) {
+	rv = snprintf(
+			transfer->range, sizeof(transfer->range), "%" PRIu64 "-%" PRIu64,
+			offset, end_offset);
+	if (rv >= (int)sizeof(transfer->range)) {
 		rv = -SQSH_ERROR_MAPPER_MAP;
 		goto out;
 	}
+	rv = 0;
+	curl_easy_setopt(transfer->handle, CURLOPT_RANGE, transfer->range);
+	curl_easy_setopt(
+			transfer->handle, CURLOPT_WRITEDATA, &transfer->write_info);
+
+out:
+	return rv;
+}
+
+static int
+transfer_finish(
+		struct SqshCurlTransfer *transfer, CURLcode code, uint64_t *file_size,
+		uint64_t *file_time) {
+	int rv = 0;
+	long http_code = 0;
+
+	transfer->retryable = false;
+	if (transfer->write_info.rv < 0) {
+		return transfer->write_info.rv;
+	}
+
+	curl_easy_getinfo(transfer->handle, CURLINFO_RESPONSE_CODE, &http_code);
+	if (code != CURLE_OK) {
+		/* Network errors, timeouts and server side errors are likely to be
+		 * transient. Client errors will not go away by retrying. */
+		transfer->retryable = code != CURLE_HTTP_RETURNED_ERROR ||
+				http_code == 429 || http_code >= 500;
+		return -SQSH_ERROR_MAPPER_MAP;
+	}
+	if (http_code != 206) {
+		return -SQSH_ERROR_MAPPER_MAP;
+	}
 
-	rv = get_total_size(handle, file_size);
+	rv = get_total_size(transfer->handle, file_size);
+	if (rv < 0) {
+		return rv;
+	}
+
+	return get_file_time(transfer->handle, file_time);
+}
+
+static uint8_t *
+transfer_take(struct SqshCurlTransfer *transfer) {
+	uint8_t *data = transfer->write_info.buffer;
+	transfer->write_info.buffer = NULL;
+	return data;
+}
+
+static void
+transfer_cleanup(
+		struct SqshCurlMapper *mapper, struct SqshCurlTransfer *transfer) {
+	free(transfer->write_info.buffer);
+	release_handle(mapper, transfer->handle);
+	memset(transfer, 0, sizeof(*transfer));
+}
+
+static int
+download_single(
+		struct SqshCurlMapper *mapper, uint64_t offset, size_t size,
+		uint8_t **data, uint64_t *file_size, uint64_t *file_time,
+		bool *retryable) {
+	int rv = 0;
+	CURLcode code;
+	struct SqshCurlTransfer transfer = {0};
+
+	rv = transfer_init(mapper, &transfer, offset, size);
 	if (rv < 0) {
 		goto out;
 	}
 
-	rv = get_file_time(handle, file_time);
+	code = curl_easy_perform(transfer.handle);
+	rv = transfer_finish(&transfer, code, file_size, file_time);
+	*retryable = transfer.retryable;
 	if (rv < 0) {
 		goto out;
 	}
+	*data = transfer_take(&transfer);
 
 out:
+	transfer_cleanup(mapper, &transfer);
+	return rv;
+}
+
+/**
+ * Runs the request on a multi handle. If it has not completed after
+ * `hedge_ms`, an identical request is started and whichever of both
+ * completes successfully first is used. The other one is aborted.
+ */
+static int
+download_hedged(
+		struct SqshCurlMapper *mapper, uint64_t offset, size_t size,
+		uint8_t **data, uint64_t *file_size, uint64_t *file_time,
+		bool *retryable) {
+	int rv = 0;
+	CURLM *multi = NULL;
+	CURLMsg *msg;
+	struct SqshCurlTransfer transfers[2] = {0};
+	size_t active = 0;
+	bool hedged = false;
+	int running = 0;
+	int queued = 0;
+	const uint64_t start_time = now_ms();
+
+	multi = curl_multi_init();
+	if (multi == NULL) {
+		rv = -SQSH_ERROR_MAPPER_MAP;
+		goto out;
+	}
+
+	rv = transfer_init(mapper, &transfers[0], offset, size);
 	if (rv < 0) {
-		free(*data);
-		*data = NULL;
+		goto out;
+	}
+	curl_multi_add_handle(multi, transfers[0].handle);
+	active++;
+
+	while (active > 0) {
+		if (curl_multi_perform(multi, &running) != CURLM_OK) {
+			rv = -SQSH_ERROR_MAPPER_MAP;
+			goto out;
+		}
+		while ((msg = curl_multi_info_read(multi, &queued)) != NULL) {
+			if (msg->msg != CURLMSG_DONE) {
+				continue;
+			}
+			struct SqshCurlTransfer *transfer =
+					msg->easy_handle == transfers[0].handle ? &transfers[0]
+															: &transfers[1];
+			const CURLcode code = msg->data.result;
+			curl_multi_remove_handle(multi, transfer->handle);
+			active--;
+
+			rv = transfer_finish(transfer, code, file_size, file_time);
+			*retryable = transfer->retryable;
+			if (rv == 0) {
+				*data = transfer_take(transfer);
+				goto out;
+			}
+		}
+		if (active == 0) {
+			break;
+		}
+
+		int timeout_ms = 1000;
+		if (hedged == false) {
+			const uint64_t elapsed = now_ms() - start_time;
+			if (elapsed >= (uint64_t)mapper->hedge_ms) {
+				hedged = true;
+				/* The hedged request is an optimization. If it cannot be
+				 * started, keep waiting for the first one. */
+				if (transfer_init(mapper, &transfers[1], offset, size) < 0) {
+					transfer_cleanup(mapper, &transfers[1]);
+					continue;
+				}
+				curl_multi_add_handle(multi, transfers[1].handle);
+				active++;
+				continue;
+			}
+			timeout_ms = SQSH_MIN(
+					timeout_ms, (int)((uint64_t)mapper->hedge_ms - elapsed));
+		}
+		curl_multi_poll(multi, NULL, 0, timeout_ms, NULL);
+	}
+
+out:
+	for (size_t i = 0; i < sizeof(transfers) / sizeof(transfers[0]); i++) {
+		if (multi != NULL && transfers[i].handle != NULL) {
+			curl_multi_remove_handle(multi, transfers[i].handle);
+		}
+		transfer_cleanup(mapper, &transfers[i]);
+	}
+	if (multi != NULL) {
+		curl_multi_cleanup(multi);
 	}
 	return rv;
 }
 
+static int
+curl_download(
+		struct SqshCurlMapper *mapper, uint64_t offset, size_t size,
+		uint8_t **data, uint64_t *file_size, uint64_t *file_time) {
+	int rv = 0;
+
+	for (unsigned int attempt = 0;; attempt++) {
+		bool retryable = false;
+		if (mapper->hedge_ms > 0) {
+			rv = download_hedged(
+					mapper, offset, size, data, file_size, file_time,
+					&retryable);
+		} else {
+			rv = download_single(
+					mapper, offset, size, data, file_size, file_time,
+					&retryable);
+		}
+		const int share_rv = atomic_load(&mapper->share_rv);
+		if (share_rv < 0) {
+			if (rv == 0) {
+				free(*data);
+				*data = NULL;
+			}
+			return share_rv;
+		}
+		if (rv == 0 || retryable == false || attempt >= mapper->retries) {
+			return rv;
+		}
+		backoff(attempt);
+	}
+}
+
+static bool
+take_prefetched(
+		struct SqshCurlMapper *mapper, uint64_t offset, size_t size,
+		uint8_t **data, size_t *fetch_blocks) {
+	bool locked = false;
+	*fetch_blocks = 1;
+	if (sqsh__mutex_lock(&mapper->lock, &locked) < 0) {
+		return false;
+	}
+
+	for (size_t i = 0; i < PREFETCH_CAPACITY; i++) {
+		struct SqshCurlChunk *chunk = &mapper->prefetched[i];
+		if (chunk->data != NULL && chunk->offset == offset &&
+			chunk->size == size) {
+			*data = chunk->data;
+			chunk->data = NULL;
+			break;
+		}
+	}
+
+	if (offset != mapper->next_offset) {
+		mapper->fetch_blocks = 1;
+	} else if (*data == NULL) {
+		mapper->fetch_blocks =
+				SQSH_MIN(mapper->fetch_blocks * 2, COALESCE_MAX_BLOCKS);
+	}
+	mapper->next_offset = offset + size;
+	*fetch_blocks = mapper->fetch_blocks;
+
+	sqsh__mutex_unlock(&mapper->lock, &locked);
+	return *data != NULL;
+}
+
+static void
+store_prefetched(
+		struct SqshCurlMapper *mapper, uint64_t offset, size_t size,
+		uint8_t *data) {
+	bool locked = false;
+	if (sqsh__mutex_lock(&mapper->lock, &locked) < 0) {
+		free(data);
+		return;
+	}
+
+	struct SqshCurlChunk *chunk = &mapper->prefetched[mapper->prefetch_next];
+	free(chunk->data);
+	chunk->offset = offset;
+	chunk->size = size;
+	chunk->data = data;
+	mapper->prefetch_next = (mapper->prefetch_next + 1) % PREFETCH_CAPACITY;
+
+	sqsh__mutex_unlock(&mapper->lock, &locked);
+}
+
+/**
+ * Splits the blocks that follow the requested one off a coalesced download
+ * and keeps them for later map calls. Prefetching is best effort, so
+ * allocation failures only drop the affected blocks.
+ */
+static void
+split_prefetched(
+		struct SqshCurlMapper *mapper, uint64_t offset, size_t size,
+		uint8_t **data, uint64_t fetch_size) {
+	for (uint64_t chunk_offset = size; chunk_offset < fetch_size;
+		 chunk_offset += size) {
+		const size_t chunk_size =
+				(size_t)SQSH_MIN((uint64_t)size, fetch_size - chunk_offset);
+		uint8_t *chunk = malloc(chunk_size);
+		if (chunk == NULL) {
+			break;
+		}
+		memcpy(chunk, &(*data)[chunk_offset], chunk_size);
+		if (mapper->has_disk_cache) {
+			sqsh__disk_cache_put(
+					&mapper->disk_cache, offset + chunk_offset, chunk_size,
+					chunk);
+		}
+		store_prefetched(mapper, offset + chunk_offset, chunk_size, chunk);
+	}
+
+	uint8_t *shrunk = realloc(*data, size);
+	if (shrunk != NULL) {
+		*data = shrunk;
+	}
+}
+
 static int
 sqsh_mapper_curl_init(
 		struct SqshMapper *mapper, const void *input, uint64_t *size) {
 	(void)size;
 	int rv = 0;
+	const struct SqshConfig *config = mapper->config;
 	curl_global_init(CURL_GLOBAL_ALL);
 
 	struct SqshCurlMapper *curl_mapper =
@@ -227,20 +667,33 @@ sqsh_mapper_curl_init(
 		goto out;
 	}
 	curl_mapper->url = strdup(input);
-	curl_mapper->handle = curl_easy_init();
+	atomic_init(&curl_mapper->share_rv, 0);
 	sqsh_mapper_set_user_data(mapper, curl_mapper);
 
+	curl_mapper->timeout_ms = DEFAULT_TIMEOUT_MS;
+	curl_mapper->retries = DEFAULT_RETRIES;
+	if (config != NULL) {
+		curl_mapper->timeout_ms = (long)SQSH_CONFIG_DEFAULT(
+				config->mapper_timeout_ms, DEFAULT_TIMEOUT_MS);
+		curl_mapper->retries = (unsigned int)SQSH_CONFIG_DEFAULT(
+				config->mapper_retries, DEFAULT_RETRIES);
+		curl_mapper->hedge_ms = (long)SQSH_CONFIG_DEFAULT(
+				config->mapper_hedge_ms, 0);
+	}
+
 	rv = sqsh__mutex_init(&curl_mapper->lock);
 	if (rv < 0) {
 		goto out;
 	}
+	rv = init_share(curl_mapper);
+	if (rv < 0) {
+		goto out;
+	}
 
 	size_t block_size = sqsh_mapper_block_size(mapper);
-	CURL *handle = configure_handle(curl_mapper);
-
 	uint64_t size64 = *size;
 	rv = curl_download(
-			handle, 0, block_size, &curl_mapper->header_cache, &size64,
+			curl_mapper, 0, block_size, &curl_mapper->header_cache, &size64,
 			&curl_mapper->expected_time);
 	if (rv < 0) {
 		goto out;
@@ -250,6 +703,24 @@ sqsh_mapper_curl_init(
 		goto out;
 	}
 	*size = (size_t)size64;
+	curl_mapper->next_offset = block_size;
+	curl_mapper->fetch_blocks = 1;
+
+	if (config != NULL && config->mapper_cache_dir != NULL) {
+		const uint64_t cache_size = config->mapper_cache_size == 0
+				? DEFAULT_CACHE_SIZE
+				: config->mapper_cache_size;
+		rv = sqsh__disk_cache_init(
+				&curl_mapper->disk_cache, config->mapper_cache_dir,
+				curl_mapper->url, curl_mapper->expected_time, cache_size);
+		if (rv < 0) {
+			goto out;
+		}
+		curl_mapper->has_disk_cache = true;
+		sqsh__disk_cache_put(
+				&curl_mapper->disk_cache, 0, block_size,
+				curl_mapper->header_cache);
+	}
 
 out:
 	return rv;
@@ -263,37 +734,78 @@ sqsh_mapper_curl_map(
 	int rv = 0;
 	uint64_t file_size = 0;
 	uint64_t file_time = 0;
+	uint64_t fetch_size = size;
+	size_t fetch_blocks = 1;
+	*data = NULL;
 
-	bool locked = false;
-	sqsh__mutex_t *lock = &curl_mapper->lock;
-	rv = sqsh__mutex_lock(lock, &locked);
-	if (rv < 0) {
-		goto out;
-	}
-	if (offset == 0 && curl_mapper->header_cache != NULL) {
+	if (offset == 0) {
+		bool locked = false;
+		rv = sqsh__mutex_lock(&curl_mapper->lock, &locked);
+		if (rv < 0) {
+			goto out;
+		}
 		*data = curl_mapper->header_cache;
 		curl_mapper->header_cache = NULL;
-	} else {
-		CURL *handle = configure_handle(mapper->user_data);
-
-		rv = curl_download(handle, offset, size, data, &file_size, &file_time);
-		if (rv < 0) {
+		sqsh__mutex_unlock(&curl_mapper->lock, &locked);
+		if (*data != NULL) {
 			goto out;
 		}
+	}
 
-		if (file_time != curl_mapper->expected_time) {
-			rv = -SQSH_ERROR_MAPPER_MAP;
+	if (take_prefetched(curl_mapper, offset, size, data, &fetch_blocks)) {
+		goto out;
+	}
+
+	if (curl_mapper->has_disk_cache) {
+		*data = calloc(size, sizeof(uint8_t));
+		if (*data == NULL) {
+			rv = -SQSH_ERROR_MALLOC_FAILED;
 			goto out;
 		}
-
-		if (file_size != sqsh_mapper_size2(mapper)) {
-			rv = -SQSH_ERROR_MAPPER_MAP;
+		if (sqsh__disk_cache_get(
+					&curl_mapper->disk_cache, offset, size, *data)) {
 			goto out;
 		}
+		free(*data);
+		*data = NULL;
+	}
+
+	if (fetch_blocks > 1) {
+		fetch_size = SQSH_MIN(
+				(uint64_t)size * fetch_blocks,
+				sqsh_mapper_size2(mapper) - offset);
+	}
+	rv = curl_download(
+			curl_mapper, offset, (size_t)fetch_size, data, &file_size,
+			&file_time);
+	if (rv < 0) {
+		goto out;
+	}
+
+	if (file_time != curl_mapper->expected_time) {
+		rv = -SQSH_ERROR_MAPPER_MAP;
+		goto out;
+	}
+
+	if (file_size != sqsh_mapper_size2(mapper)) {
+		rv = -SQSH_ERROR_MAPPER_MAP;
+		goto out;
+	}
+
+	if (fetch_size > size) {
+		split_prefetched(curl_mapper, offset, size, data, fetch_size);
+	}
+
+	if (curl_mapper->has_disk_cache) {
+		/* Failing to persist the chunk does not affect this read. */
+		sqsh__disk_cache_put(&curl_mapper->disk_cache, offset, size, *data);
 	}
 
 out:
-	sqsh__mutex_unlock(lock, &locked);
+	if (rv < 0 && *data != NULL) {
+		free(*data);
+		*data = NULL;
+	}
 	return rv;
 }
 
@@ -303,8 +815,23 @@ sqsh_mapper_curl_cleanup(struct SqshMapper *mapper) {
 
 	free(user_data->url);
 	free(user_data->header_cache);
+	for (size_t i = 0; i < PREFETCH_CAPACITY; i++) {
+		free(user_data->prefetched[i].data);
+	}
+	if (user_data->has_disk_cache) {
+		sqsh__disk_cache_cleanup(&user_data->disk_cache);
+	}
+	for (size_t i = 0; i < user_data->idle_count; i++) {
+		curl_easy_cleanup(user_data->idle_handles[i]);
+	}
+	free(user_data->idle_handles);
+	if (user_data->share != NULL) {
+		curl_share_cleanup(user_data->share);
+	}
+	for (size_t i = 0; i < CURL_LOCK_DATA_LAST; i++) {
+		sqsh__mutex_destroy(&user_data->share_locks[i]);
+	}
 	sqsh__mutex_destroy(&user_data->lock);
-	curl_easy_cleanup(user_data->handle);
 	free(user_data);
 	return 0;
 }
@@ -0,0 +1,368 @@
+/******************************************************************************
+ *                                                                            *
+ * Copyright (c) 2023-2024, Enno Boland <g@s01.de>                            *
+ *                                                                            *
+ * Redistribution and use in source and binary forms, with or without         *
+ * modification, are permitted provided that the following conditions are     *
+ * met:                                                                       *
+ *                                                                            *
+ * * Redistributions of source code must retain the above copyright notice,   *
+ *   this list of conditions and the following disclaimer.                    *
+ * * Redistributions in binary form must reproduce the above copyright        *
+ *   notice, this list of conditions and the following disclaimer in the      *
+ *   documentation and/or other materials provided with the distribution.     *
+ *                                                                            *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS    *
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,  *
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR     *
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR          *
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,      *
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,        *
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR         *
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF     *
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING       *
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS         *
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.               *
+ *                                                                            *
+ ******************************************************************************/
+
+
+/**
+ * @author       Enno Boland (mail@eboland.de)
+ * @file         disk_cache.c
+ */
+
+#define _DEFAULT_SOURCE
+
+#include <sqsh_mapper_private.h>
+
+#include <sqsh_common_private.h>
+#include <sqsh_error.h>
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* When the cache is full, entries are evicted until it is filled up to this
+ * percentage, so that not every insertion triggers a directory scan. */
+#define DISK_CACHE_LOW_WATERMARK 90
+
+struct DiskCacheEntry {
+	char *name;
+	uint64_t size;
+	struct timespec mtime;
+};
+
+static uint64_t
+hash_name(const char *name) {
+	/* FNV-1a */
+	uint64_t hash = UINT64_C(0xcbf29ce484222325);
+	for (; *name != '\0'; name++) {
+		hash ^= (uint8_t)*name;
+		hash *= UINT64_C(0x100000001b3);
+	}
+	return hash;
+}
+
+static int
+entry_path(
+		const struct SqshDiskCache *cache, const char *name, char **path) {
+	const size_t size = strlen(cache->path) + strlen(name) + 2;
+	*path = malloc(size);
+	if (*path == NULL) {
+		return -SQSH_ERROR_MALLOC_FAILED;
+	}
+	snprintf(*path, size, "%s/%s", cache->path, name);
+	return 0;
+}
+
+static int
+chunk_path(
+		const struct SqshDiskCache *cache, uint64_t offset, size_t size,
+		char **path) {
+	char name[sizeof(cache->prefix) + 64];
+	snprintf(
+			name, sizeof(name), "%s%" PRIx64 "-%zx", cache->prefix, offset,
+			size);
+	return entry_path(cache, name, path);
+}
+
+static int
+compare_entries(const void *a, const void *b) {
+	const struct DiskCacheEntry *entry_a = a;
+	const struct DiskCacheEntry *entry_b = b;
+	if (entry_a->mtime.tv_sec != entry_b->mtime.tv_sec) {
+		return entry_a->mtime.tv_sec < entry_b->mtime.tv_sec ? -1 : 1;
+	}
+	if (entry_a->mtime.tv_nsec != entry_b->mtime.tv_nsec) {
+		return entry_a->mtime.tv_nsec < entry_b->mtime.tv_nsec ? -1 : 1;
+	}
+	return 0;
+}
+
+/**
+ * Scans the cache directory, removes entries of outdated versions and, if
+ * the cache is larger than `target_size`, the least recently used entries.
+ * Must be called with the lock held.
+ */
+static int
+scan(struct SqshDiskCache *cache, uint64_t target_size) {
+	int rv = 0;
+	DIR *dir = NULL;
+	struct dirent *dirent;
+	struct DiskCacheEntry *entries = NULL;
+	size_t entry_count = 0;
+	size_t entry_capacity = 0;
+	uint64_t size = 0;
+	char *path = NULL;
+	const size_t name_prefix_len = strlen(cache->name_prefix);
+	const size_t prefix_len = strlen(cache->prefix);
+
+	dir = opendir(cache->path);
+	if (dir == NULL) {
+		rv = -SQSH_ERROR_MAPPER_INIT;
+		goto out;
+	}
+
+	while ((dirent = readdir(dir)) != NULL) {
+		struct stat st;
+		const char *name = dirent->d_name;
+		if (name[0] == '.') {
+			continue;
+		}
+
+		free(path);
+		rv = entry_path(cache, name, &path);
+		if (rv < 0) {
+			goto out;
+		}
+		if (stat(path, &st) < 0 || !S_ISREG(st.st_mode)) {
+			continue;
+		}
+
+		/* Entries of the same archive with a different version are stale. */
+		if (strncmp(name, cache->name_prefix, name_prefix_len) == 0 &&
+			strncmp(name, cache->prefix, prefix_len) != 0) {
+			unlink(path);
+			continue;
+		}
+
+		if (entry_count == entry_capacity) {
+			size_t capacity = SQSH_MAX(entry_capacity * 2, 64);
+			struct DiskCacheEntry *new_entries =
+					realloc(entries, capacity * sizeof(struct DiskCacheEntry));
+			if (new_entries == NULL) {
+				rv = -SQSH_ERROR_MALLOC_FAILED;
+				goto out;
+			}
+			entries = new_entries;
+			entry_capacity = capacity;
+		}
+		entries[entry_count].name = strdup(name);
+		if (entries[entry_count].name == NULL) {
+			rv = -SQSH_ERROR_MALLOC_FAILED;
+			goto out;
+		}
+		entries[entry_count].size = (uint64_t)st.st_size;
+		entries[entry_count].mtime = st.st_mtim;
+		entry_count++;
+		size += (uint64_t)st.st_size;
+	}
+
+	if (size > target_size) {
+		qsort(entries, entry_count, sizeof(struct DiskCacheEntry),
+			  compare_entries);
+		for (size_t i = 0; i < entry_count && size > target_size; i++) {
+			free(path);
+			rv = entry_path(cache, entries[i].name, &path);
+			if (rv < 0) {
+				goto out;
+			}
+			if (unlink(path) == 0 || errno == ENOENT) {
+				size -= entries[i].size;
+			}
+		}
+	}
+	cache->size = size;
+
+out:
+	for (size_t i = 0; i < entry_count; i++) {
+		free(entries[i].name);
+	}
+	free(entries);
+	free(path);
+	if (dir != NULL) {
+		closedir(dir);
+	}
+	return rv;
+}
+
+int
+sqsh__disk_cache_init(
+		struct SqshDiskCache *cache, const char *path, const char *name,
+		uint64_t version, uint64_t max_size) {
+	int rv = 0;
+	bool locked = false;
+
+	rv = sqsh__mutex_init(&cache->lock);
+	if (rv < 0) {
+		goto out;
+	}
+	cache->path = strdup(path);
+	if (cache->path == NULL) {
+		rv = -SQSH_ERROR_MALLOC_FAILED;
+		goto out;
+	}
+	cache->max_size = max_size;
+	cache->size = 0;
+
+	const uint64_t name_hash = hash_name(name);
+	snprintf(
+			cache->name_prefix, sizeof(cache->name_prefix), "%016" PRIx64 "-",
+			name_hash);
+	snprintf(
+			cache->prefix, sizeof(cache->prefix), "%016" PRIx64 "-%" PRIx64 "-",
+			name_hash, version);
+
+	if (mkdir(cache->path, 0700) < 0 && errno != EEXIST) {
+		rv = -SQSH_ERROR_MAPPER_INIT;
+		goto out;
+	}
+
+	rv = sqsh__mutex_lock(&cache->lock, &locked);
+	if (rv < 0) {
+		goto out;
+	}
+	rv = scan(cache, cache->max_size);
+
+out:
+	sqsh__mutex_unlock(&cache->lock, &locked);
+	if (rv < 0) {
+		sqsh__disk_cache_cleanup(cache);
+	}
+	return rv;
+}
+
+bool
+sqsh__disk_cache_get(
+		struct SqshDiskCache *cache, uint64_t offset, size_t size,
+		uint8_t *target) {
+	bool hit = false;
+	int fd = -1;
+	char *path = NULL;
+	struct stat st;
+	size_t read_size = 0;
+
+	if (chunk_path(cache, offset, size, &path) < 0) {
+		goto out;
+	}
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		goto out;
+	}
+	if (fstat(fd, &st) < 0 || (uint64_t)st.st_size != size) {
+		goto out;
+	}
+	while (read_size < size) {
+		ssize_t rv = read(fd, &target[read_size], size - read_size);
+		if (rv < 0 && errno == EINTR) {
+			continue;
+		} else if (rv <= 0) {
+			goto out;
+		}
+		read_size += (size_t)rv;
+	}
+
+	/* The modification time tracks the last access for the LRU eviction. */
+	futimens(fd, NULL);
+	hit = true;
+
+out:
+	if (fd >= 0) {
+		close(fd);
+	}
+	free(path);
+	return hit;
+}
+
+int
+sqsh__disk_cache_put(
+		struct SqshDiskCache *cache, uint64_t offset, size_t size,
+		const uint8_t *data) {
+	int rv = 0;
+	int fd = -1;
+	bool locked = false;
+	char *path = NULL;
+	char *tmp_path = NULL;
+	size_t written = 0;
+
+	rv = chunk_path(cache, offset, size, &path);
+	if (rv < 0) {
+		goto out;
+	}
+	rv = entry_path(cache, ".tmp-XXXXXX", &tmp_path);
+	if (rv < 0) {
+		goto out;
+	}
+
+	/* Write to a temporary file first and move it in place afterwards, so
+	 * that other processes never see partially written entries. */
+	fd = mkstemp(tmp_path);
+	if (fd < 0) {
+		free(tmp_path);
+		tmp_path = NULL;
+		rv = -SQSH_ERROR_MAPPER_MAP;
+		goto out;
+	}
+	while (written < size) {
+		ssize_t write_rv = write(fd, &data[written], size - written);
+		if (write_rv < 0 && errno == EINTR) {
+			continue;
+		} else if (write_rv <= 0) {
+			rv = -SQSH_ERROR_MAPPER_MAP;
+			goto out;
+		}
+		written += (size_t)write_rv;
+	}
+	if (rename(tmp_path, path) < 0) {
+		rv = -SQSH_ERROR_MAPPER_MAP;
+		goto out;
+	}
+	free(tmp_path);
+	tmp_path = NULL;
+
+	rv = sqsh__mutex_lock(&cache->lock, &locked);
+	if (rv < 0) {
+		goto out;
+	}
+	cache->size += size;
+	if (cache->size > cache->max_size) {
+		rv = scan(cache, cache->max_size / 100 * DISK_CACHE_LOW_WATERMARK);
+	}
+
+out:
+	sqsh__mutex_unlock(&cache->lock, &locked);
+	if (fd >= 0) {
+		close(fd);
+	}
+	if (tmp_path != NULL) {
+		unlink(tmp_path);
+		free(tmp_path);
+	}
+	free(path);
+	return rv;
+}
+
+int
+sqsh__disk_cache_cleanup(struct SqshDiskCache *cache) {
+	free(cache->path);
+	cache->path = NULL;
+	sqsh__mutex_destroy(&cache->lock);
+	return 0;
+}
@@ -34,8 +34,16 @@
 #include <sqsh_mapper_private.h>
 
 #include <sqsh_archive.h>
+#include <sqsh_archive_private.h>
 #include <sqsh_common_private.h>
 #include <sqsh_error.h>
+#include <stdlib.h>
+
+/* The upper limit of shards a map manager splits its slice cache into. Must
+ * be a power of two. */
+#define SQSH_MAP_MANAGER_MAX_SHARDS 64
+/* The minimum amount of blocks that an archive needs per shard. */
+#define SQSH_MAP_MANAGER_SHARD_MIN_BLOCKS 16
 
 static void
 map_cleanup_cb(void *data) {
@@ -78,18 +86,38 @@ out:
 	return rv;
 }
 
+static size_t
+shard_count_for(uint64_t block_count, size_t lru_size) {
+	size_t shard_count = 1;
+
+	/* Only shard archives that span enough blocks to make concurrent access
+	 * to different slices likely. Every shard gets at least
+	 * SQSH_MAP_MANAGER_SHARD_MIN_BLOCKS blocks and one LRU entry.
+	 */
+	while (shard_count < SQSH_MAP_MANAGER_MAX_SHARDS &&
+		   shard_count * 2 * SQSH_MAP_MANAGER_SHARD_MIN_BLOCKS <= block_count &&
+		   (lru_size == 0 || shard_count * 2 <= lru_size)) {
+		shard_count *= 2;
+	}
+	return shard_count;
+}
+
+static struct SqshMapManagerShard *
+get_shard(const struct SqshMapManager *manager, uint64_t index) {
+	return &manager->shards[index & (manager->shard_count - 1)];
+}
+
 int
 sqsh__map_manager_init(
 		struct SqshMapManager *manager, const void *input,
 		const struct SqshConfig *config) {
 	int rv;
-	const size_t lru_size = SQSH_CONFIG_DEFAULT(config->mapper_lru_size, 32);
 	const uint64_t archive_offset = config->archive_offset;
 
-	rv = sqsh__mutex_init(&manager->lock);
-	if (rv < 0) {
-		goto out;
-	}
+	manager->shards = NULL;
+	manager->shard_count = 0;
+	manager->is_direct = false;
+
 	rv = sqsh__mapper_init(&manager->mapper, input, config);
 	if (rv < 0) {
 		goto out;
@@ -101,19 +129,83 @@ sqsh__map_manager_init(
 		rv = -SQSH_ERROR_OUT_OF_BOUNDS;
 		goto out;
 	}
+	const size_t lru_size = sqsh__config_lru_size(
+			config->mapper_lru_size, config->mapper_lru_bytes,
+			config->lru_bytes / 4, sqsh_mapper_block_size(&manager->mapper),
+			32);
 	manager->block_count = SQSH_DIVIDE_CEIL(
 			mapper_size - archive_offset,
 			sqsh_mapper_block_size(&manager->mapper));
 
 	manager->archive_offset = archive_offset;
-	rv = cx_rc_hash_map_init(
-			&manager->maps, 1024, sizeof(struct SqshMapSlice), map_cleanup_cb);
-	if (rv < 0) {
+
+	/* Blocks of the mmap mapper only take address space, not heap memory,
+	 * so they are not charged to a shared cache context. */
+	struct SqshCacheContext *context = config->cache_context;
+	if (manager->mapper.impl == sqsh_mapper_impl_mmap) {
+		context = NULL;
+	}
+
+	/* A disabled LRU means that unused blocks are unmapped immediately, so
+	 * do not keep the archive mapped in that case. The same applies if the
+	 * mapped blocks count against the budget of a shared cache context. */
+	if (manager->block_count == 1 && lru_size > 0 && context == NULL) {
+		rv = load_mapping(&manager->direct, manager, 0);
+		if (rv < 0) {
+			goto out;
+		}
+		manager->is_direct = true;
+		goto out;
+	}
+
+	const size_t shard_count = shard_count_for(manager->block_count, lru_size);
+	const size_t shard_lru_size = SQSH_DIVIDE_CEIL(lru_size, shard_count);
+	/* At most the cached slices and the ones in use are live at a time, so
+	 * size the map by the LRU and not by the size of the archive. */
+	const size_t shard_map_size = SQSH_MAX(
+			2 * shard_lru_size, (size_t)SQSH_MAP_MANAGER_SHARD_MIN_BLOCKS);
+	const int policy =
+			context != NULL ? context->policy : SQSH_CACHE_POLICY_LRU;
+
+	manager->shards = calloc(shard_count, sizeof(struct SqshMapManagerShard));
+	if (manager->shards == NULL) {
+		rv = -SQSH_ERROR_MALLOC_FAILED;
 		goto out;
 	}
 
-	rv = cx_lru_init(
-			&manager->lru, lru_size, &cx_lru_rc_hash_map, &manager->maps);
+	for (size_t i = 0; i < shard_count; i++) {
+		struct SqshMapManagerShard *shard = &manager->shards[i];
+
+		rv = sqsh__mutex_init(&shard->lock);
+		if (rv < 0) {
+			goto out;
+		}
+		rv = cx_rc_hash_map_init(
+				&shard->maps, shard_map_size, sizeof(struct SqshMapSlice),
+				map_cleanup_cb);
+		if (rv < 0) {
+			sqsh__mutex_destroy(&shard->lock);
+			goto out;
+		}
+
+		rv = sqsh__extract_cache_init(
+				&shard->lru, shard_lru_size, policy, &shard->maps);
+		if (rv < 0) {
+			cx_rc_hash_map_cleanup(&shard->maps);
+			sqsh__mutex_destroy(&shard->lock);
+			goto out;
+		}
+		if (context != NULL) {
+			rv = sqsh__extract_cache_attach(&shard->lru, context, &shard->lock);
+			if (rv < 0) {
+				sqsh__extract_cache_cleanup(&shard->lru);
+				cx_rc_hash_map_cleanup(&shard->maps);
+				sqsh__mutex_destroy(&shard->lock);
+				goto out;
+			}
+		}
+		manager->shard_count++;
+	}
 out:
 	if (rv < 0) {
 		sqsh__map_manager_cleanup(manager);
@@ -137,87 +229,108 @@ sqsh__map_manager_get(
 		const struct SqshMapSlice **target) {
 	bool is_locked = false;
 	int rv = 0;
+	if (manager->is_direct) {
+		if (index != 0) {
+			return -SQSH_ERROR_OUT_OF_BOUNDS;
+		}
+		*target = &manager->direct;
+		return 0;
+	}
+
+	struct SqshMapManagerShard *shard = get_shard(manager, index);
 
-	rv = sqsh__mutex_lock(&manager->lock, &is_locked);
+	rv = sqsh__mutex_lock(&shard->lock, &is_locked);
 	if (rv < 0) {
 		goto out;
 	}
 
-	*target = cx_rc_hash_map_retain(&manager->maps, index);
+	*target = cx_rc_hash_map_retain(&shard->maps, index);
 
 	if (*target == NULL) {
 		struct SqshMapSlice mapping = {0};
-		sqsh__mutex_unlock(&manager->lock, &is_locked);
+		sqsh__mutex_unlock(&shard->lock, &is_locked);
 		rv = load_mapping(&mapping, manager, index);
 		if (rv < 0) {
 			goto out;
 		}
 
-		rv = sqsh__mutex_lock(&manager->lock, &is_locked);
+		rv = sqsh__mutex_lock(&shard->lock, &is_locked);
 		if (rv < 0) {
 			sqsh__map_slice_cleanup(&mapping);
 			goto out;
 		}
 
-		*target = cx_rc_hash_map_put(&manager->maps, index, &mapping);
+		*target = cx_rc_hash_map_put(&shard->maps, index, &mapping);
 		if (*target == NULL) {
 			sqsh__map_slice_cleanup(&mapping);
 			rv = -SQSH_ERROR_MALLOC_FAILED;
 			goto out;
 		}
 	}
-	rv = cx_lru_touch(&manager->lru, index);
+	const size_t size = sqsh__map_slice_size(*target);
+	rv = sqsh__extract_cache_touch(&shard->lru, index, size, size);
 
 out:
-	sqsh__mutex_unlock(&manager->lock, &is_locked);
+	sqsh__mutex_unlock(&shard->lock, &is_locked);
 	return rv;
 }
 
 int
 sqsh__map_manager_retain(
 		struct SqshMapManager *manager, const struct SqshMapSlice *mapping) {
-	if (manager == NULL || mapping == NULL) {
+	if (manager == NULL || mapping == NULL || manager->is_direct) {
 		return 0;
 	}
+	struct SqshMapManagerShard *shard = get_shard(manager, mapping->index);
 	bool locked = false;
-	int rv = sqsh__mutex_lock(&manager->lock, &locked);
+	int rv = sqsh__mutex_lock(&shard->lock, &locked);
 	if (rv < 0) {
 		goto out;
 	}
 
-	cx_rc_hash_map_retain(&manager->maps, mapping->index);
+	cx_rc_hash_map_retain(&shard->maps, mapping->index);
 
 out:
-	sqsh__mutex_unlock(&manager->lock, &locked);
+	sqsh__mutex_unlock(&shard->lock, &locked);
 	return rv;
 }
 
 int
 sqsh__map_manager_release(
 		struct SqshMapManager *manager, const struct SqshMapSlice *mapping) {
-	if (manager == NULL || mapping == NULL) {
+	if (manager == NULL || mapping == NULL || manager->is_direct) {
 		return 0;
 	}
+	struct SqshMapManagerShard *shard = get_shard(manager, mapping->index);
 	bool locked = false;
-	int rv = sqsh__mutex_lock(&manager->lock, &locked);
+	int rv = sqsh__mutex_lock(&shard->lock, &locked);
 	if (rv < 0) {
 		goto out;
 	}
 
-	cx_rc_hash_map_release_key(&manager->maps, mapping->index);
+	cx_rc_hash_map_release_key(&shard->maps, mapping->index);
 
 out:
-	sqsh__mutex_unlock(&manager->lock, &locked);
+	sqsh__mutex_unlock(&shard->lock, &locked);
 	return rv;
 }
 
 int
 sqsh__map_manager_cleanup(struct SqshMapManager *manager) {
-	cx_lru_cleanup(&manager->lru);
-	cx_rc_hash_map_cleanup(&manager->maps);
+	for (size_t i = 0; i < manager->shard_count; i++) {
+		struct SqshMapManagerShard *shard = &manager->shards[i];
+		sqsh__extract_cache_cleanup(&shard->lru);
+		cx_rc_hash_map_cleanup(&shard->maps);
+		sqsh__mutex_destroy(&shard->lock);
+	}
+	free(manager->shards);
+	manager->shards = NULL;
+	manager->shard_count = 0;
+	if (manager->is_direct) {
+		sqsh__map_slice_cleanup(&manager->direct);
+		manager->is_direct = false;
+	}
 	sqsh__mapper_cleanup(&manager->mapper);
 
-	sqsh__mutex_destroy(&manager->lock);
-
 	return 0;
 }
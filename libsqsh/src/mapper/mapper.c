@@ -56,6 +56,7 @@ sqsh__mapper_init(
 		mapper->block_size = mapper->impl->block_size_hint;
 	}
 
+	mapper->config = config;
 	if (mapper->impl->init == NULL) {
 		rv = mapper->impl->init2(mapper, source, &size);
 	} else {
@@ -67,6 +68,7 @@ sqsh__mapper_init(
 		rv = mapper->impl->init(mapper, source, &small_size);
 		size = small_size;
 	}
+	mapper->config = NULL;
 	if (rv < 0) {
 		goto out;
 	}
@@ -41,6 +41,7 @@
 #include <unistd.h>
 
 #include <sqsh_archive.h>
+#include <sqsh_archive_private.h>
 #include <sqsh_common_private.h>
 #include <sqsh_error.h>
 #include <sqsh_file_private.h>
@@ -71,11 +72,14 @@ out:
 	return rv;
 }
 
-struct FileIteratorMtBlock {
-	struct FileIteratorMt *mt;
-	uint64_t block_offset;
-	struct SqshIteratorState state;
-};
+/* Number of consecutive blocks a task processes with a single sequential
+ * iterator. */
+#define FILE_ITERATOR_MT_BATCH_BLOCKS 8
+/* Upper limit of tasks that are scheduled at the same time. */
+#define FILE_ITERATOR_MT_MAX_TASKS 32
+/* Upper limit of decompressed bytes that are held by tasks at the same time.
+ * Each task holds at most one block. */
+#define FILE_ITERATOR_MT_MAX_BYTES (64 * 1024 * 1024)
 
 struct FileIteratorMt {
 	struct SqshFile file;
@@ -83,9 +87,13 @@ struct FileIteratorMt {
 	uint32_t chunk_size;
 	void *data;
 	atomic_int rv;
-	atomic_size_t remaining_blocks;
+	atomic_size_t remaining_tasks;
 
-	struct FileIteratorMtBlock *blocks;
+	uint16_t block_log;
+	uint64_t block_count;
+	uint64_t num_data_blocks;
+	uint64_t batch_count;
+	atomic_uint_fast64_t next_batch;
 };
 
 struct FileToStreamMt {
@@ -100,45 +108,77 @@ static void
 file_iterator_mt_cleanup(struct FileIteratorMt *mt, int rv) {
 	mt->cb(&mt->file, NULL, 0, mt->data, rv);
 	sqsh__file_cleanup(&mt->file);
-	free(mt->blocks);
 	free(mt);
 }
 
-static void
-iterator_worker(void *data) {
+static int
+iterator_batch(struct FileIteratorMt *mt, uint64_t batch) {
 	int rv = 0;
 	struct SqshFileIterator iterator = {0};
-
-	struct FileIteratorMtBlock *block = data;
-	struct FileIteratorMt *mt = block->mt;
-
-	rv = sqsh__file_iterator_init_with_state(
-			&iterator, &mt->file, &block->state);
+	struct SqshIteratorState state = {0};
+	const uint16_t block_log = mt->block_log;
+	const uint64_t file_size = sqsh_file_size(&mt->file);
+	const uint64_t start_block = batch * FILE_ITERATOR_MT_BATCH_BLOCKS;
+	const uint64_t end_block = SQSH_MIN(
+			start_block + FILE_ITERATOR_MT_BATCH_BLOCKS, mt->block_count);
+	uint64_t position = start_block << block_log;
+	const uint64_t end_position = SQSH_MIN(end_block << block_log, file_size);
+
+	/* The fragment (if any) is handled as one extra block beyond the data
+	 * blocks; it has no entry in the block-size list, so its compressed
+	 * offset is the end of the last data block. */
+	state.block_index = start_block;
+	rv = sqsh__file_block_offset(
+			&mt->file, SQSH_MIN(start_block, mt->num_data_blocks),
+			&state.compressed_offset);
 	if (rv < 0) {
 		goto out;
 	}
-
-	bool has_next = sqsh_file_iterator_next(&iterator, 1, &rv);
+	rv = sqsh__file_iterator_init_with_state(&iterator, &mt->file, &state);
 	if (rv < 0) {
 		goto out;
 	}
-	if (has_next == false) {
-		rv = -SQSH_ERROR_OUT_OF_BOUNDS;
-		goto out;
-	}
 
-	mt->cb(&mt->file, &iterator, block->block_offset, mt->data, rv);
+	while (position < end_position) {
+		bool has_next = sqsh_file_iterator_next(&iterator, 1, &rv);
+		if (rv < 0) {
+			goto out;
+		}
+		if (has_next == false) {
+			rv = -SQSH_ERROR_OUT_OF_BOUNDS;
+			goto out;
+		}
+
+		mt->cb(&mt->file, &iterator, position, mt->data, rv);
+		position += sqsh_file_iterator_size(&iterator);
+	}
 
 out:
 	sqsh__file_iterator_cleanup(&iterator);
+	return rv;
+}
 
-	if (rv < 0) {
-		atomic_store(&mt->rv, rv);
+static void
+iterator_worker(void *data) {
+	int rv = 0;
+	struct FileIteratorMt *mt = data;
+
+	/* Every task claims batches until all of them are processed or an error
+	 * occurred in any of the tasks. */
+	while (atomic_load(&mt->rv) == 0) {
+		const uint64_t batch = atomic_fetch_add(&mt->next_batch, 1);
+		if (batch >= mt->batch_count) {
+			break;
+		}
+		rv = iterator_batch(mt, batch);
+		if (rv < 0) {
+			atomic_store(&mt->rv, rv);
+		}
 	}
 
-	size_t remaining_blocks = atomic_fetch_sub(&mt->remaining_blocks, 1);
-	assert(remaining_blocks > 0);
-	if (remaining_blocks == 1) {
+	size_t remaining_tasks = atomic_fetch_sub(&mt->remaining_tasks, 1);
+	assert(remaining_tasks > 0);
+	if (remaining_tasks == 1) {
 		file_iterator_mt_cleanup(mt, atomic_load(&mt->rv));
 	}
 }
@@ -149,7 +189,7 @@ file_iterator_mt(
 		struct SqshThreadpool *threadpool, sqsh_file_iterator_mt_cb cb,
 		void *data, int rv) {
 	size_t scheduled = 0;
-	uint64_t block_count = 0;
+	size_t task_count = 0;
 	if (rv < 0) {
 		goto out;
 	}
@@ -159,55 +199,35 @@ file_iterator_mt(
 	uint16_t block_log = sqsh_superblock_block_log(superblock);
 	uint32_t block_size = sqsh_superblock_block_size(superblock);
 
-	block_count = sqsh_block_count_ceil(sqsh_file_size(file), block_log);
-	if (block_count > SIZE_MAX) {
-		rv = -SQSH_ERROR_INTEGER_OVERFLOW;
-		goto out;
-	}
-
 	mt->cb = cb;
 	mt->data = data;
 	mt->chunk_size = block_size;
-	atomic_init(&mt->remaining_blocks, (size_t)block_count);
+	mt->block_log = block_log;
+	mt->block_count = sqsh_block_count_ceil(sqsh_file_size(file), block_log);
+	mt->batch_count = SQSH_DIVIDE_CEIL(
+			mt->block_count, (uint64_t)FILE_ITERATOR_MT_BATCH_BLOCKS);
+	atomic_init(&mt->next_batch, 0);
 	atomic_init(&mt->rv, 0);
 
+	/* Only a bounded number of tasks is scheduled, regardless of the file
+	 * size. This caps both the number of queued tasks and the number of
+	 * decompressed blocks in flight. */
+	task_count = SQSH_MAX(FILE_ITERATOR_MT_MAX_BYTES / block_size, 1);
+	task_count = SQSH_MIN(task_count, FILE_ITERATOR_MT_MAX_TASKS);
+	task_count = (size_t)SQSH_MIN((uint64_t)task_count, mt->batch_count);
+	atomic_init(&mt->remaining_tasks, task_count);
+
 	rv = sqsh__file_init(&mt->file, file->archive, inode_ref);
 	if (rv < 0) {
 		goto out;
 	}
+	mt->num_data_blocks = sqsh_file_block_count2(&mt->file);
 
-	if (block_count == 0) {
-		goto out;
-	}
-
-	mt->blocks =
-			calloc((size_t)block_count, sizeof(struct FileIteratorMtBlock));
-	if (mt->blocks == NULL) {
-		rv = -SQSH_ERROR_MALLOC_FAILED;
-		goto out;
-	}
-
-	/* The fragment (if any) is scheduled as one extra task beyond the data
-	 * blocks; it has no entry in the block-size list, so only data blocks
-	 * contribute to the compressed prefix offset. */
-	const uint64_t num_data_blocks = sqsh_file_block_count2(&mt->file);
-	uint64_t block_offset = 0;
-	uint64_t data_offset = 0;
-	for (size_t i = 0; i < block_count; i++) {
-		mt->blocks[i].mt = mt;
-		mt->blocks[i].block_offset = block_offset;
-		mt->blocks[i].state.block_index = i;
-		mt->blocks[i].state.compressed_offset = data_offset;
-		rv = cx_threadpool_schedule(
-				&threadpool->pool, iterator_worker, &mt->blocks[i]);
+	for (; scheduled < task_count; scheduled++) {
+		rv = cx_threadpool_schedule(&threadpool->pool, iterator_worker, mt);
 		if (rv < 0) {
 			break;
 		}
-		scheduled++;
-		block_offset += block_size;
-		if (i < num_data_blocks) {
-			data_offset += sqsh_file_block_size2(&mt->file, i);
-		}
 	}
 
 out:
@@ -216,10 +236,9 @@ out:
 	}
 	if (scheduled == 0) {
 		file_iterator_mt_cleanup(mt, rv);
-	} else if (scheduled < block_count) {
-		const size_t unscheduled = (size_t)block_count - scheduled;
-		const size_t prev =
-				atomic_fetch_sub(&mt->remaining_blocks, unscheduled);
+	} else if (scheduled < task_count) {
+		const size_t unscheduled = task_count - scheduled;
+		const size_t prev = atomic_fetch_sub(&mt->remaining_tasks, unscheduled);
 		if (prev == unscheduled) {
 			file_iterator_mt_cleanup(mt, rv);
 		}
@@ -295,3 +314,689 @@ sqsh_file_to_stream_mt(
 out:
 	return rv;
 }
+
+/* Number of blocks that may be decompressed ahead of the block that is
+ * currently written to the stream. */
+#define FILE_TO_STREAM_ORDERED_WINDOW 16
+
+struct FileToStreamOrderedSlot {
+	struct FileToStreamOrdered *ordered;
+	struct SqshIteratorState state;
+	struct SqshFileIterator iterator;
+	bool initialized;
+	bool ready;
+	int rv;
+};
+
+struct FileToStreamOrdered {
+	struct SqshFile file;
+	struct SqshThreadpool *threadpool;
+	sqsh_file_to_stream_mt_cb cb;
+	void *data;
+	FILE *stream;
+
+	sqsh__mutex_t lock;
+	uint64_t block_count;
+	uint64_t num_data_blocks;
+	uint64_t next_schedule;
+	uint64_t next_write;
+	size_t pending;
+	bool writing;
+	int rv;
+
+	struct FileToStreamOrderedSlot slots[FILE_TO_STREAM_ORDERED_WINDOW];
+};
+
+static void ordered_worker(void *data);
+
+static void
+ordered_finish(struct FileToStreamOrdered *ordered) {
+	ordered->cb(&ordered->file, ordered->stream, ordered->data, ordered->rv);
+
+	for (size_t i = 0; i < FILE_TO_STREAM_ORDERED_WINDOW; i++) {
+		if (ordered->slots[i].initialized) {
+			sqsh__file_iterator_cleanup(&ordered->slots[i].iterator);
+		}
+	}
+	sqsh__file_cleanup(&ordered->file);
+	sqsh__mutex_destroy(&ordered->lock);
+	free(ordered);
+}
+
+/**
+ * Schedules the next block. Must be called with the lock held.
+ */
+static int
+ordered_schedule(struct FileToStreamOrdered *ordered) {
+	int rv = 0;
+	const uint64_t block_index = ordered->next_schedule;
+	struct FileToStreamOrderedSlot *slot =
+			&ordered->slots[block_index % FILE_TO_STREAM_ORDERED_WINDOW];
+	uint64_t compressed_offset;
+
+	/* The fragment has no entry in the block-size list, so its compressed
+	 * offset is the end of the last data block. */
+	rv = sqsh__file_block_offset(
+			&ordered->file, SQSH_MIN(block_index, ordered->num_data_blocks),
+			&compressed_offset);
+	if (rv < 0) {
+		goto out;
+	}
+
+	slot->ordered = ordered;
+	slot->state.block_index = block_index;
+	slot->state.compressed_offset = compressed_offset;
+	slot->initialized = false;
+	slot->ready = false;
+	slot->rv = 0;
+	rv = cx_threadpool_schedule(
+			&ordered->threadpool->pool, ordered_worker, slot);
+	if (rv < 0) {
+		goto out;
+	}
+	ordered->pending++;
+	ordered->next_schedule++;
+
+out:
+	return rv;
+}
+
+static int
+ordered_write_slot(
+		struct FileToStreamOrdered *ordered,
+		struct FileToStreamOrderedSlot *slot) {
+	int rv = 0;
+	struct SqshFileIterator *iterator = &slot->iterator;
+
+	/* A block may be followed by a sparse section, which the iterator
+	 * presents as separate chunks. */
+	for (;;) {
+		const uint8_t *data = sqsh_file_iterator_data(iterator);
+		const size_t size = sqsh_file_iterator_size(iterator);
+		const size_t written =
+				fwrite(data, sizeof(uint8_t), size, ordered->stream);
+		if (written != size) {
+			rv = -errno;
+			goto out;
+		}
+		if (sqsh_file_iterator_is_zero_block(iterator) == false) {
+			break;
+		}
+		if (sqsh_file_iterator_next(iterator, 1, &rv) == false) {
+			goto out;
+		}
+	}
+
+out:
+	return rv;
+}
+
+/**
+ * Writes all blocks that are ready in file order and schedules a new block
+ * for each block that was written. Must be called with the lock held. If the
+ * lock cannot be taken again after a write, the error is returned and the
+ * lock is not held anymore.
+ */
+static int
+ordered_write(struct FileToStreamOrdered *ordered, bool *locked) {
+	int rv = 0;
+
+	while (ordered->rv == 0 && ordered->next_write < ordered->block_count) {
+		struct FileToStreamOrderedSlot *slot =
+				&ordered->slots
+						 [ordered->next_write % FILE_TO_STREAM_ORDERED_WINDOW];
+		if (slot->ready == false) {
+			break;
+		}
+
+		rv = slot->rv;
+		if (rv == 0) {
+			sqsh__mutex_unlock(&ordered->lock, locked);
+			rv = ordered_write_slot(ordered, slot);
+			const int lock_rv = sqsh__mutex_lock(&ordered->lock, locked);
+			if (lock_rv < 0) {
+				return lock_rv;
+			}
+		}
+		if (slot->initialized) {
+			sqsh__file_iterator_cleanup(&slot->iterator);
+			slot->initialized = false;
+		}
+		slot->ready = false;
+		ordered->next_write++;
+
+		if (rv == 0 && ordered->next_schedule < ordered->block_count) {
+			rv = ordered_schedule(ordered);
+		}
+		if (rv < 0) {
+			ordered->rv = rv;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Called with the lock held whenever a task finished. The first thread that
+ * finds no other writer becomes the writer. The last task to finish cleans
+ * up.
+ *
+ * The shared state cannot be touched without the lock. If it cannot be
+ * taken, the task stops and the context is leaked instead of being cleaned
+ * up in an unknown state.
+ */
+static void
+ordered_task_done(struct FileToStreamOrdered *ordered, bool *locked) {
+	if (ordered->writing == false) {
+		ordered->writing = true;
+		if (ordered_write(ordered, locked) < 0) {
+			return;
+		}
+		ordered->writing = false;
+	}
+
+	ordered->pending--;
+	const bool finished = ordered->pending == 0;
+	sqsh__mutex_unlock(&ordered->lock, locked);
+
+	if (finished) {
+		ordered_finish(ordered);
+	}
+}
+
+static void
+ordered_worker(void *data) {
+	int rv = 0;
+	bool locked = false;
+	struct FileToStreamOrderedSlot *slot = data;
+	struct FileToStreamOrdered *ordered = slot->ordered;
+
+	rv = sqsh__file_iterator_init_with_state(
+			&slot->iterator, &ordered->file, &slot->state);
+	slot->initialized = rv == 0;
+	if (rv == 0) {
+		bool has_next = sqsh_file_iterator_next(&slot->iterator, 1, &rv);
+		if (rv == 0 && has_next == false) {
+			rv = -SQSH_ERROR_OUT_OF_BOUNDS;
+		}
+	}
+
+	if (sqsh__mutex_lock(&ordered->lock, &locked) < 0) {
+		/* See ordered_task_done() */
+		return;
+	}
+	slot->rv = rv;
+	slot->ready = true;
+	ordered_task_done(ordered, &locked);
+}
+
+int
+sqsh_file_to_stream_ordered_mt(
+		const struct SqshFile *file, struct SqshThreadpool *threadpool,
+		FILE *stream, sqsh_file_to_stream_mt_cb cb, void *data) {
+	int rv = 0;
+	bool locked = false;
+	struct FileToStreamOrdered *ordered = NULL;
+	const struct SqshSuperblock *superblock =
+			sqsh_archive_superblock(file->archive);
+	const uint16_t block_log = sqsh_superblock_block_log(superblock);
+
+	ordered = calloc(1, sizeof(struct FileToStreamOrdered));
+	if (ordered == NULL) {
+		return -SQSH_ERROR_MALLOC_FAILED;
+	}
+	rv = sqsh__mutex_init(&ordered->lock);
+	if (rv < 0) {
+		free(ordered);
+		return rv;
+	}
+	rv = sqsh__file_init(
+			&ordered->file, file->archive, sqsh_file_inode_ref(file));
+	if (rv < 0) {
+		sqsh__mutex_destroy(&ordered->lock);
+		free(ordered);
+		return rv;
+	}
+	ordered->threadpool = threadpool;
+	ordered->cb = cb;
+	ordered->data = data;
+	ordered->stream = stream;
+	ordered->block_count =
+			sqsh_block_count_ceil(sqsh_file_size(&ordered->file), block_log);
+	ordered->num_data_blocks = sqsh_file_block_count2(&ordered->file);
+
+	/* The caller holds a pending task of its own until the initial window
+	 * is scheduled, so the context cannot be finished underneath it. */
+	rv = sqsh__mutex_lock(&ordered->lock, &locked);
+	if (rv < 0) {
+		sqsh__file_cleanup(&ordered->file);
+		sqsh__mutex_destroy(&ordered->lock);
+		free(ordered);
+		return rv;
+	}
+	ordered->pending = 1;
+	while (ordered->next_schedule < ordered->block_count &&
+		   ordered->next_schedule < FILE_TO_STREAM_ORDERED_WINDOW) {
+		rv = ordered_schedule(ordered);
+		if (rv < 0) {
+			ordered->rv = rv;
+			break;
+		}
+	}
+	ordered_task_done(ordered, &locked);
+
+	return 0;
+}
+
+/* Number of consecutive blocks that are decoded with a single call to
+ * sqsh_file_read_into(). */
+#define FILE_CONTENT_MT_BATCH_BLOCKS 4
+/* Upper limit of tasks that are scheduled for one file. */
+#define FILE_CONTENT_MT_MAX_TASKS 32
+
+struct FileContentMt {
+	const struct SqshFile *file;
+	uint8_t *content;
+	uint64_t file_size;
+	uint64_t batch_size;
+
+	sqsh__mutex_t lock;
+	sqsh__cond_t finished_cond;
+	uint64_t batch_count;
+	uint64_t next_batch;
+	uint64_t finished_batches;
+	size_t ref_count;
+	/* Also written without the lock if the lock cannot be taken. */
+	atomic_int rv;
+};
+
+/**
+ * Drops a reference. Must be called with the lock held. The last reference
+ * frees the context.
+ */
+static void
+content_mt_release(struct FileContentMt *mt, bool *locked) {
+	mt->ref_count--;
+	const bool finished = mt->ref_count == 0;
+	sqsh__mutex_unlock(&mt->lock, locked);
+
+	if (finished) {
+		sqsh__cond_destroy(&mt->finished_cond);
+		sqsh__mutex_destroy(&mt->lock);
+		free(mt);
+	}
+}
+
+/**
+ * Decodes batches until all of them are claimed or an error occurred. Must be
+ * called with the lock held. If the lock cannot be taken again after a
+ * batch, the error is recorded and returned, and the lock is not held
+ * anymore. The shared state cannot be touched without the lock, so the
+ * context is leaked in that case.
+ */
+static int
+content_mt_run(struct FileContentMt *mt, bool *locked) {
+	int rv = 0;
+
+	while (atomic_load(&mt->rv) == 0 && mt->next_batch < mt->batch_count) {
+		const uint64_t offset = mt->next_batch * mt->batch_size;
+		const size_t size =
+				(size_t)SQSH_MIN(mt->batch_size, mt->file_size - offset);
+		mt->next_batch++;
+		sqsh__mutex_unlock(&mt->lock, locked);
+
+		rv = sqsh_file_read_into(mt->file, offset, &mt->content[offset], size);
+
+		const int lock_rv = sqsh__mutex_lock(&mt->lock, locked);
+		if (lock_rv < 0) {
+			atomic_store(&mt->rv, lock_rv);
+			return lock_rv;
+		}
+		if (rv < 0 && atomic_load(&mt->rv) == 0) {
+			atomic_store(&mt->rv, rv);
+		}
+		mt->finished_batches++;
+		if (mt->finished_batches == mt->next_batch) {
+			sqsh__cond_broadcast(&mt->finished_cond);
+		}
+	}
+	return 0;
+}
+
+static void
+content_mt_worker(void *data) {
+	int rv = 0;
+	bool locked = false;
+	struct FileContentMt *mt = data;
+
+	rv = sqsh__mutex_lock(&mt->lock, &locked);
+	if (rv < 0) {
+		/* See content_mt_run() */
+		atomic_store(&mt->rv, rv);
+		return;
+	}
+	/* Tasks that start after the caller returned find no batches left and
+	 * must not touch the file or the content anymore. */
+	if (content_mt_run(mt, &locked) < 0) {
+		return;
+	}
+	content_mt_release(mt, &locked);
+}
+
+static int
+content_mt(
+		const struct SqshFile *file, struct SqshThreadpool *threadpool,
+		uint8_t *content) {
+	int rv = 0;
+	bool locked = false;
+	struct FileContentMt *mt = NULL;
+	const struct SqshSuperblock *superblock =
+			sqsh_archive_superblock(file->archive);
+	const uint32_t block_size = sqsh_superblock_block_size(superblock);
+
+	mt = calloc(1, sizeof(struct FileContentMt));
+	if (mt == NULL) {
+		return -SQSH_ERROR_MALLOC_FAILED;
+	}
+	atomic_init(&mt->rv, 0);
+	rv = sqsh__mutex_init(&mt->lock);
+	if (rv < 0) {
+		free(mt);
+		return rv;
+	}
+	rv = sqsh__cond_init(&mt->finished_cond);
+	if (rv < 0) {
+		sqsh__mutex_destroy(&mt->lock);
+		free(mt);
+		return rv;
+	}
+	mt->file = file;
+	mt->content = content;
+	mt->file_size = sqsh_file_size(file);
+	mt->batch_size = (uint64_t)block_size * FILE_CONTENT_MT_BATCH_BLOCKS;
+	mt->batch_count = SQSH_DIVIDE_CEIL(mt->file_size, mt->batch_size);
+
+	rv = sqsh__mutex_lock(&mt->lock, &locked);
+	if (rv < 0) {
+		sqsh__cond_destroy(&mt->finished_cond);
+		sqsh__mutex_destroy(&mt->lock);
+		free(mt);
+		return rv;
+	}
+	/* The caller decodes batches as well, so it needs one task less and
+	 * makes progress even if all threads of the pool are busy. */
+	mt->ref_count = 1;
+	const uint64_t task_count = SQSH_MIN(
+			mt->batch_count > 0 ? mt->batch_count - 1 : 0,
+			(uint64_t)FILE_CONTENT_MT_MAX_TASKS);
+	for (uint64_t i = 0; i < task_count; i++) {
+		rv = cx_threadpool_schedule(
+				&threadpool->pool, content_mt_worker, mt);
+		if (rv < 0) {
+			atomic_store(&mt->rv, rv);
+			break;
+		}
+		mt->ref_count++;
+	}
+
+	rv = content_mt_run(mt, &locked);
+	if (rv < 0) {
+		return rv;
+	}
+	/* Wait for the batches that were claimed by other tasks. */
+	rv = 0;
+	while (rv == 0 && mt->finished_batches != mt->next_batch) {
+		rv = sqsh__cond_wait(&mt->finished_cond, &mt->lock);
+	}
+	if (rv == 0) {
+		rv = atomic_load(&mt->rv);
+	}
+	content_mt_release(mt, &locked);
+
+	return rv;
+}
+
+uint8_t *
+sqsh_easy_file_content_mt(
+		struct SqshArchive *archive, const char *path,
+		struct SqshThreadpool *threadpool, int *err) {
+	int rv = 0;
+	struct SqshFile *file = NULL;
+	uint8_t *content = NULL;
+
+	file = sqsh_open(archive, path, &rv);
+	if (rv < 0) {
+		goto out;
+	}
+	if (sqsh_file_type(file) != SQSH_FILE_TYPE_FILE) {
+		rv = -SQSH_ERROR_NOT_A_FILE;
+		goto out;
+	}
+
+	uint64_t file_size = sqsh_file_size(file);
+	if (file_size > SIZE_MAX - 1) {
+		rv = -SQSH_ERROR_INTEGER_OVERFLOW;
+		goto out;
+	}
+	content = calloc((size_t)file_size + 1, sizeof(*content));
+	if (content == NULL) {
+		rv = -SQSH_ERROR_MALLOC_FAILED;
+		goto out;
+	}
+
+	rv = content_mt(file, threadpool, content);
+
+out:
+	sqsh_close(file);
+	if (rv < 0) {
+		free(content);
+		content = NULL;
+	}
+	if (err != NULL) {
+		*err = rv;
+	}
+	return content;
+}
+
+struct FileIteratorReadahead {
+	struct SqshFile file;
+	struct SqshThreadpool *threadpool;
+	struct SqshExtractManager *extract_manager;
+	struct SqshMapManager *map_manager;
+	uint64_t upper_limit;
+	size_t window;
+	uint64_t expected_block;
+	uint64_t scheduled_until;
+	atomic_bool cancelled;
+	atomic_size_t ref_count;
+};
+
+struct FileIteratorReadaheadTask {
+	struct FileIteratorReadahead *readahead;
+	uint64_t block_index;
+};
+
+static void
+readahead_release(struct FileIteratorReadahead *readahead) {
+	size_t ref_count = atomic_fetch_sub(&readahead->ref_count, 1);
+	assert(ref_count > 0);
+	if (ref_count == 1) {
+		sqsh__file_cleanup(&readahead->file);
+		free(readahead);
+	}
+}
+
+static int
+readahead_block(struct FileIteratorReadahead *readahead, uint64_t block_index) {
+	int rv = 0;
+	const struct SqshFile *file = &readahead->file;
+	struct SqshMapReader reader = {0};
+	struct CxBuffer *buffer = NULL;
+	uint64_t block_offset;
+	uint64_t address;
+	const uint32_t block_size = sqsh_file_block_size2(file, block_index);
+
+	rv = sqsh__file_block_offset(file, block_index, &block_offset);
+	if (rv < 0) {
+		goto out;
+	}
+	if (SQSH_ADD_OVERFLOW(
+				sqsh_file_blocks_start(file), block_offset, &address)) {
+		rv = -SQSH_ERROR_INTEGER_OVERFLOW;
+		goto out;
+	}
+	rv = sqsh__map_reader_init(
+			&reader, readahead->map_manager, address, readahead->upper_limit);
+	if (rv < 0) {
+		goto out;
+	}
+	rv = sqsh__map_reader_advance(&reader, 0, block_size);
+	if (rv < 0) {
+		goto out;
+	}
+
+	/* The decompressed block stays in the extract manager's LRU cache after
+	 * it is released, where the iterator picks it up. */
+	rv = sqsh__extract_manager_uncompress(
+			readahead->extract_manager, &reader, &buffer);
+	if (rv < 0) {
+		goto out;
+	}
+	rv = sqsh__extract_manager_release(readahead->extract_manager, address);
+
+out:
+	sqsh__map_reader_cleanup(&reader);
+	return rv;
+}
+
+static void
+readahead_worker(void *data) {
+	struct FileIteratorReadaheadTask *task = data;
+	struct FileIteratorReadahead *readahead = task->readahead;
+
+	/* Errors are ignored here. Readahead is only a hint, the iterator will
+	 * run into the same error when it reaches the block. */
+	if (atomic_load(&readahead->cancelled) == false) {
+		readahead_block(readahead, task->block_index);
+	}
+
+	free(task);
+	readahead_release(readahead);
+}
+
+static int
+readahead_schedule(
+		struct FileIteratorReadahead *readahead, uint64_t block_index) {
+	int rv = 0;
+	struct FileIteratorReadaheadTask *task =
+			calloc(1, sizeof(struct FileIteratorReadaheadTask));
+	if (task == NULL) {
+		return -SQSH_ERROR_MALLOC_FAILED;
+	}
+	task->readahead = readahead;
+	task->block_index = block_index;
+
+	atomic_fetch_add(&readahead->ref_count, 1);
+	rv = cx_threadpool_schedule(
+			&readahead->threadpool->pool, readahead_worker, task);
+	if (rv < 0) {
+		atomic_fetch_sub(&readahead->ref_count, 1);
+		free(task);
+	}
+	return rv;
+}
+
+static void
+readahead_block_mapped(
+		void *data, uint64_t block_index, uint64_t next_block_index) {
+	struct FileIteratorReadahead *readahead = data;
+	const struct SqshFile *file = &readahead->file;
+
+	/* Only read ahead while the iterator consumes the file sequentially.
+	 * After a seek, the iterator needs to map two consecutive blocks before
+	 * readahead resumes. */
+	const bool sequential = block_index == readahead->expected_block;
+	readahead->expected_block = next_block_index;
+	if (sequential == false) {
+		readahead->scheduled_until = next_block_index;
+		return;
+	}
+
+	const uint64_t block_count = sqsh_file_block_count2(file);
+	uint64_t end = SQSH_MIN(next_block_index + readahead->window, block_count);
+	uint64_t i = SQSH_MAX(readahead->scheduled_until, next_block_index);
+	for (; i < end; i++) {
+		if (sqsh_file_block_size2(file, i) == 0 ||
+			sqsh_file_block_is_compressed2(file, i) == false) {
+			continue;
+		}
+		if (readahead_schedule(readahead, i) < 0) {
+			break;
+		}
+	}
+	readahead->scheduled_until = SQSH_MAX(readahead->scheduled_until, i);
+}
+
+static void
+readahead_cleanup(void *data) {
+	struct FileIteratorReadahead *readahead = data;
+
+	atomic_store(&readahead->cancelled, true);
+	readahead_release(readahead);
+}
+
+static const struct SqshFileIteratorReadaheadImpl readahead_impl = {
+		.block_mapped = readahead_block_mapped,
+		.cleanup = readahead_cleanup,
+};
+
+int
+sqsh_file_iterator_readahead(
+		struct SqshFileIterator *iterator, struct SqshThreadpool *threadpool,
+		size_t block_count) {
+	int rv = 0;
+	const struct SqshFile *file = iterator->file;
+	struct SqshArchive *archive = file->archive;
+	struct FileIteratorReadahead *readahead = NULL;
+
+	if (block_count == 0) {
+		sqsh__file_iterator_set_readahead(iterator, NULL, NULL);
+		goto out;
+	}
+
+	readahead = calloc(1, sizeof(struct FileIteratorReadahead));
+	if (readahead == NULL) {
+		rv = -SQSH_ERROR_MALLOC_FAILED;
+		goto out;
+	}
+	atomic_init(&readahead->cancelled, false);
+	atomic_init(&readahead->ref_count, 1);
+	/* The readahead keeps its own copy of the file, as scheduled tasks may
+	 * outlive the iterator. */
+	rv = sqsh__file_init(&readahead->file, archive, sqsh_file_inode_ref(file));
+	if (rv < 0) {
+		free(readahead);
+		readahead = NULL;
+		goto out;
+	}
+	rv = sqsh__archive_data_extract_manager(
+			archive, &readahead->extract_manager);
+	if (rv < 0) {
+		goto out;
+	}
+	readahead->map_manager = sqsh_archive_map_manager(archive);
+	readahead->upper_limit =
+			sqsh_superblock_bytes_used(sqsh_archive_superblock(archive));
+	readahead->threadpool = threadpool;
+	readahead->window = block_count;
+	readahead->expected_block = iterator->block_index;
+	readahead->scheduled_until = iterator->block_index;
+
+	sqsh__file_iterator_set_readahead(iterator, &readahead_impl, readahead);
+	readahead = NULL;
+
+out:
+	if (readahead != NULL) {
+		readahead_release(readahead);
+	}
+	return rv;
+}
@@ -34,43 +34,94 @@
 #define _DEFAULT_SOURCE
 #define _FILE_OFFSET_BITS 64
 
+#include <sqsh_archive.h>
 #include <sqsh_error.h>
-#include <sqsh_mapper.h>
+#include <sqsh_mapper_private.h>
 
 #include <errno.h>
 #include <fcntl.h>
+#include <stdlib.h>
 #include <sys/mman.h>
 #include <unistd.h>
 
-#define TO_PTR(x) ((void *)(uintptr_t)(x))
-#define FROM_PTR(x) ((int)(uintptr_t)(x))
+struct SqshMmapMapper {
+	int fd;
+	int advice;
+};
+
+static int
+advise(uint8_t *data, size_t size, int advice) {
+	const uintptr_t page_size = (uintptr_t)sysconf(_SC_PAGESIZE);
+	const uintptr_t offset = (uintptr_t)data % page_size;
+	uint8_t *page = data - offset;
+	const size_t length = size + offset;
+
+	if (size == 0) {
+		return 0;
+	}
+	if (advice & SQSH_MAPPER_ADVICE_SEQUENTIAL &&
+		madvise(page, length, MADV_SEQUENTIAL) < 0) {
+		return -errno;
+	}
+	if (advice & SQSH_MAPPER_ADVICE_RANDOM &&
+		madvise(page, length, MADV_RANDOM) < 0) {
+		return -errno;
+	}
+	if (advice & SQSH_MAPPER_ADVICE_WILLNEED &&
+		madvise(page, length, MADV_WILLNEED) < 0) {
+		return -errno;
+	}
+	if (advice & SQSH_MAPPER_ADVICE_POPULATE) {
+#ifdef MADV_POPULATE_READ
+		if (madvise(page, length, MADV_POPULATE_READ) == 0) {
+			goto populated;
+		}
+#endif
+		/* Older kernels do not support MADV_POPULATE_READ. Fall back to
+		 * asynchronous read ahead. */
+		if (madvise(page, length, MADV_WILLNEED) < 0) {
+			return -errno;
+		}
+	}
+#ifdef MADV_POPULATE_READ
+populated:
+#endif
+	if (advice & SQSH_MAPPER_ADVICE_LOCK && mlock(page, length) < 0) {
+		return -errno;
+	}
+	return 0;
+}
 
 static int
 sqsh_mapper_mmap_init(
 		struct SqshMapper *mapper, const void *input, uint64_t *size) {
 	int rv = 0;
-	int fd = -1;
 	off_t pos = 0;
+	struct SqshMmapMapper *mmap_mapper =
+			calloc(1, sizeof(struct SqshMmapMapper));
+	if (mmap_mapper == NULL) {
+		return -SQSH_ERROR_MALLOC_FAILED;
+	}
+	mmap_mapper->fd = -1;
+	if (mapper->config != NULL) {
+		mmap_mapper->advice = mapper->config->mapper_advice;
+	}
+	sqsh_mapper_set_user_data(mapper, mmap_mapper);
 
-	fd = open(input, O_RDONLY | O_CLOEXEC);
-	if (fd < 0) {
+	mmap_mapper->fd = open(input, O_RDONLY | O_CLOEXEC);
+	if (mmap_mapper->fd < 0) {
 		rv = -errno;
 		goto out;
 	}
 
-	pos = lseek(fd, 0, SEEK_END);
+	pos = lseek(mmap_mapper->fd, 0, SEEK_END);
 	if (pos < 0) {
 		rv = -errno;
 		goto out;
 	}
 	*size = (uint64_t)pos;
 
-	sqsh_mapper_set_user_data(mapper, TO_PTR(fd));
-
 out:
-	if (rv < 0 && fd >= 0) {
-		close(fd);
-	}
 	return rv;
 }
 
@@ -78,21 +129,31 @@ static int
 sqsh_mapping_mmap_map(
 		const struct SqshMapper *mapper, uint64_t offset, size_t size,
 		uint8_t **data) {
-	const int fd = FROM_PTR(sqsh_mapper_user_data(mapper));
+	const struct SqshMmapMapper *mmap_mapper = sqsh_mapper_user_data(mapper);
 	const long page_size = sysconf(_SC_PAGESIZE);
 
 	const off_t mmap_offset = (off_t)offset % page_size;
 	const size_t mmap_size = (size_t)mmap_offset + size;
+	int flags = MAP_PRIVATE;
 
 	uint8_t *file_map = NULL;
 
+	if (mmap_mapper->advice & SQSH_MAPPER_ADVICE_POPULATE) {
+		flags |= MAP_POPULATE;
+	}
+
 	if (size != 0) {
 		file_map =
-				mmap(NULL, mmap_size, PROT_READ, MAP_PRIVATE, fd,
+				mmap(NULL, mmap_size, PROT_READ, flags, mmap_mapper->fd,
 					 (off_t)offset - mmap_offset);
 		if (file_map == MAP_FAILED) {
 			return -errno;
 		}
+		/* Advice is a hint. Failing to apply it, e.g. because the memlock
+		 * limit is exceeded, does not fail the mapping. The populate hint
+		 * is already handled by MAP_POPULATE. */
+		advise(file_map, mmap_size,
+			   mmap_mapper->advice & ~SQSH_MAPPER_ADVICE_POPULATE);
 	}
 
 	*data = &file_map[mmap_offset];
@@ -101,8 +162,14 @@ sqsh_mapping_mmap_map(
 
 static int
 sqsh_mapper_mmap_cleanup(struct SqshMapper *mapper) {
-	const int fd = FROM_PTR(sqsh_mapper_user_data(mapper));
-	close(fd);
+	struct SqshMmapMapper *mmap_mapper = sqsh_mapper_user_data(mapper);
+	if (mmap_mapper == NULL) {
+		return 0;
+	}
+	if (mmap_mapper->fd >= 0) {
+		close(mmap_mapper->fd);
+	}
+	free(mmap_mapper);
 	return 0;
 }
 
@@ -130,3 +197,11 @@ static const struct SqshMemoryMapperImpl impl = {
 		.cleanup = sqsh_mapper_mmap_cleanup,
 };
 const struct SqshMemoryMapperImpl *const sqsh_mapper_impl_mmap = &impl;
+
+int
+sqsh__mmap_mapper_advise(
+		const struct SqshMapper *mapper, uint8_t *data, size_t size,
+		int advice) {
+	(void)mapper;
+	return advise(data, size, advice);
+}
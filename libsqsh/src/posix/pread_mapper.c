@@ -0,0 +1,545 @@
+/******************************************************************************
+ *                                                                            *
+ * Copyright (c) 2023-2024, Enno Boland <g@s01.de>                            *
+ *                                                                            *
+ * Redistribution and use in source and binary forms, with or without         *
+ * modification, are permitted provided that the following conditions are     *
+ * met:                                                                       *
+ *                                                                            *
+ * * Redistributions of source code must retain the above copyright notice,   *
+ *   this list of conditions and the following disclaimer.                    *
+ * * Redistributions in binary form must reproduce the above copyright        *
+ *   notice, this list of conditions and the following disclaimer in the      *
+ *   documentation and/or other materials provided with the distribution.     *
+ *                                                                            *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS    *
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,  *
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR     *
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR          *
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,      *
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,        *
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR         *
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF     *
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING       *
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS         *
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.               *
+ *                                                                            *
+ ******************************************************************************/
+
+/**
+ * @author       Enno Boland (mail@eboland.de)
+ * @file         pread_mapper.c
+ */
+
+#define _DEFAULT_SOURCE
+#define _FILE_OFFSET_BITS 64
+
+#include <sqsh_common_private.h>
+#include <sqsh_error.h>
+#include <sqsh_mapper.h>
+#include <sqsh_utils_private.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef CONFIG_IO_URING
+#	include <liburing.h>
+#endif
+
+/* The number of blocks that are read ahead once sequential access is
+ * detected. */
+#define PREAD_PREFETCH_BLOCKS 8
+/* The number of reads that can be in flight at once. */
+#define PREAD_CHUNK_COUNT (PREAD_PREFETCH_BLOCKS * 2)
+/* The number of unused block buffers that are kept for reuse. */
+#define PREAD_POOL_SIZE 32
+
+#ifdef CONFIG_IO_URING
+struct PreadChunk {
+	uint64_t offset;
+	size_t size;
+	uint8_t *data;
+	int result;
+	bool used;
+	bool done;
+	/* A map call waits for this chunk, so it must not be recycled. */
+	bool claimed;
+};
+#endif
+
+struct SqshPreadMapper {
+	int fd;
+	size_t block_size;
+	uint64_t size;
+	sqsh__mutex_t lock;
+	uint8_t *pool[PREAD_POOL_SIZE];
+	size_t pool_count;
+	/* The offset directly after the last mapped block and the end of the
+	 * range that has already been requested ahead. */
+	uint64_t next_offset;
+	uint64_t prefetch_end;
+#ifdef CONFIG_IO_URING
+	bool has_ring;
+	struct io_uring ring;
+	struct PreadChunk chunks[PREAD_CHUNK_COUNT];
+	/* Set while a thread waits for completions without holding the lock.
+	 * Only that thread consumes completions, other threads wait on
+	 * `completed` until it has reaped their chunk. */
+	bool ring_busy;
+	sqsh__cond_t completed;
+#endif
+};
+
+static uint8_t *
+pool_get(struct SqshPreadMapper *mapper, size_t size) {
+	uint8_t *buffer = NULL;
+	bool locked = false;
+
+	if (size == mapper->block_size &&
+		sqsh__mutex_lock(&mapper->lock, &locked) == 0) {
+		if (mapper->pool_count > 0) {
+			mapper->pool_count--;
+			buffer = mapper->pool[mapper->pool_count];
+		}
+		sqsh__mutex_unlock(&mapper->lock, &locked);
+	}
+	if (buffer == NULL) {
+		buffer = malloc(SQSH_MAX(size, (size_t)1));
+	}
+	return buffer;
+}
+
+static void
+pool_put_locked(struct SqshPreadMapper *mapper, uint8_t *buffer, size_t size) {
+	if (size == mapper->block_size && mapper->pool_count < PREAD_POOL_SIZE) {
+		mapper->pool[mapper->pool_count] = buffer;
+		mapper->pool_count++;
+	} else {
+		free(buffer);
+	}
+}
+
+static int
+read_full(int fd, uint8_t *buffer, size_t size, uint64_t offset) {
+	size_t read_size = 0;
+	while (read_size < size) {
+		ssize_t rv = pread(
+				fd, &buffer[read_size], size - read_size,
+				(off_t)(offset + read_size));
+		if (rv < 0 && errno == EINTR) {
+			continue;
+		} else if (rv < 0) {
+			return -errno;
+		} else if (rv == 0) {
+			return -SQSH_ERROR_SIZE_MISMATCH;
+		}
+		read_size += (size_t)rv;
+	}
+	return 0;
+}
+
+#ifdef CONFIG_IO_URING
+static void
+complete_locked(struct SqshPreadMapper *mapper, struct io_uring_cqe *cqe) {
+	struct PreadChunk *chunk = io_uring_cqe_get_data(cqe);
+	chunk->result = cqe->res;
+	chunk->done = true;
+	io_uring_cqe_seen(&mapper->ring, cqe);
+}
+
+static void
+reap_locked(struct SqshPreadMapper *mapper) {
+	struct io_uring_cqe *cqe;
+	if (mapper->ring_busy) {
+		return;
+	}
+	while (io_uring_peek_cqe(&mapper->ring, &cqe) == 0) {
+		complete_locked(mapper, cqe);
+	}
+}
+
+static int
+wait_locked(struct SqshPreadMapper *mapper, struct PreadChunk *chunk) {
+	struct io_uring_cqe *cqe;
+	while (chunk->done == false) {
+		int rv = io_uring_wait_cqe(&mapper->ring, &cqe);
+		if (rv == -EINTR) {
+			continue;
+		} else if (rv < 0) {
+			return rv;
+		}
+		complete_locked(mapper, cqe);
+	}
+	return 0;
+}
+
+/**
+ * Waits until a claimed chunk is completed. The lock is dropped while
+ * waiting, so other map calls are not blocked by a single pending read.
+ * Must be called with the lock held. On error, `locked` tells whether the
+ * lock is still held.
+ */
+static int
+wait_claimed_locked(
+		struct SqshPreadMapper *mapper, struct PreadChunk *chunk,
+		bool *locked) {
+	int rv = 0;
+	struct io_uring_cqe *cqe;
+
+	while (chunk->done == false) {
+		if (mapper->ring_busy) {
+			rv = sqsh__cond_wait(&mapper->completed, &mapper->lock);
+			if (rv < 0) {
+				return rv;
+			}
+			continue;
+		}
+
+		mapper->ring_busy = true;
+		sqsh__mutex_unlock(&mapper->lock, locked);
+		do {
+			rv = io_uring_wait_cqe(&mapper->ring, &cqe);
+		} while (rv == -EINTR);
+		const int lock_rv = sqsh__mutex_lock(&mapper->lock, locked);
+		if (lock_rv < 0) {
+			/* The mapper state cannot be updated without the lock. */
+			return lock_rv;
+		}
+		mapper->ring_busy = false;
+
+		if (rv == 0) {
+			complete_locked(mapper, cqe);
+			reap_locked(mapper);
+		}
+		sqsh__cond_broadcast(&mapper->completed);
+		if (rv < 0) {
+			return rv;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Takes a block that was read ahead. Returns false if the block was not
+ * read ahead or the read failed, so that the caller falls back to a
+ * synchronous read.
+ */
+static bool
+take_prefetched(
+		struct SqshPreadMapper *mapper, uint64_t offset, size_t size,
+		uint8_t **data) {
+	bool locked = false;
+	struct PreadChunk *chunk = NULL;
+
+	if (mapper->has_ring == false ||
+		sqsh__mutex_lock(&mapper->lock, &locked) < 0) {
+		return false;
+	}
+
+	for (size_t i = 0; i < PREAD_CHUNK_COUNT; i++) {
+		if (mapper->chunks[i].used && mapper->chunks[i].claimed == false &&
+			mapper->chunks[i].offset == offset &&
+			mapper->chunks[i].size == size) {
+			chunk = &mapper->chunks[i];
+			break;
+		}
+	}
+	if (chunk == NULL) {
+		goto out;
+	}
+	chunk->claimed = true;
+	if (wait_claimed_locked(mapper, chunk, &locked) < 0) {
+		/* The read is still in flight. Leave the chunk to be recycled once
+		 * it completed. */
+		if (locked) {
+			chunk->claimed = false;
+		}
+		goto out;
+	}
+
+	if (chunk->result == (int)size) {
+		*data = chunk->data;
+	} else {
+		pool_put_locked(mapper, chunk->data, chunk->size);
+	}
+	chunk->data = NULL;
+	chunk->used = false;
+	chunk->claimed = false;
+
+out:
+	sqsh__mutex_unlock(&mapper->lock, &locked);
+	return *data != NULL;
+}
+
+static struct PreadChunk *
+free_chunk_locked(
+		struct SqshPreadMapper *mapper, uint64_t start, uint64_t end) {
+	for (size_t i = 0; i < PREAD_CHUNK_COUNT; i++) {
+		struct PreadChunk *chunk = &mapper->chunks[i];
+		if (chunk->used == false) {
+			return chunk;
+		}
+		/* Completed blocks outside of the current window are left over
+		 * from an earlier sequential run and are recycled. */
+		if (chunk->done && chunk->claimed == false &&
+			(chunk->offset < start || chunk->offset >= end)) {
+			pool_put_locked(mapper, chunk->data, chunk->size);
+			chunk->data = NULL;
+			chunk->used = false;
+			return chunk;
+		}
+	}
+	return NULL;
+}
+
+static bool
+is_pending_locked(struct SqshPreadMapper *mapper, uint64_t offset) {
+	for (size_t i = 0; i < PREAD_CHUNK_COUNT; i++) {
+		if (mapper->chunks[i].used && mapper->chunks[i].offset == offset) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static void
+submit_locked(struct SqshPreadMapper *mapper, uint64_t start, uint64_t end) {
+	unsigned int submitted = 0;
+
+	reap_locked(mapper);
+	for (uint64_t offset = start; offset < end; offset += mapper->block_size) {
+		const size_t size =
+				(size_t)SQSH_MIN((uint64_t)mapper->block_size, end - offset);
+		if (is_pending_locked(mapper, offset)) {
+			continue;
+		}
+		struct PreadChunk *chunk = free_chunk_locked(mapper, start, end);
+		if (chunk == NULL) {
+			break;
+		}
+		uint8_t *buffer = NULL;
+		if (size == mapper->block_size && mapper->pool_count > 0) {
+			mapper->pool_count--;
+			buffer = mapper->pool[mapper->pool_count];
+		} else {
+			buffer = malloc(size);
+		}
+		if (buffer == NULL) {
+			break;
+		}
+		struct io_uring_sqe *sqe = io_uring_get_sqe(&mapper->ring);
+		if (sqe == NULL) {
+			pool_put_locked(mapper, buffer, size);
+			break;
+		}
+
+		chunk->offset = offset;
+		chunk->size = size;
+		chunk->data = buffer;
+		chunk->result = 0;
+		chunk->used = true;
+		chunk->done = false;
+		chunk->claimed = false;
+		io_uring_prep_read(
+				sqe, mapper->fd, buffer, (unsigned int)size, offset);
+		io_uring_sqe_set_data(sqe, chunk);
+		submitted++;
+	}
+	if (submitted > 0) {
+		io_uring_submit(&mapper->ring);
+	}
+}
+#endif
+
+/**
+ * Requests the blocks following a sequential read ahead of time. With
+ * io_uring, the blocks are read into pooled buffers in one submission.
+ * Otherwise the kernel is asked to populate the page cache for the range.
+ */
+static void
+prefetch(struct SqshPreadMapper *mapper, uint64_t offset, size_t size) {
+	bool locked = false;
+	if (sqsh__mutex_lock(&mapper->lock, &locked) < 0) {
+		return;
+	}
+
+	const bool sequential = offset == mapper->next_offset;
+	const uint64_t window =
+			(uint64_t)mapper->block_size * PREAD_PREFETCH_BLOCKS;
+	uint64_t start = offset + size;
+	const uint64_t end = SQSH_MIN(start + window, mapper->size);
+	mapper->next_offset = start;
+
+	/* A seek starts a new sequential run. The range requested ahead for the
+	 * previous run does not apply to it. */
+	if (sequential == false) {
+		mapper->prefetch_end = start;
+		goto out;
+	}
+	/* Only refill once half of the window has been consumed, so that the
+	 * requests are issued in batches. */
+	if (start + window / 2 < mapper->prefetch_end || start >= end) {
+		goto out;
+	}
+	start = SQSH_MAX(start, mapper->prefetch_end);
+	mapper->prefetch_end = end;
+
+#ifdef CONFIG_IO_URING
+	if (mapper->has_ring) {
+		submit_locked(mapper, start, end);
+		goto out;
+	}
+#endif
+	posix_fadvise(
+			mapper->fd, (off_t)start, (off_t)(end - start),
+			POSIX_FADV_WILLNEED);
+
+out:
+	sqsh__mutex_unlock(&mapper->lock, &locked);
+}
+
+static int
+sqsh_mapper_pread_init(
+		struct SqshMapper *mapper, const void *input, uint64_t *size) {
+	int rv = 0;
+	struct stat st;
+	struct SqshPreadMapper *pread_mapper =
+			calloc(1, sizeof(struct SqshPreadMapper));
+	if (pread_mapper == NULL) {
+		return -SQSH_ERROR_MALLOC_FAILED;
+	}
+	pread_mapper->fd = -1;
+	sqsh_mapper_set_user_data(mapper, pread_mapper);
+
+	rv = sqsh__mutex_init(&pread_mapper->lock);
+	if (rv < 0) {
+		goto out;
+	}
+#ifdef CONFIG_IO_URING
+	rv = sqsh__cond_init(&pread_mapper->completed);
+	if (rv < 0) {
+		goto out;
+	}
+#endif
+
+	pread_mapper->fd = open(input, O_RDONLY | O_CLOEXEC);
+	if (pread_mapper->fd < 0) {
+		rv = -errno;
+		goto out;
+	}
+	if (fstat(pread_mapper->fd, &st) < 0) {
+		rv = -errno;
+		goto out;
+	}
+	*size = (uint64_t)st.st_size;
+	pread_mapper->size = *size;
+	pread_mapper->block_size = sqsh_mapper_block_size(mapper);
+
+	/* Read ahead is done by the mapper itself on sequential access. */
+	posix_fadvise(pread_mapper->fd, 0, 0, POSIX_FADV_RANDOM);
+
+#ifdef CONFIG_IO_URING
+	/* If io_uring is not available, e.g. because it is disabled by the
+	 * system policy, the mapper falls back to posix_fadvise(). */
+	pread_mapper->has_ring =
+			io_uring_queue_init(
+					PREAD_CHUNK_COUNT, &pread_mapper->ring,
+					0) == 0;
+#endif
+
+out:
+	return rv;
+}
+
+static int
+sqsh_mapper_pread_map(
+		const struct SqshMapper *mapper, uint64_t offset, size_t size,
+		uint8_t **data) {
+	int rv = 0;
+	struct SqshPreadMapper *pread_mapper = sqsh_mapper_user_data(mapper);
+	*data = NULL;
+
+#ifdef CONFIG_IO_URING
+	if (take_prefetched(pread_mapper, offset, size, data)) {
+		goto out;
+	}
+#endif
+
+	*data = pool_get(pread_mapper, size);
+	if (*data == NULL) {
+		rv = -SQSH_ERROR_MALLOC_FAILED;
+		goto out;
+	}
+	rv = read_full(pread_mapper->fd, *data, size, offset);
+	if (rv < 0) {
+		free(*data);
+		*data = NULL;
+		goto out;
+	}
+
+out:
+	if (rv == 0) {
+		prefetch(pread_mapper, offset, size);
+	}
+	return rv;
+}
+
+static int
+sqsh_mapper_pread_unmap(
+		const struct SqshMapper *mapper, uint8_t *data, size_t size) {
+	struct SqshPreadMapper *pread_mapper = sqsh_mapper_user_data(mapper);
+	bool locked = false;
+
+	if (sqsh__mutex_lock(&pread_mapper->lock, &locked) < 0) {
+		free(data);
+		return 0;
+	}
+	pool_put_locked(pread_mapper, data, size);
+	sqsh__mutex_unlock(&pread_mapper->lock, &locked);
+	return 0;
+}
+
+static int
+sqsh_mapper_pread_cleanup(struct SqshMapper *mapper) {
+	struct SqshPreadMapper *pread_mapper = sqsh_mapper_user_data(mapper);
+	if (pread_mapper == NULL) {
+		return 0;
+	}
+
+#ifdef CONFIG_IO_URING
+	if (pread_mapper->has_ring) {
+		/* The kernel may still write into the buffers of pending reads. */
+		for (size_t i = 0; i < PREAD_CHUNK_COUNT; i++) {
+			struct PreadChunk *chunk = &pread_mapper->chunks[i];
+			if (chunk->used) {
+				wait_locked(pread_mapper, chunk);
+				free(chunk->data);
+			}
+		}
+		io_uring_queue_exit(&pread_mapper->ring);
+	}
+	sqsh__cond_destroy(&pread_mapper->completed);
+#endif
+	for (size_t i = 0; i < pread_mapper->pool_count; i++) {
+		free(pread_mapper->pool[i]);
+	}
+	if (pread_mapper->fd >= 0) {
+		close(pread_mapper->fd);
+	}
+	sqsh__mutex_destroy(&pread_mapper->lock);
+	free(pread_mapper);
+	return 0;
+}
+
+static const struct SqshMemoryMapperImpl impl = {
+		/* 256 KiB */
+		.block_size_hint = 256 * 1024,
+		.init2 = sqsh_mapper_pread_init,
+		.map2 = sqsh_mapper_pread_map,
+		.unmap = sqsh_mapper_pread_unmap,
+		.cleanup = sqsh_mapper_pread_cleanup,
+};
+const struct SqshMemoryMapperImpl *const sqsh_mapper_impl_pread = &impl;
@@ -83,6 +83,24 @@ config__config_compat_check_v1_0(void) {
 			sizeof(struct SqshConfigV1_0));
 }
 
+static void
+config__lru_size(void) {
+	/* Neither entries nor bytes configured */
+	ASSERT_EQ((size_t)128, sqsh__config_lru_size(0, 0, 0, 8192, 128));
+	/* Disabled caches stay disabled */
+	ASSERT_EQ((size_t)0, sqsh__config_lru_size(-1, 1 << 20, 0, 8192, 128));
+	/* Entry counts */
+	ASSERT_EQ((size_t)16, sqsh__config_lru_size(16, 0, 1 << 20, 8192, 128));
+	/* Byte budgets take precedence over entry counts */
+	ASSERT_EQ((size_t)8, sqsh__config_lru_size(16, 65536, 0, 8192, 128));
+	/* The archive wide budget is only used if nothing else is configured */
+	ASSERT_EQ((size_t)4, sqsh__config_lru_size(0, 0, 32768, 8192, 128));
+	ASSERT_EQ((size_t)16, sqsh__config_lru_size(16, 0, 32768, 8192, 128));
+	/* At least one entry is kept */
+	ASSERT_EQ((size_t)1, sqsh__config_lru_size(0, 1024, 0, 8192, 128));
+}
+
 DECLARE_TESTS
 TEST(config__config_compat_check_v1_0)
+TEST(config__lru_size)
 END_TESTS
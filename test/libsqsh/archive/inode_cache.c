@@ -0,0 +1,113 @@
+/*
+ * BSD 2-Clause License
+ *
+ * Copyright (c) 2023, Enno Boland
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @author       Enno Boland (mail@eboland.de)
+ * @file         inode_cache.c
+ */
+
+#include "../common.h"
+#include <testlib.h>
+
+#include <sqsh_archive_private.h>
+
+static struct SqshFileAttributes
+mk_attributes(uint64_t inode_ref, uint32_t inode_number) {
+	struct SqshFileAttributes attributes = {
+			.inode_ref = inode_ref,
+			.type = SQSH_FILE_TYPE_FILE,
+			.inode_number = inode_number,
+	};
+	return attributes;
+}
+
+static void
+inode_cache__put_get(void) {
+	int rv;
+	struct SqshInodeCache cache = {0};
+	struct SqshFileAttributes attributes = {0};
+
+	rv = sqsh__inode_cache_init(&cache, 16);
+	ASSERT_EQ(0, rv);
+
+	attributes = mk_attributes(0, 1);
+	sqsh__inode_cache_put(&cache, &attributes);
+	attributes = mk_attributes(4242, 2);
+	sqsh__inode_cache_put(&cache, &attributes);
+
+	ASSERT_EQ(true, sqsh__inode_cache_get(&cache, 0, &attributes));
+	ASSERT_EQ((uint32_t)1, attributes.inode_number);
+	ASSERT_EQ(true, sqsh__inode_cache_get(&cache, 4242, &attributes));
+	ASSERT_EQ((uint32_t)2, attributes.inode_number);
+	ASSERT_EQ(false, sqsh__inode_cache_get(&cache, 42, &attributes));
+
+	sqsh__inode_cache_cleanup(&cache);
+}
+
+static void
+inode_cache__replace(void) {
+	int rv;
+	struct SqshInodeCache cache = {0};
+	struct SqshFileAttributes attributes = {0};
+
+	rv = sqsh__inode_cache_init(&cache, 1);
+	ASSERT_EQ(0, rv);
+
+	attributes = mk_attributes(1, 1);
+	sqsh__inode_cache_put(&cache, &attributes);
+	attributes = mk_attributes(2, 2);
+	sqsh__inode_cache_put(&cache, &attributes);
+
+	ASSERT_EQ(false, sqsh__inode_cache_get(&cache, 1, &attributes));
+	ASSERT_EQ(true, sqsh__inode_cache_get(&cache, 2, &attributes));
+	ASSERT_EQ((uint32_t)2, attributes.inode_number);
+
+	sqsh__inode_cache_cleanup(&cache);
+}
+
+static void
+inode_cache__disabled(void) {
+	int rv;
+	struct SqshInodeCache cache = {0};
+	struct SqshFileAttributes attributes = mk_attributes(1, 1);
+
+	rv = sqsh__inode_cache_init(&cache, 0);
+	ASSERT_EQ(0, rv);
+
+	sqsh__inode_cache_put(&cache, &attributes);
+	ASSERT_EQ(false, sqsh__inode_cache_get(&cache, 1, &attributes));
+
+	sqsh__inode_cache_cleanup(&cache);
+}
+
+DECLARE_TESTS
+TEST(inode_cache__put_get)
+TEST(inode_cache__replace)
+TEST(inode_cache__disabled)
+END_TESTS
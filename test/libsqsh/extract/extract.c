@@ -93,6 +93,72 @@ decompress_test_split(
 	}
 }
 
+static void
+decompress_test_decoder(
+		const struct SqshExtractorImpl *impl, uint8_t *input,
+		size_t input_size) {
+	int rv;
+	uint8_t output[16];
+	void *decoder = NULL;
+	sqsh__extractor_context_t context = {0};
+
+	if (impl == NULL) {
+		puts("skipping test extractor compile time disabled.");
+		return;
+	}
+
+	rv = impl->decoder_new(&decoder);
+	ASSERT_EQ(0, rv);
+
+	for (int i = 0; i < 3; i++) {
+		size_t output_size = sizeof(output);
+		memset(output, 0, sizeof(output));
+
+		rv = impl->init_with_decoder(context, decoder, output, output_size);
+		ASSERT_EQ(0, rv);
+		rv = impl->write(context, input, input_size);
+		ASSERT_EQ(0, rv);
+		rv = impl->finish(context, output, &output_size);
+		ASSERT_EQ(0, rv);
+
+		ASSERT_EQ((size_t)4, output_size);
+		ASSERT_EQ(0, memcmp(output, "abcd", 4));
+	}
+
+	impl->decoder_free(decoder);
+}
+
+static void
+decompress_test_oneshot(
+		const struct SqshExtractorImpl *impl, uint8_t *input,
+		size_t input_size) {
+	int rv;
+	uint8_t output[16];
+	void *decoder = NULL;
+
+	if (impl == NULL) {
+		puts("skipping test extractor compile time disabled.");
+		return;
+	}
+
+	rv = impl->decoder_new(&decoder);
+	ASSERT_EQ(0, rv);
+
+	for (int i = 0; i < 3; i++) {
+		size_t output_size = sizeof(output);
+		memset(output, 0, sizeof(output));
+
+		rv = impl->decompress(
+				decoder, output, &output_size, input, input_size);
+		ASSERT_EQ(0, rv);
+
+		ASSERT_EQ((size_t)4, output_size);
+		ASSERT_EQ(0, memcmp(output, "abcd", 4));
+	}
+
+	impl->decoder_free(decoder);
+}
+
 static void
 extract__decompress_lzma(void) {
 	uint8_t input[] = {0x5d, 0x00, 0x00, 0x80, 0x00, 0xff, 0xff, 0xff, 0xff,
@@ -102,6 +168,24 @@ extract__decompress_lzma(void) {
 	decompress_test(sqsh__impl_lzma, input, sizeof(input));
 }
 
+static void
+extract__decompress_lzma_decoder(void) {
+	uint8_t input[] = {0x5d, 0x00, 0x00, 0x80, 0x00, 0xff, 0xff, 0xff, 0xff,
+					   0xff, 0xff, 0xff, 0xff, 0x00, 0x30, 0x98, 0x88, 0x98,
+					   0x46, 0x7e, 0x1e, 0xb2, 0xff, 0xfa, 0x1c, 0x80, 0x00};
+
+	decompress_test_decoder(sqsh__impl_lzma, input, sizeof(input));
+}
+
+static void
+extract__decompress_lzma_oneshot(void) {
+	uint8_t input[] = {0x5d, 0x00, 0x00, 0x80, 0x00, 0xff, 0xff, 0xff, 0xff,
+					   0xff, 0xff, 0xff, 0xff, 0x00, 0x30, 0x98, 0x88, 0x98,
+					   0x46, 0x7e, 0x1e, 0xb2, 0xff, 0xfa, 0x1c, 0x80, 0x00};
+
+	decompress_test_oneshot(sqsh__impl_lzma, input, sizeof(input));
+}
+
 static void
 extract__decompress_lzma_split(void) {
 	uint8_t input[] = {0x5d, 0x00, 0x00, 0x80, 0x00, 0xff, 0xff, 0xff, 0xff,
@@ -124,6 +208,32 @@ extract__decompress_xz(void) {
 	decompress_test(sqsh__impl_xz, input, sizeof(input));
 }
 
+static void
+extract__decompress_xz_decoder(void) {
+	uint8_t input[] = {0xfd, 0x37, 0x7a, 0x58, 0x5a, 0x00, 0x00, 0x04, 0xe6,
+					   0xd6, 0xb4, 0x46, 0x02, 0x00, 0x21, 0x01, 0x16, 0x00,
+					   0x00, 0x00, 0x74, 0x2f, 0xe5, 0xa3, 0x01, 0x00, 0x03,
+					   0x61, 0x62, 0x63, 0x64, 0x00, 0xba, 0x60, 0x59, 0x6e,
+					   0x59, 0x28, 0x9d, 0x3c, 0x00, 0x01, 0x1c, 0x04, 0x6f,
+					   0x2c, 0x9c, 0xc1, 0x1f, 0xb6, 0xf3, 0x7d, 0x01, 0x00,
+					   0x00, 0x00, 0x00, 0x04, 0x59, 0x5a};
+
+	decompress_test_decoder(sqsh__impl_xz, input, sizeof(input));
+}
+
+static void
+extract__decompress_xz_oneshot(void) {
+	uint8_t input[] = {0xfd, 0x37, 0x7a, 0x58, 0x5a, 0x00, 0x00, 0x04, 0xe6,
+					   0xd6, 0xb4, 0x46, 0x02, 0x00, 0x21, 0x01, 0x16, 0x00,
+					   0x00, 0x00, 0x74, 0x2f, 0xe5, 0xa3, 0x01, 0x00, 0x03,
+					   0x61, 0x62, 0x63, 0x64, 0x00, 0xba, 0x60, 0x59, 0x6e,
+					   0x59, 0x28, 0x9d, 0x3c, 0x00, 0x01, 0x1c, 0x04, 0x6f,
+					   0x2c, 0x9c, 0xc1, 0x1f, 0xb6, 0xf3, 0x7d, 0x01, 0x00,
+					   0x00, 0x00, 0x00, 0x04, 0x59, 0x5a};
+
+	decompress_test_oneshot(sqsh__impl_xz, input, sizeof(input));
+}
+
 static void
 extract__decompress_xz_split(void) {
 	uint8_t input[] = {0xfd, 0x37, 0x7a, 0x58, 0x5a, 0x00, 0x00, 0x04, 0xe6,
@@ -144,6 +254,20 @@ extract__decompress_lz4(void) {
 	decompress_test(sqsh__impl_lz4, input, sizeof(input));
 }
 
+static void
+extract__decompress_lz4_decoder(void) {
+	uint8_t input[] = {0x40, 0x61, 0x62, 0x63, 0x64};
+
+	decompress_test_decoder(sqsh__impl_lz4, input, sizeof(input));
+}
+
+static void
+extract__decompress_lz4_oneshot(void) {
+	uint8_t input[] = {0x40, 0x61, 0x62, 0x63, 0x64};
+
+	decompress_test_oneshot(sqsh__impl_lz4, input, sizeof(input));
+}
+
 static void
 extract__decompress_lz4_split(void) {
 	uint8_t input[] = {0x40, 0x61, 0x62, 0x63, 0x64};
@@ -160,6 +284,24 @@ extract__decompress_zlib(void) {
 	decompress_test(sqsh__impl_zlib, input, sizeof(input));
 }
 
+static void
+extract__decompress_zlib_decoder(void) {
+	uint8_t input[] = {
+			ZLIB_ABCD,
+	};
+
+	decompress_test_decoder(sqsh__impl_zlib, input, sizeof(input));
+}
+
+static void
+extract__decompress_zlib_oneshot(void) {
+	uint8_t input[] = {
+			ZLIB_ABCD,
+	};
+
+	decompress_test_oneshot(sqsh__impl_zlib, input, sizeof(input));
+}
+
 static void
 extract__decompress_zlib_split(void) {
 	uint8_t input[] = {
@@ -177,6 +319,22 @@ extract__decompress_zstd(void) {
 	decompress_test(sqsh__impl_zstd, input, sizeof(input));
 }
 
+static void
+extract__decompress_zstd_decoder(void) {
+	uint8_t input[] = {0x28, 0xb5, 0x2f, 0xfd, 0x20, 0x04, 0x21,
+					   0x00, 0x00, 0x61, 0x62, 0x63, 0x64};
+
+	decompress_test_decoder(sqsh__impl_zstd, input, sizeof(input));
+}
+
+static void
+extract__decompress_zstd_oneshot(void) {
+	uint8_t input[] = {0x28, 0xb5, 0x2f, 0xfd, 0x20, 0x04, 0x21,
+					   0x00, 0x00, 0x61, 0x62, 0x63, 0x64};
+
+	decompress_test_oneshot(sqsh__impl_zstd, input, sizeof(input));
+}
+
 static void
 extract__decompress_zstd_split(void) {
 	uint8_t input[] = {0x28, 0xb5, 0x2f, 0xfd, 0x20, 0x04, 0x21,
@@ -185,15 +343,86 @@ extract__decompress_zstd_split(void) {
 	decompress_test_split(sqsh__impl_zstd, input, sizeof(input));
 }
 
+static int
+legacy_init(void *context, uint8_t *target, size_t target_size) {
+	(void)context;
+	(void)target;
+	(void)target_size;
+	return 0;
+}
+
+static int
+legacy_write(
+		void *context, const uint8_t *compressed,
+		const size_t compressed_size) {
+	(void)context;
+	(void)compressed;
+	(void)compressed_size;
+	return 0;
+}
+
+static int
+legacy_finish(void *context, uint8_t *target, size_t *target_size) {
+	(void)context;
+	(void)target;
+	*target_size = 0;
+	return 0;
+}
+
+/* Mimics an out-of-tree extractor that was built against the first three
+ * members of SqshExtractorImpl only. */
+static const struct {
+	int (*init)(void *context, uint8_t *target, size_t target_size);
+	int (*write)(
+			void *context, const uint8_t *compressed,
+			const size_t compressed_size);
+	int (*finish)(void *context, uint8_t *target, size_t *target_size);
+} legacy_impl = {
+		.init = legacy_init,
+		.write = legacy_write,
+		.finish = legacy_finish,
+};
+
+static void
+extract__legacy_impl(void) {
+	int rv;
+	void *decoder = NULL;
+	struct SqshExtractorPool pool = {0};
+	const struct SqshExtractorImpl *impl =
+			(const struct SqshExtractorImpl *)&legacy_impl;
+
+	ASSERT_EQ(false, sqsh__extractor_impl_is_builtin(impl));
+	ASSERT_EQ((uint32_t)1, sqsh__extractor_impl_decode_cost(impl));
+
+	rv = sqsh__extractor_pool_init(&pool, impl);
+	ASSERT_EQ(0, rv);
+	rv = sqsh__extractor_pool_acquire(&pool, &decoder);
+	ASSERT_EQ(0, rv);
+	ASSERT_EQ(NULL, decoder);
+	rv = sqsh__extractor_pool_cleanup(&pool);
+	ASSERT_EQ(0, rv);
+}
+
 DECLARE_TESTS
 TEST(extract__decompress_lzma)
 NO_TEST(extract__decompress_lzma_split)
+TEST(extract__decompress_lzma_decoder)
+TEST(extract__decompress_lzma_oneshot)
 TEST(extract__decompress_xz)
 TEST(extract__decompress_xz_split)
+TEST(extract__decompress_xz_decoder)
+TEST(extract__decompress_xz_oneshot)
 TEST(extract__decompress_lz4)
 NO_TEST(extract__decompress_lz4_split)
+TEST(extract__decompress_lz4_decoder)
+TEST(extract__decompress_lz4_oneshot)
 TEST(extract__decompress_zlib)
 TEST(extract__decompress_zlib_split)
+TEST(extract__decompress_zlib_decoder)
+TEST(extract__decompress_zlib_oneshot)
 TEST(extract__decompress_zstd)
 TEST(extract__decompress_zstd_split)
+TEST(extract__decompress_zstd_decoder)
+TEST(extract__decompress_zstd_oneshot)
+TEST(extract__legacy_impl)
 END_TESTS
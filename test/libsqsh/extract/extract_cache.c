@@ -0,0 +1,261 @@
+/*
+ * BSD 2-Clause License
+ *
+ * Copyright (c) 2023, Enno Boland
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @author       Enno Boland (mail@eboland.de)
+ * @file         extract_cache.c
+ */
+
+#include "../common.h"
+#include <testlib.h>
+
+#include <cextras/collection.h>
+#include <sqsh_archive.h>
+#include <sqsh_extract_private.h>
+
+static void
+access_block(
+		struct CxRcHashMap *map, struct SqshExtractCache *cache,
+		uint64_t address, uint64_t cost) {
+	int rv;
+	int value = 0;
+	if (cx_rc_hash_map_retain(map, address) == NULL) {
+		ASSERT_NE(NULL, cx_rc_hash_map_put(map, address, &value));
+	} else {
+		cost = 0;
+	}
+	rv = sqsh__extract_cache_touch(cache, address, 100, cost);
+	ASSERT_EQ(0, rv);
+	rv = cx_rc_hash_map_release_key(map, address);
+	ASSERT_EQ(0, rv);
+}
+
+static bool
+is_resident(struct CxRcHashMap *map, uint64_t address) {
+	if (cx_rc_hash_map_retain(map, address) == NULL) {
+		return false;
+	}
+	cx_rc_hash_map_release_key(map, address);
+	return true;
+}
+
+static void
+run_scan(int policy, bool expect_hot_resident) {
+	int rv;
+	struct CxRcHashMap map = {0};
+	struct SqshExtractCache cache = {0};
+
+	rv = cx_rc_hash_map_init(&map, 64, sizeof(int), NULL);
+	ASSERT_EQ(0, rv);
+	rv = sqsh__extract_cache_init(&cache, 8, policy, &map);
+	ASSERT_EQ(0, rv);
+
+	/* Interleave accesses to a hot set with short scans. */
+	uint64_t scan_address = 100;
+	for (int round = 0; round < 3; round++) {
+		for (uint64_t address = 1; address <= 4; address++) {
+			access_block(&map, &cache, address, 1);
+		}
+		for (int i = 0; i < 8; i++, scan_address++) {
+			access_block(&map, &cache, scan_address, 1);
+		}
+	}
+	for (uint64_t address = 1000; address < 1100; address++) {
+		access_block(&map, &cache, address, 1);
+	}
+
+	for (uint64_t address = 1; address <= 4; address++) {
+		ASSERT_EQ(expect_hot_resident, is_resident(&map, address));
+	}
+
+	rv = sqsh__extract_cache_cleanup(&cache);
+	ASSERT_EQ(0, rv);
+	for (uint64_t address = 1000; address < 1100; address++) {
+		ASSERT_EQ(false, is_resident(&map, address));
+	}
+	cx_rc_hash_map_cleanup(&map);
+}
+
+static void
+extract_cache__lru_scan(void) {
+	run_scan(SQSH_CACHE_POLICY_LRU, false);
+}
+
+static void
+extract_cache__2q_scan(void) {
+	run_scan(SQSH_CACHE_POLICY_2Q, true);
+}
+
+static void
+extract_cache__2q_cost(void) {
+	int rv;
+	struct CxRcHashMap map = {0};
+	struct SqshExtractCache cache = {0};
+
+	rv = cx_rc_hash_map_init(&map, 64, sizeof(int), NULL);
+	ASSERT_EQ(0, rv);
+	rv = sqsh__extract_cache_init(&cache, 4, SQSH_CACHE_POLICY_2Q, &map);
+	ASSERT_EQ(0, rv);
+
+	/* Fill the cache and push block 1 and 2 out to the ghost queue. */
+	const uint64_t first[] = {1, 2, 3, 4, 5, 6};
+	const uint64_t first_cost[] = {1, 8, 1, 1, 1, 1};
+	for (size_t i = 0; i < sizeof(first) / sizeof(first[0]); i++) {
+		access_block(&map, &cache, first[i], first_cost[i]);
+	}
+	ASSERT_EQ(false, is_resident(&map, 1));
+	ASSERT_EQ(false, is_resident(&map, 2));
+
+	/* Accessing them again promotes them to the main queue. Block 2 is the
+	 * least recently used block of the main queue, but it is the most
+	 * expensive one to decode. */
+	const uint64_t second[] = {2, 1, 3, 4};
+	const uint64_t second_cost[] = {8, 1, 1, 1};
+	for (size_t i = 0; i < sizeof(second) / sizeof(second[0]); i++) {
+		access_block(&map, &cache, second[i], second_cost[i]);
+	}
+	ASSERT_EQ(true, is_resident(&map, 2));
+	ASSERT_EQ(false, is_resident(&map, 1));
+
+	rv = sqsh__extract_cache_cleanup(&cache);
+	ASSERT_EQ(0, rv);
+	cx_rc_hash_map_cleanup(&map);
+}
+
+static void
+extract_cache__disabled(void) {
+	int rv;
+	struct CxRcHashMap map = {0};
+	struct SqshExtractCache cache = {0};
+
+	rv = cx_rc_hash_map_init(&map, 64, sizeof(int), NULL);
+	ASSERT_EQ(0, rv);
+	rv = sqsh__extract_cache_init(&cache, 0, SQSH_CACHE_POLICY_2Q, &map);
+	ASSERT_EQ(0, rv);
+
+	access_block(&map, &cache, 1, 1);
+	ASSERT_EQ(false, is_resident(&map, 1));
+
+	rv = sqsh__extract_cache_cleanup(&cache);
+	ASSERT_EQ(0, rv);
+	cx_rc_hash_map_cleanup(&map);
+}
+
+static void
+extract_cache__limit_size(void) {
+	int rv;
+	struct CxRcHashMap map = {0};
+	struct SqshExtractCache cache = {0};
+
+	rv = cx_rc_hash_map_init(&map, 64, sizeof(int), NULL);
+	ASSERT_EQ(0, rv);
+	rv = sqsh__extract_cache_init(&cache, 8, SQSH_CACHE_POLICY_LRU, &map);
+	ASSERT_EQ(0, rv);
+	sqsh__extract_cache_limit_size(&cache, 250);
+
+	for (uint64_t address = 1; address <= 4; address++) {
+		access_block(&map, &cache, address, 1);
+	}
+	ASSERT_EQ(false, is_resident(&map, 2));
+	ASSERT_EQ(true, is_resident(&map, 3));
+	ASSERT_EQ(true, is_resident(&map, 4));
+
+	rv = sqsh__extract_cache_cleanup(&cache);
+	ASSERT_EQ(0, rv);
+	cx_rc_hash_map_cleanup(&map);
+}
+
+static void
+extract_cache__context(void) {
+	int rv;
+	struct CxRcHashMap map_a = {0}, map_b = {0};
+	struct SqshExtractCache cache_a = {0}, cache_b = {0};
+	sqsh__mutex_t lock_a, lock_b;
+	struct SqshCacheContext *context =
+			sqsh_cache_context_new(300, SQSH_CACHE_POLICY_LRU, &rv);
+	ASSERT_EQ(0, rv);
+
+	rv = sqsh__mutex_init(&lock_a);
+	ASSERT_EQ(0, rv);
+	rv = sqsh__mutex_init(&lock_b);
+	ASSERT_EQ(0, rv);
+	rv = cx_rc_hash_map_init(&map_a, 64, sizeof(int), NULL);
+	ASSERT_EQ(0, rv);
+	rv = cx_rc_hash_map_init(&map_b, 64, sizeof(int), NULL);
+	ASSERT_EQ(0, rv);
+	rv = sqsh__extract_cache_init(&cache_a, 8, context->policy, &map_a);
+	ASSERT_EQ(0, rv);
+	rv = sqsh__extract_cache_attach(&cache_a, context, &lock_a);
+	ASSERT_EQ(0, rv);
+	rv = sqsh__extract_cache_init(&cache_b, 8, context->policy, &map_b);
+	ASSERT_EQ(0, rv);
+	rv = sqsh__extract_cache_attach(&cache_b, context, &lock_b);
+	ASSERT_EQ(0, rv);
+
+	for (uint64_t address = 1; address <= 3; address++) {
+		access_block(&map_a, &cache_a, address, 1);
+	}
+	ASSERT_EQ((uint64_t)300, sqsh_cache_context_size(context));
+
+	/* The blocks of the idle cache are evicted first. */
+	access_block(&map_b, &cache_b, 101, 1);
+	ASSERT_EQ((uint64_t)300, sqsh_cache_context_size(context));
+	ASSERT_EQ(false, is_resident(&map_a, 1));
+	ASSERT_EQ(true, is_resident(&map_a, 2));
+
+	for (uint64_t address = 102; address <= 104; address++) {
+		access_block(&map_b, &cache_b, address, 1);
+	}
+	ASSERT_EQ((uint64_t)300, sqsh_cache_context_size(context));
+	ASSERT_EQ(false, is_resident(&map_a, 3));
+	ASSERT_EQ(false, is_resident(&map_b, 101));
+	ASSERT_EQ(true, is_resident(&map_b, 104));
+
+	rv = sqsh__extract_cache_cleanup(&cache_a);
+	ASSERT_EQ(0, rv);
+	rv = sqsh__extract_cache_cleanup(&cache_b);
+	ASSERT_EQ(0, rv);
+	ASSERT_EQ((uint64_t)0, sqsh_cache_context_size(context));
+
+	cx_rc_hash_map_cleanup(&map_a);
+	cx_rc_hash_map_cleanup(&map_b);
+	sqsh__mutex_destroy(&lock_a);
+	sqsh__mutex_destroy(&lock_b);
+	rv = sqsh_cache_context_free(context);
+	ASSERT_EQ(0, rv);
+}
+
+DECLARE_TESTS
+TEST(extract_cache__lru_scan)
+TEST(extract_cache__2q_scan)
+TEST(extract_cache__2q_cost)
+TEST(extract_cache__disabled)
+TEST(extract_cache__limit_size)
+TEST(extract_cache__context)
+END_TESTS
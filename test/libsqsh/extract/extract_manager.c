@@ -40,6 +40,8 @@
 #include <sqsh_extract_private.h>
 #include <sqsh_mapper_private.h>
 
+#include <pthread.h>
+
 static void
 directory_iterator__decompress(void) {
 	int rv;
@@ -116,7 +118,199 @@ directory_iterator__decompress_and_cached(void) {
 	sqsh__archive_cleanup(&archive);
 }
 
+struct ConcurrentUncompress {
+	struct SqshExtractManager *manager;
+	const struct SqshMapReader *reader;
+	struct CxBuffer *buffer;
+	int rv;
+};
+
+static void *
+concurrent_uncompress_worker(void *data) {
+	struct ConcurrentUncompress *job = data;
+	job->rv = sqsh__extract_manager_uncompress(
+			job->manager, job->reader, &job->buffer);
+	return NULL;
+}
+
+static void
+directory_iterator__decompress_concurrent(void) {
+	int rv;
+	struct SqshArchive archive = {0};
+	struct SqshExtractManager manager = {0};
+	pthread_t threads[16] = {0};
+	struct ConcurrentUncompress jobs[16] = {0};
+	uint8_t payload[8192] = {SQSH_HEADER, ZLIB_ABCD};
+
+	mk_stub(&archive, payload, sizeof(payload));
+
+	struct SqshMapManager *map_manager = sqsh_archive_map_manager(&archive);
+	struct SqshMapReader reader = {0};
+	rv = sqsh__map_reader_init(
+			&reader, map_manager, sizeof(struct SqshDataSuperblock),
+			sizeof(payload));
+	ASSERT_EQ(0, rv);
+
+	rv = sqsh__map_reader_advance(&reader, 0, CHUNK_SIZE(ZLIB_ABCD));
+	ASSERT_EQ(0, rv);
+
+	rv = sqsh__extract_manager_init(&manager, &archive, 8192, 128);
+	ASSERT_EQ(0, rv);
+
+	for (size_t i = 0; i < 16; i++) {
+		jobs[i].manager = &manager;
+		jobs[i].reader = &reader;
+		rv = pthread_create(
+				&threads[i], NULL, concurrent_uncompress_worker, &jobs[i]);
+		ASSERT_EQ(0, rv);
+	}
+	for (size_t i = 0; i < 16; i++) {
+		rv = pthread_join(threads[i], NULL);
+		ASSERT_EQ(0, rv);
+		ASSERT_EQ(0, jobs[i].rv);
+		ASSERT_EQ(jobs[0].buffer, jobs[i].buffer);
+	}
+	ASSERT_EQ((size_t)4, cx_buffer_size(jobs[0].buffer));
+	ASSERT_EQ(0, memcmp(cx_buffer_data(jobs[0].buffer), "abcd", 4));
+	ASSERT_EQ(NULL, manager.inflight);
+
+	sqsh__map_reader_cleanup(&reader);
+	for (size_t i = 0; i < 16; i++) {
+		sqsh__extract_manager_release(
+				&manager, sizeof(struct SqshDataSuperblock));
+	}
+	sqsh__extract_manager_cleanup(&manager);
+	sqsh__archive_cleanup(&archive);
+}
+
+static void
+uncompress_at(
+		struct SqshExtractManager *manager, struct SqshMapManager *map_manager,
+		uint64_t address, size_t size, const char *expected) {
+	int rv;
+	struct CxBuffer *buffer = NULL;
+	struct SqshMapReader reader = {0};
+	rv = sqsh__map_reader_init(&reader, map_manager, address, 8192);
+	ASSERT_EQ(0, rv);
+	rv = sqsh__map_reader_advance(&reader, 0, size);
+	ASSERT_EQ(0, rv);
+
+	rv = sqsh__extract_manager_uncompress(manager, &reader, &buffer);
+	ASSERT_EQ(0, rv);
+	ASSERT_EQ(0, memcmp(cx_buffer_data(buffer), expected, 4));
+
+	sqsh__map_reader_cleanup(&reader);
+	rv = sqsh__extract_manager_release(manager, address);
+	ASSERT_EQ(0, rv);
+}
+
+static void
+extract_manager__lookup_compressed(void) {
+	int rv;
+	struct SqshArchive archive = {0};
+	struct SqshExtractManager manager = {0};
+	struct CxBuffer *buffer = NULL;
+	uint8_t payload[8192] = {SQSH_HEADER, ZLIB_ABCD, ZLIB_EFGH};
+	const uint64_t abcd_address = sizeof(struct SqshDataSuperblock);
+	const uint64_t efgh_address = abcd_address + CHUNK_SIZE(ZLIB_ABCD);
+
+	mk_stub(&archive, payload, sizeof(payload));
+	struct SqshMapManager *map_manager = sqsh_archive_map_manager(&archive);
+
+	rv = sqsh__extract_manager_init(&manager, &archive, 8192, 1);
+	ASSERT_EQ(0, rv);
+	rv = sqsh__extract_manager_init_compressed_cache(&manager, 8192);
+	ASSERT_EQ(0, rv);
+
+	rv = sqsh__extract_manager_lookup(&manager, abcd_address, &buffer);
+	ASSERT_EQ(0, rv);
+
+	uncompress_at(
+			&manager, map_manager, abcd_address, CHUNK_SIZE(ZLIB_ABCD), "abcd");
+	/* Evicts the decompressed abcd block. */
+	uncompress_at(
+			&manager, map_manager, efgh_address, CHUNK_SIZE(ZLIB_EFGH), "efgh");
+
+	rv = sqsh__extract_manager_lookup(&manager, abcd_address, &buffer);
+	ASSERT_EQ(1, rv);
+	ASSERT_EQ((size_t)4, cx_buffer_size(buffer));
+	ASSERT_EQ(0, memcmp(cx_buffer_data(buffer), "abcd", 4));
+	rv = sqsh__extract_manager_release(&manager, abcd_address);
+	ASSERT_EQ(0, rv);
+
+	sqsh__extract_manager_cleanup(&manager);
+	sqsh__archive_cleanup(&archive);
+}
+
+static void
+extract_manager__lookup_without_compressed(void) {
+	int rv;
+	struct SqshArchive archive = {0};
+	struct SqshExtractManager manager = {0};
+	struct CxBuffer *buffer = NULL;
+	uint8_t payload[8192] = {SQSH_HEADER, ZLIB_ABCD, ZLIB_EFGH};
+	const uint64_t abcd_address = sizeof(struct SqshDataSuperblock);
+	const uint64_t efgh_address = abcd_address + CHUNK_SIZE(ZLIB_ABCD);
+
+	mk_stub(&archive, payload, sizeof(payload));
+	struct SqshMapManager *map_manager = sqsh_archive_map_manager(&archive);
+
+	rv = sqsh__extract_manager_init(&manager, &archive, 8192, 1);
+	ASSERT_EQ(0, rv);
+
+	uncompress_at(
+			&manager, map_manager, abcd_address, CHUNK_SIZE(ZLIB_ABCD), "abcd");
+	rv = sqsh__extract_manager_lookup(&manager, abcd_address, &buffer);
+	ASSERT_EQ(1, rv);
+	rv = sqsh__extract_manager_release(&manager, abcd_address);
+	ASSERT_EQ(0, rv);
+
+	uncompress_at(
+			&manager, map_manager, efgh_address, CHUNK_SIZE(ZLIB_EFGH), "efgh");
+	rv = sqsh__extract_manager_lookup(&manager, abcd_address, &buffer);
+	ASSERT_EQ(0, rv);
+
+	sqsh__extract_manager_cleanup(&manager);
+	sqsh__archive_cleanup(&archive);
+}
+
+static void
+extract_manager__reuse_buffers(void) {
+	int rv;
+	struct SqshArchive archive = {0};
+	struct SqshExtractManager manager = {0};
+	uint8_t payload[8192] = {SQSH_HEADER, ZLIB_ABCD, ZLIB_EFGH};
+	const uint64_t abcd_address = sizeof(struct SqshDataSuperblock);
+	const uint64_t efgh_address = abcd_address + CHUNK_SIZE(ZLIB_ABCD);
+
+	mk_stub(&archive, payload, sizeof(payload));
+	struct SqshMapManager *map_manager = sqsh_archive_map_manager(&archive);
+
+	rv = sqsh__extract_manager_init(&manager, &archive, 8192, 1);
+	ASSERT_EQ(0, rv);
+
+	uncompress_at(
+			&manager, map_manager, abcd_address, CHUNK_SIZE(ZLIB_ABCD), "abcd");
+	ASSERT_EQ((size_t)0, manager.buffer_pool_count);
+
+	/* The buffer of the evicted block is kept for reuse. */
+	uncompress_at(
+			&manager, map_manager, efgh_address, CHUNK_SIZE(ZLIB_EFGH), "efgh");
+	ASSERT_EQ((size_t)1, manager.buffer_pool_count);
+
+	uncompress_at(
+			&manager, map_manager, abcd_address, CHUNK_SIZE(ZLIB_ABCD), "abcd");
+	ASSERT_EQ((size_t)1, manager.buffer_pool_count);
+
+	sqsh__extract_manager_cleanup(&manager);
+	sqsh__archive_cleanup(&archive);
+}
+
 DECLARE_TESTS
 TEST(directory_iterator__decompress)
 TEST(directory_iterator__decompress_and_cached)
+TEST(directory_iterator__decompress_concurrent)
+TEST(extract_manager__lookup_compressed)
+TEST(extract_manager__lookup_without_compressed)
+TEST(extract_manager__reuse_buffers)
 END_TESTS
@@ -165,8 +165,66 @@ file__resolve_unkown_dir_inode(void) {
 	sqsh__archive_cleanup(&archive);
 }
 
+static void
+file__attributes_by_ref(void) {
+	int rv;
+	struct SqshArchive archive = {0};
+	struct SqshFile file = {0};
+	struct SqshInodeCache *inode_cache = NULL;
+	struct SqshFileAttributes attributes = {0};
+	struct SqshFileAttributes cached = {0};
+	uint8_t payload[8192] = {
+			SQSH_HEADER,
+			/* inode */
+			[INODE_TABLE_OFFSET + 15] = METABLOCK_HEADER(0, 128),
+			0,
+			0,
+			0,
+			INODE_HEADER(2, 0666, 0, 0, 4242, 1),
+			INODE_BASIC_FILE(1024, 0xFFFFFFFF, 0, 1),
+			UINT32_BYTES(42),
+
+	};
+	mk_stub(&archive, payload, sizeof(payload));
+
+	uint64_t inode_ref = sqsh_address_ref_create(15, 3);
+	rv = sqsh_file_attributes_by_ref(&archive, inode_ref, &attributes);
+	ASSERT_EQ(0, rv);
+
+	ASSERT_EQ(inode_ref, attributes.inode_ref);
+	ASSERT_EQ(SQSH_FILE_TYPE_FILE, (int)attributes.type);
+	ASSERT_EQ(0666, attributes.permission);
+	ASSERT_EQ((uint32_t)1, attributes.inode_number);
+	ASSERT_EQ((uint32_t)4242, attributes.modified_time);
+	ASSERT_EQ((uint64_t)1024, attributes.blocks_start);
+
+	rv = sqsh__file_init(&file, &archive, inode_ref);
+	ASSERT_EQ(0, rv);
+	ASSERT_EQ(sqsh_file_size(&file), attributes.size);
+	ASSERT_EQ(sqsh_file_uid(&file), attributes.uid);
+	ASSERT_EQ(sqsh_file_gid(&file), attributes.gid);
+	ASSERT_EQ(sqsh_file_hard_link_count(&file), attributes.hard_link_count);
+	sqsh__file_cleanup(&file);
+
+	/* The second lookup is served from the cache */
+	rv = sqsh__archive_inode_cache(&archive, &inode_cache);
+	ASSERT_EQ(0, rv);
+	ASSERT_EQ(
+			true, sqsh__inode_cache_get(inode_cache, inode_ref, &cached));
+	ASSERT_EQ(inode_ref, cached.inode_ref);
+	ASSERT_EQ((uint32_t)4242, cached.modified_time);
+
+	rv = sqsh_file_attributes_by_ref(&archive, inode_ref, &cached);
+	ASSERT_EQ(0, rv);
+	ASSERT_EQ(attributes.size, cached.size);
+	ASSERT_EQ(attributes.uid, cached.uid);
+
+	sqsh__archive_cleanup(&archive);
+}
+
 DECLARE_TESTS
 TEST(file__load_file)
 TEST(file__resolve_file)
 TEST(file__resolve_unkown_dir_inode)
+TEST(file__attributes_by_ref)
 END_TESTS
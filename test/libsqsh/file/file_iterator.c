@@ -38,6 +38,7 @@
 #include <sqsh_archive_private.h>
 #include <sqsh_common_private.h>
 #include <sqsh_data_private.h>
+#include <sqsh_file_private.h>
 
 static const size_t BLOCK_SIZE = 32768;
 #define ZERO_BLOCK_SIZE (size_t)16384
@@ -588,6 +589,84 @@ open_directory_with_file_iterator(void) {
 	sqsh__archive_cleanup(&archive);
 }
 
+static void
+skip_with_block_offset_index(void) {
+	int rv;
+	struct SqshArchive archive = {0};
+	struct SqshFile file = {0};
+	uint64_t offset;
+	uint8_t payload[] = {
+			/* clang-format off */
+			SQSH_HEADER,
+			/* inode */
+			[INODE_TABLE_OFFSET] = METABLOCK_HEADER(0, 128),
+			INODE_HEADER(2, 0, 0, 0, 0, 1),
+			INODE_BASIC_FILE(8192, 0xFFFFFFFF, 0, 2 * BLOCK_SIZE + 3),
+			DATA_BLOCK_REF(1000, 0),
+			DATA_BLOCK_REF(5, 0),
+			DATA_BLOCK_REF(3, 0),
+			/* datablocks */
+			[8192 ... 8192 + 999] = 0xa1,
+			[8192 + 1000] = 1, 2, 3, 4, 5,
+			[8192 + 1005] = 7, 8, 9
+			/* clang-format on */
+	};
+	mk_stub(&archive, payload, sizeof(payload));
+
+	uint64_t inode_ref = sqsh_address_ref_create(0, 0);
+	rv = sqsh__file_init(&file, &archive, inode_ref);
+	ASSERT_EQ(0, rv);
+
+	rv = sqsh__file_block_offset(&file, 0, &offset);
+	ASSERT_EQ(0, rv);
+	ASSERT_EQ((uint64_t)0, offset);
+	rv = sqsh__file_block_offset(&file, 2, &offset);
+	ASSERT_EQ(0, rv);
+	ASSERT_EQ((uint64_t)1005, offset);
+	rv = sqsh__file_block_offset(&file, 3, &offset);
+	ASSERT_EQ(0, rv);
+	ASSERT_EQ((uint64_t)1008, offset);
+	rv = sqsh__file_block_offset(&file, 4, &offset);
+	ASSERT_EQ(-SQSH_ERROR_OUT_OF_BOUNDS, rv);
+
+	struct SqshFileIterator iter = {0};
+	rv = sqsh__file_iterator_init(&iter, &file);
+	ASSERT_EQ(0, rv);
+
+	bool has_next = sqsh_file_iterator_next(&iter, 1, &rv);
+	ASSERT_EQ(0, rv);
+	ASSERT_EQ(true, has_next);
+	ASSERT_EQ((size_t)1000, sqsh_file_iterator_size(&iter));
+
+	/* skip from the first chunk into the last block */
+	offset = 2 * BLOCK_SIZE + 1;
+	rv = sqsh_file_iterator_skip2(&iter, &offset, 1);
+	ASSERT_EQ(0, rv);
+	ASSERT_EQ((uint64_t)1, offset);
+	ASSERT_EQ((size_t)3, sqsh_file_iterator_size(&iter));
+	ASSERT_EQ(8, sqsh_file_iterator_data(&iter)[offset]);
+	sqsh__file_iterator_cleanup(&iter);
+
+	/* skip from a fresh iterator into the sparse tail of the second block */
+	rv = sqsh__file_iterator_init(&iter, &file);
+	ASSERT_EQ(0, rv);
+	offset = BLOCK_SIZE + 100;
+	rv = sqsh_file_iterator_skip2(&iter, &offset, 1);
+	ASSERT_EQ(0, rv);
+	ASSERT_EQ((uint64_t)95, offset);
+	ASSERT_EQ(true, sqsh_file_iterator_is_zero_block(&iter));
+	ASSERT_EQ(0, sqsh_file_iterator_data(&iter)[offset]);
+
+	/* skip past the end of the file */
+	offset = 3 * BLOCK_SIZE;
+	rv = sqsh_file_iterator_skip2(&iter, &offset, 1);
+	ASSERT_EQ(-SQSH_ERROR_OUT_OF_BOUNDS, rv);
+
+	sqsh__file_iterator_cleanup(&iter);
+	sqsh__file_cleanup(&file);
+	sqsh__archive_cleanup(&archive);
+}
+
 DECLARE_TESTS
 TEST(load_segment_from_compressed_data_block)
 TEST(load_two_segments_from_uncompressed_data_blockm)
@@ -598,4 +677,5 @@ TEST(load_zero_block)
 TEST(load_two_zero_blocks)
 TEST(load_two_sparse_blocks)
 TEST(open_directory_with_file_iterator)
+TEST(skip_with_block_offset_index)
 END_TESTS
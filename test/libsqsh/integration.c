@@ -167,6 +167,14 @@ sqsh_ls(void) {
 	ASSERT_EQ(0, strcmp("large_dir", name));
 	free(name);
 
+	has_next = sqsh_directory_iterator_next(iter, &rv);
+	ASSERT_EQ(0, rv);
+	ASSERT_EQ(true, has_next);
+	name = sqsh_directory_iterator_name_dup(iter);
+	ASSERT_NE(NULL, name);
+	ASSERT_EQ(0, strcmp("mt", name));
+	free(name);
+
 	has_next = sqsh_directory_iterator_next(iter, &rv);
 	// End of file list
 	ASSERT_EQ(0, rv);
@@ -617,7 +625,8 @@ test_follow_symlink(void) {
 	ASSERT_EQ(0, strcmp(dir_list[0], "a"));
 	ASSERT_EQ(0, strcmp(dir_list[1], "b"));
 	ASSERT_EQ(0, strcmp(dir_list[2], "large_dir"));
-	ASSERT_EQ(NULL, dir_list[3]);
+	ASSERT_EQ(0, strcmp(dir_list[3], "mt"));
+	ASSERT_EQ(NULL, dir_list[4]);
 	free(dir_list);
 
 	rv = sqsh__archive_cleanup(&sqsh);
@@ -699,6 +708,43 @@ test_tree_traversal(void) {
 					SQSH_TREE_TRAVERSAL_STATE_DIRECTORY_END,
 			sqsh_tree_traversal_state(traversal));
 
+	has_next = sqsh_tree_traversal_next(traversal, &rv);
+	ASSERT_EQ(0, rv);
+	ASSERT_EQ(true, has_next);
+	name = sqsh_tree_traversal_name(traversal, &size);
+	ASSERT_STREQS("mt", name, size);
+	ASSERT_EQ(
+			SQSH_TREE_TRAVERSAL_STATE_DIRECTORY_BEGIN,
+			sqsh_tree_traversal_state(traversal));
+
+	has_next = sqsh_tree_traversal_next(traversal, &rv);
+	ASSERT_EQ(0, rv);
+	ASSERT_EQ(true, has_next);
+	name = sqsh_tree_traversal_name(traversal, &size);
+	ASSERT_STREQS("many_batches", name, size);
+	ASSERT_EQ(
+			SQSH_TREE_TRAVERSAL_STATE_FILE,
+			sqsh_tree_traversal_state(traversal));
+
+	has_next = sqsh_tree_traversal_next(traversal, &rv);
+	ASSERT_EQ(0, rv);
+	ASSERT_EQ(true, has_next);
+	name = sqsh_tree_traversal_name(traversal, &size);
+	ASSERT_STREQS("sparse_tail", name, size);
+	ASSERT_EQ(
+			SQSH_TREE_TRAVERSAL_STATE_FILE,
+			sqsh_tree_traversal_state(traversal));
+
+	has_next = sqsh_tree_traversal_next(traversal, &rv);
+	ASSERT_EQ(0, rv);
+	ASSERT_EQ(true, has_next);
+	name = sqsh_tree_traversal_name(traversal, &size);
+	ASSERT_STREQS("mt", name, size);
+	ASSERT_EQ(
+			(enum SqshTreeTraversalState)
+					SQSH_TREE_TRAVERSAL_STATE_DIRECTORY_END,
+			sqsh_tree_traversal_state(traversal));
+
 	has_next = sqsh_tree_traversal_next(traversal, &rv);
 	ASSERT_EQ(0, rv);
 	ASSERT_EQ(true, has_next);
@@ -821,6 +867,82 @@ test_mmap(void) {
 	ASSERT_EQ(0, rv);
 }
 
+static void
+test_mmap_advise(void) {
+	int rv;
+	struct SqshArchive sqsh = {0};
+	struct SqshFile *file = NULL;
+
+	struct SqshConfig config = {
+			.source_mapper = sqsh_mapper_impl_mmap,
+			.archive_offset = 1010,
+			.mapper_advice = SQSH_MAPPER_ADVICE_RANDOM |
+					SQSH_MAPPER_ADVICE_POPULATE,
+	};
+	rv = sqsh__archive_init(&sqsh, (char *)INTEGRATION_PATH, &config);
+	ASSERT_EQ(0, rv);
+
+	const struct SqshSuperblock *superblock = sqsh_archive_superblock(&sqsh);
+	const uint64_t metadata_start =
+			sqsh_superblock_inode_table_start(superblock);
+	rv = sqsh_archive_advise(
+			&sqsh, metadata_start,
+			sqsh_superblock_bytes_used(superblock) - metadata_start,
+			SQSH_MAPPER_ADVICE_WILLNEED);
+	ASSERT_EQ(0, rv);
+
+	file = sqsh_open(&sqsh, "/b", &rv);
+	ASSERT_EQ(0, rv);
+	rv = sqsh_file_advise(file, SQSH_MAPPER_ADVICE_SEQUENTIAL);
+	ASSERT_EQ(0, rv);
+
+	uint8_t *content = sqsh_easy_file_content(&sqsh, "/b", &rv);
+	ASSERT_EQ(0, rv);
+	ASSERT_EQ('b', content[0]);
+
+	free(content);
+	rv = sqsh_close(file);
+	ASSERT_EQ(0, rv);
+	rv = sqsh__archive_cleanup(&sqsh);
+	ASSERT_EQ(0, rv);
+}
+
+static void
+test_pread(void) {
+	int rv;
+	struct SqshArchive mmap_archive = {0};
+	struct SqshArchive pread_archive = {0};
+
+	struct SqshConfig config = {
+			.source_mapper = sqsh_mapper_impl_mmap,
+			.archive_offset = 1010,
+	};
+	rv = sqsh__archive_init(&mmap_archive, (char *)INTEGRATION_PATH, &config);
+	ASSERT_EQ(0, rv);
+
+	/* Use a small block size, so that reading the file spans many blocks
+	 * and triggers read ahead. */
+	config.source_mapper = sqsh_mapper_impl_pread;
+	config.mapper_block_size = 4096;
+	rv = sqsh__archive_init(&pread_archive, (char *)INTEGRATION_PATH, &config);
+	ASSERT_EQ(0, rv);
+
+	uint8_t *expected = sqsh_easy_file_content(&mmap_archive, "/b", &rv);
+	ASSERT_EQ(0, rv);
+	uint8_t *content = sqsh_easy_file_content(&pread_archive, "/b", &rv);
+	ASSERT_EQ(0, rv);
+	const uint64_t size = sqsh_easy_file_size2(&mmap_archive, "/b", &rv);
+	ASSERT_EQ(0, rv);
+	ASSERT_EQ(0, memcmp(expected, content, (size_t)size));
+
+	free(expected);
+	free(content);
+	rv = sqsh__archive_cleanup(&pread_archive);
+	ASSERT_EQ(0, rv);
+	rv = sqsh__archive_cleanup(&mmap_archive);
+	ASSERT_EQ(0, rv);
+}
+
 static void
 copy_iterator_newly(void) {
 	int rv;
@@ -916,6 +1038,124 @@ iterator_mt_collect(
 	d->blocks++;
 }
 
+static void
+dup_iterator_keeps_data(void) {
+	int rv;
+	struct SqshArchive sqsh = {0};
+	struct SqshFile *file = NULL;
+	struct SqshFileIterator *iter = NULL;
+	struct SqshFileIterator *dups[32] = {0};
+	size_t dup_count = 0;
+
+	struct SqshConfig config = DEFAULT_CONFIG(TEST_SQUASHFS_IMAGE_LEN);
+	config.archive_offset = 1010;
+	rv = sqsh__archive_init(&sqsh, (char *)TEST_SQUASHFS_IMAGE, &config);
+	ASSERT_EQ(0, rv);
+
+	file = sqsh_open(&sqsh, "/b", &rv);
+	ASSERT_EQ(0, rv);
+
+	uint8_t *expected = sqsh_easy_file_content(&sqsh, "/b", &rv);
+	ASSERT_EQ(0, rv);
+
+	iter = sqsh_file_iterator_new(file, &rv);
+	ASSERT_EQ(0, rv);
+
+	while (sqsh_file_iterator_next(iter, 1, &rv)) {
+		ASSERT_LT(dup_count, sizeof(dups) / sizeof(dups[0]));
+		dups[dup_count] = sqsh_file_iterator_dup(iter, &rv);
+		ASSERT_EQ(0, rv);
+		ASSERT_EQ(
+				sqsh_file_iterator_size(iter),
+				sqsh_file_iterator_size(dups[dup_count]));
+		dup_count++;
+	}
+	ASSERT_EQ(0, rv);
+	rv = sqsh_file_iterator_free(iter);
+	ASSERT_EQ(0, rv);
+
+	size_t offset = 0;
+	for (size_t i = 0; i < dup_count; i++) {
+		const uint8_t *data = sqsh_file_iterator_data(dups[i]);
+		const size_t size = sqsh_file_iterator_size(dups[i]);
+		ASSERT_EQ(0, memcmp(&expected[offset], data, size));
+		offset += size;
+		rv = sqsh_file_iterator_free(dups[i]);
+		ASSERT_EQ(0, rv);
+	}
+	ASSERT_EQ(sqsh_file_size(file), offset);
+
+	free(expected);
+	rv = sqsh_close(file);
+	ASSERT_EQ(0, rv);
+
+	rv = sqsh__archive_cleanup(&sqsh);
+	ASSERT_EQ(0, rv);
+}
+
+static void
+file_read_into(void) {
+	int rv;
+	struct SqshArchive sqsh = {0};
+	struct SqshFile *file = NULL;
+	struct SqshFileIterator *iter = NULL;
+
+	struct SqshConfig config = DEFAULT_CONFIG(TEST_SQUASHFS_IMAGE_LEN);
+	config.archive_offset = 1010;
+	rv = sqsh__archive_init(&sqsh, (char *)TEST_SQUASHFS_IMAGE, &config);
+	ASSERT_EQ(0, rv);
+
+	file = sqsh_open(&sqsh, "/b", &rv);
+	ASSERT_EQ(0, rv);
+	const size_t file_size = sqsh_file_size(file);
+	const size_t block_size =
+			sqsh_superblock_block_size(sqsh_archive_superblock(&sqsh));
+
+	uint8_t *expected = calloc(file_size, 1);
+	ASSERT_NE(NULL, expected);
+	iter = sqsh_file_iterator_new(file, &rv);
+	ASSERT_EQ(0, rv);
+	size_t pos = 0;
+	while (sqsh_file_iterator_next(iter, SIZE_MAX, &rv)) {
+		const size_t size = sqsh_file_iterator_size(iter);
+		memcpy(&expected[pos], sqsh_file_iterator_data(iter), size);
+		pos += size;
+	}
+	ASSERT_EQ(0, rv);
+	ASSERT_EQ(file_size, pos);
+	rv = sqsh_file_iterator_free(iter);
+	ASSERT_EQ(0, rv);
+
+	uint8_t *content = calloc(file_size, 1);
+	ASSERT_NE(NULL, content);
+
+	/* Ranges that start and end in the middle of a block */
+	const size_t offsets[] = {
+			0, 1, block_size - 1, block_size, block_size + 1, file_size / 2};
+	for (size_t i = 0; i < sizeof(offsets) / sizeof(offsets[0]); i++) {
+		const size_t offset = offsets[i];
+		ASSERT_LT(offset, file_size);
+		const size_t sizes[] = {file_size - offset, (file_size - offset) / 3};
+		for (size_t j = 0; j < sizeof(sizes) / sizeof(sizes[0]); j++) {
+			memset(content, 0xAA, file_size);
+			rv = sqsh_file_read_into(file, offset, content, sizes[j]);
+			ASSERT_EQ(0, rv);
+			ASSERT_EQ(0, memcmp(&expected[offset], content, sizes[j]));
+		}
+	}
+
+	rv = sqsh_file_read_into(file, file_size - 1, content, 2);
+	ASSERT_EQ(-SQSH_ERROR_OUT_OF_BOUNDS, rv);
+
+	free(content);
+	free(expected);
+	rv = sqsh_close(file);
+	ASSERT_EQ(0, rv);
+
+	rv = sqsh__archive_cleanup(&sqsh);
+	ASSERT_EQ(0, rv);
+}
+
 static void
 file_iterator_mt_basic(void) {
 	int rv;
@@ -959,6 +1199,280 @@ file_iterator_mt_basic(void) {
 	ASSERT_EQ(0, rv);
 }
 
+struct MtCompareData {
+	pthread_mutex_t lock;
+	uint8_t *buf;
+	size_t size;
+	size_t processed;
+	int err;
+};
+
+static void
+iterator_mt_compare_collect(
+		const struct SqshFile *file, const struct SqshFileIterator *iter,
+		uint64_t offset, void *data, int err) {
+	(void)file;
+	struct MtCompareData *d = data;
+	if (iter == NULL) {
+		d->err = err;
+		return;
+	}
+
+	const uint8_t *block_data = sqsh_file_iterator_data(iter);
+	size_t block_size = sqsh_file_iterator_size(iter);
+	pthread_mutex_lock(&d->lock);
+	if (offset + block_size <= d->size) {
+		memcpy(d->buf + offset, block_data, block_size);
+	}
+	d->processed += block_size;
+	pthread_mutex_unlock(&d->lock);
+}
+
+/* Runs sqsh_file_iterator_mt() on a file and compares the result with the
+ * content read by the sequential iterator. */
+static void
+iterator_mt_compare(const char *path, uint64_t *block_count) {
+	int rv;
+	struct SqshArchive sqsh = {0};
+	struct SqshThreadpool *tp = NULL;
+	struct SqshFile *file = NULL;
+	struct SqshFileIterator *iter = NULL;
+
+	struct SqshConfig config = DEFAULT_CONFIG(TEST_SQUASHFS_IMAGE_LEN);
+	config.archive_offset = 1010;
+	rv = sqsh__archive_init(&sqsh, (char *)TEST_SQUASHFS_IMAGE, &config);
+	ASSERT_EQ(0, rv);
+
+	tp = sqsh_threadpool_new(4, &rv);
+	ASSERT_TRUE(tp != NULL);
+	ASSERT_EQ(0, rv);
+
+	file = sqsh_open(&sqsh, path, &rv);
+	ASSERT_EQ(0, rv);
+	*block_count = sqsh_file_block_count2(file);
+
+	const size_t size = sqsh_file_size(file);
+	uint8_t *expected = calloc(size, 1);
+	ASSERT_NE(NULL, expected);
+	size_t expected_size = 0;
+	iter = sqsh_file_iterator_new(file, &rv);
+	ASSERT_EQ(0, rv);
+	while (sqsh_file_iterator_next(iter, SIZE_MAX, &rv)) {
+		const size_t chunk_size = sqsh_file_iterator_size(iter);
+		ASSERT_TRUE(expected_size + chunk_size <= size);
+		memcpy(expected + expected_size, sqsh_file_iterator_data(iter),
+			   chunk_size);
+		expected_size += chunk_size;
+	}
+	ASSERT_EQ(0, rv);
+	ASSERT_EQ(size, expected_size);
+	rv = sqsh_file_iterator_free(iter);
+	ASSERT_EQ(0, rv);
+
+	struct MtCompareData data = {0};
+	pthread_mutex_init(&data.lock, NULL);
+	data.size = size;
+	data.buf = malloc(size);
+	ASSERT_NE(NULL, data.buf);
+	/* Poison the buffer so that chunks that are never delivered, like a
+	 * dropped sparse tail, do not compare equal by accident. */
+	memset(data.buf, 0xaa, size);
+
+	rv = sqsh_file_iterator_mt(file, tp, iterator_mt_compare_collect, &data);
+	ASSERT_EQ(0, rv);
+	rv = sqsh_threadpool_wait(tp);
+	ASSERT_EQ(0, rv);
+
+	ASSERT_EQ(0, data.err);
+	ASSERT_EQ(size, data.processed);
+	ASSERT_EQ(0, memcmp(expected, data.buf, size));
+
+	pthread_mutex_destroy(&data.lock);
+	free(data.buf);
+	free(expected);
+	rv = sqsh_threadpool_free(tp);
+	ASSERT_EQ(0, rv);
+
+	rv = sqsh_close(file);
+	ASSERT_EQ(0, rv);
+
+	rv = sqsh__archive_cleanup(&sqsh);
+	ASSERT_EQ(0, rv);
+}
+
+static void
+file_iterator_mt_sparse_tail(void) {
+	uint64_t block_count = 0;
+
+	/* The file consists of four full blocks, the last two are sparse. */
+	iterator_mt_compare("/mt/sparse_tail", &block_count);
+	ASSERT_EQ((uint64_t)4, block_count);
+}
+
+static void
+file_iterator_mt_many_batches(void) {
+	uint64_t block_count = 0;
+
+	/* More blocks than 32 batches of 8 blocks each. */
+	iterator_mt_compare("/mt/many_batches", &block_count);
+	ASSERT_GT(block_count, (uint64_t)32 * 8);
+}
+
+static void
+file_iterator_readahead(void) {
+	int rv;
+	struct SqshArchive sqsh = {0};
+	struct SqshThreadpool *tp = NULL;
+	struct SqshFile *file = NULL;
+	struct SqshFileIterator *iterator = NULL;
+
+	struct SqshConfig config = DEFAULT_CONFIG(TEST_SQUASHFS_IMAGE_LEN);
+	config.archive_offset = 1010;
+	rv = sqsh__archive_init(&sqsh, (char *)TEST_SQUASHFS_IMAGE, &config);
+	ASSERT_EQ(0, rv);
+
+	tp = sqsh_threadpool_new(4, &rv);
+	ASSERT_TRUE(tp != NULL);
+	ASSERT_EQ(0, rv);
+
+	file = sqsh_open(&sqsh, "/b", &rv);
+	ASSERT_EQ(0, rv);
+
+	uint8_t *expected = sqsh_easy_file_content(&sqsh, "/b", &rv);
+	ASSERT_EQ(0, rv);
+	const size_t file_size = sqsh_file_size(file);
+
+	iterator = sqsh_file_iterator_new(file, &rv);
+	ASSERT_EQ(0, rv);
+	rv = sqsh_file_iterator_readahead(iterator, tp, 4);
+	ASSERT_EQ(0, rv);
+
+	size_t offset = 0;
+	while (sqsh_file_iterator_next(iterator, SIZE_MAX, &rv)) {
+		const uint8_t *data = sqsh_file_iterator_data(iterator);
+		const size_t size = sqsh_file_iterator_size(iterator);
+		ASSERT_LT(offset, file_size + 1);
+		ASSERT_EQ(0, memcmp(&expected[offset], data, size));
+		offset += size;
+	}
+	ASSERT_EQ(0, rv);
+	ASSERT_EQ(file_size, offset);
+
+	rv = sqsh_file_iterator_free(iterator);
+	ASSERT_EQ(0, rv);
+	rv = sqsh_threadpool_wait(tp);
+	ASSERT_EQ(0, rv);
+	rv = sqsh_threadpool_free(tp);
+	ASSERT_EQ(0, rv);
+
+	free(expected);
+	rv = sqsh_close(file);
+	ASSERT_EQ(0, rv);
+
+	rv = sqsh__archive_cleanup(&sqsh);
+	ASSERT_EQ(0, rv);
+}
+
+static void
+file_to_stream_ordered_cb(
+		const struct SqshFile *file, FILE *stream, void *data, int err) {
+	(void)file;
+	(void)stream;
+	*(int *)data = err;
+}
+
+static void
+file_to_stream_ordered_mt(void) {
+	int rv;
+	struct SqshArchive sqsh = {0};
+	struct SqshThreadpool *tp = NULL;
+	struct SqshFile *file = NULL;
+
+	struct SqshConfig config = DEFAULT_CONFIG(TEST_SQUASHFS_IMAGE_LEN);
+	config.archive_offset = 1010;
+	rv = sqsh__archive_init(&sqsh, (char *)TEST_SQUASHFS_IMAGE, &config);
+	ASSERT_EQ(0, rv);
+
+	tp = sqsh_threadpool_new(4, &rv);
+	ASSERT_TRUE(tp != NULL);
+	ASSERT_EQ(0, rv);
+
+	file = sqsh_open(&sqsh, "/b", &rv);
+	ASSERT_EQ(0, rv);
+
+	uint8_t *expected = sqsh_easy_file_content(&sqsh, "/b", &rv);
+	ASSERT_EQ(0, rv);
+	const size_t file_size = sqsh_file_size(file);
+
+	FILE *stream = tmpfile();
+	ASSERT_NE(NULL, stream);
+
+	int cb_rv = 1;
+	rv = sqsh_file_to_stream_ordered_mt(
+			file, tp, stream, file_to_stream_ordered_cb, &cb_rv);
+	ASSERT_EQ(0, rv);
+	rv = sqsh_threadpool_wait(tp);
+	ASSERT_EQ(0, rv);
+	ASSERT_EQ(0, cb_rv);
+
+	uint8_t *written = calloc(file_size, 1);
+	ASSERT_NE(NULL, written);
+	rewind(stream);
+	ASSERT_EQ(file_size, fread(written, 1, file_size, stream));
+	ASSERT_EQ(EOF, fgetc(stream));
+	ASSERT_EQ(0, memcmp(expected, written, file_size));
+
+	free(written);
+	fclose(stream);
+	free(expected);
+	rv = sqsh_threadpool_free(tp);
+	ASSERT_EQ(0, rv);
+
+	rv = sqsh_close(file);
+	ASSERT_EQ(0, rv);
+
+	rv = sqsh__archive_cleanup(&sqsh);
+	ASSERT_EQ(0, rv);
+}
+
+static void
+easy_file_content_mt(void) {
+	int rv;
+	struct SqshArchive sqsh = {0};
+	struct SqshThreadpool *tp = NULL;
+
+	struct SqshConfig config = DEFAULT_CONFIG(TEST_SQUASHFS_IMAGE_LEN);
+	config.archive_offset = 1010;
+	rv = sqsh__archive_init(&sqsh, (char *)TEST_SQUASHFS_IMAGE, &config);
+	ASSERT_EQ(0, rv);
+
+	tp = sqsh_threadpool_new(4, &rv);
+	ASSERT_TRUE(tp != NULL);
+	ASSERT_EQ(0, rv);
+
+	const size_t file_size = (size_t)sqsh_easy_file_size2(&sqsh, "/b", &rv);
+	ASSERT_EQ(0, rv);
+	uint8_t *expected = sqsh_easy_file_content(&sqsh, "/b", &rv);
+	ASSERT_EQ(0, rv);
+
+	uint8_t *content = sqsh_easy_file_content_mt(&sqsh, "/b", tp, &rv);
+	ASSERT_EQ(0, rv);
+	ASSERT_NE(NULL, content);
+	ASSERT_EQ(0, memcmp(expected, content, file_size));
+	free(content);
+
+	content = sqsh_easy_file_content_mt(&sqsh, "/", tp, &rv);
+	ASSERT_EQ(-SQSH_ERROR_NOT_A_FILE, rv);
+	ASSERT_EQ(NULL, content);
+
+	free(expected);
+	rv = sqsh_threadpool_free(tp);
+	ASSERT_EQ(0, rv);
+
+	rv = sqsh__archive_cleanup(&sqsh);
+	ASSERT_EQ(0, rv);
+}
+
 DECLARE_TESTS
 TEST(sqsh_empty)
 TEST(sqsh_get_nonexistant)
@@ -981,7 +1495,16 @@ TEST(test_tree_traversal)
 TEST(test_easy_traversal)
 TEST(test_traversal_zero_max_depth)
 TEST(test_mmap)
+TEST(test_mmap_advise)
+TEST(test_pread)
 TEST(copy_iterator_newly)
 TEST(copy_iterator_iterated)
+TEST(dup_iterator_keeps_data)
+TEST(file_read_into)
 TEST(file_iterator_mt_basic)
+TEST(file_iterator_mt_sparse_tail)
+TEST(file_iterator_mt_many_batches)
+TEST(file_iterator_readahead)
+TEST(file_to_stream_ordered_mt)
+TEST(easy_file_content_mt)
 END_TESTS
@@ -14,6 +14,9 @@ cat > $tmp/pf <<EOF
 "b" F 0 777 2020 202020 seq 1 1050000 | head -1050000 | tr -cd "\n" | tr '\n' b
 "large_dir" D 0 777 2020 202020
 "large_dir/link" s 777 2020 202020 ..
+"mt" D 0 777 2020 202020
+"mt/many_batches" F 0 777 2020 202020 yes abcdefgh | head -c 34603008
+"mt/sparse_tail" F 0 777 2020 202020 seq 1 30000 | cat - /dev/zero | head -c 524288
 EOF
 if [ `uname` != "OpenBSD" ] && [ `uname` != "FreeBSD" ]; then
 	cat >> $tmp/pf <<EOF
@@ -0,0 +1,397 @@
+/*
+ * BSD 2-Clause License
+ *
+ * Copyright (c) 2023, Enno Boland
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @author       Enno Boland (mail@eboland.de)
+ * @file         curl_mapper.c
+ *
+ * These tests are run by http_server.py, which serves CONTENT_SIZE bytes
+ * over HTTP and injects the faults that are selected by the query string of
+ * the request.
+ */
+
+#define _DEFAULT_SOURCE
+
+#include "../common.h"
+#include <testlib.h>
+
+#include <sqsh_error.h>
+#include <sqsh_mapper_private.h>
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Keep in sync with test/libsqsh/mapper/http_server.py */
+#define CONTENT_SIZE (1024 * 1024)
+#define BLOCK_SIZE 4096
+#define MAX_REQUESTS 64
+
+struct RequestLog {
+	size_t count;
+	char kind[MAX_REQUESTS][8];
+	uint64_t first[MAX_REQUESTS];
+	uint64_t last[MAX_REQUESTS];
+};
+
+static void
+read_request_log(const char *name, struct RequestLog *log) {
+	char path[4096];
+	const char *log_dir = getenv("SQSH_TEST_HTTP_LOG");
+	assert(log_dir != NULL);
+
+	memset(log, 0, sizeof(*log));
+	snprintf(path, sizeof(path), "%s/%s.log", log_dir, name);
+	FILE *file = fopen(path, "r");
+	if (file == NULL) {
+		return;
+	}
+	while (log->count < MAX_REQUESTS &&
+		   fscanf(file, "%7s %" SCNu64 " %" SCNu64, log->kind[log->count],
+				  &log->first[log->count], &log->last[log->count]) == 3) {
+		log->count++;
+	}
+	fclose(file);
+}
+
+static int
+init_mapper(
+		struct SqshMapper *mapper, struct SqshConfig *config,
+		const char *name, const char *query) {
+	char url[4096];
+	const char *server_url = getenv("SQSH_TEST_HTTP_URL");
+	assert(server_url != NULL);
+
+	snprintf(url, sizeof(url), "%s/%s?%s", server_url, name, query);
+	config->source_mapper = sqsh_mapper_impl_curl;
+	config->mapper_block_size = BLOCK_SIZE;
+	return sqsh__mapper_init(mapper, url, config);
+}
+
+static void
+assert_block(struct SqshMapper *mapper, uint64_t index) {
+	int rv;
+	struct SqshMapSlice slice = {0};
+	const uint64_t offset = index * BLOCK_SIZE;
+
+	rv = sqsh__map_slice_init(&slice, mapper, index, offset, BLOCK_SIZE);
+	ASSERT_EQ(0, rv);
+	const uint8_t *data = sqsh__map_slice_data(&slice);
+	for (size_t i = 0; i < BLOCK_SIZE; i++) {
+		ASSERT_EQ((uint8_t)((offset + i) % 251), data[i]);
+	}
+	rv = sqsh__map_slice_cleanup(&slice);
+	ASSERT_EQ(0, rv);
+}
+
+static void
+assert_request(
+		const struct RequestLog *log, size_t index, const char *kind,
+		uint64_t first_block, uint64_t block_count) {
+	ASSERT_LT(index, log->count);
+	ASSERT_EQ(0, strcmp(kind, log->kind[index]));
+	ASSERT_EQ(first_block * BLOCK_SIZE, log->first[index]);
+	ASSERT_EQ(
+			(first_block + block_count) * BLOCK_SIZE - 1, log->last[index]);
+}
+
+static void
+curl_mapper__download(void) {
+	int rv;
+	struct SqshMapper mapper = {0};
+	struct SqshConfig config = {0};
+	struct RequestLog log;
+
+	rv = init_mapper(&mapper, &config, "download", "");
+	ASSERT_EQ(0, rv);
+	ASSERT_EQ((uint64_t)CONTENT_SIZE, sqsh_mapper_size2(&mapper));
+	assert_block(&mapper, 0);
+
+	read_request_log("download", &log);
+	ASSERT_EQ((size_t)1, log.count);
+	assert_request(&log, 0, "ok", 0, 1);
+
+	sqsh__mapper_cleanup(&mapper);
+}
+
+static void
+curl_mapper__retry_server_error(void) {
+	int rv;
+	struct SqshMapper mapper = {0};
+	struct SqshConfig config = {0};
+	struct RequestLog log;
+
+	rv = init_mapper(&mapper, &config, "retry_server_error", "fail=2");
+	ASSERT_EQ(0, rv);
+	assert_block(&mapper, 0);
+
+	read_request_log("retry_server_error", &log);
+	ASSERT_EQ((size_t)3, log.count);
+	assert_request(&log, 0, "fail", 0, 1);
+	assert_request(&log, 1, "fail", 0, 1);
+	assert_request(&log, 2, "ok", 0, 1);
+
+	sqsh__mapper_cleanup(&mapper);
+}
+
+static void
+curl_mapper__retry_dropped_connection(void) {
+	int rv;
+	struct SqshMapper mapper = {0};
+	struct SqshConfig config = {0};
+	struct RequestLog log;
+
+	rv = init_mapper(&mapper, &config, "retry_dropped", "drop=1");
+	ASSERT_EQ(0, rv);
+	assert_block(&mapper, 0);
+
+	read_request_log("retry_dropped", &log);
+	ASSERT_EQ((size_t)2, log.count);
+	assert_request(&log, 0, "drop", 0, 1);
+	assert_request(&log, 1, "ok", 0, 1);
+
+	sqsh__mapper_cleanup(&mapper);
+}
+
+static void
+curl_mapper__retry_exhausted(void) {
+	int rv;
+	struct SqshMapper mapper = {0};
+	struct SqshConfig config = {.mapper_retries = 2};
+	struct RequestLog log;
+
+	rv = init_mapper(&mapper, &config, "retry_exhausted", "fail=10");
+	ASSERT_EQ(-SQSH_ERROR_MAPPER_MAP, rv);
+
+	read_request_log("retry_exhausted", &log);
+	ASSERT_EQ((size_t)3, log.count);
+
+	sqsh__mapper_cleanup(&mapper);
+}
+
+static void
+curl_mapper__no_retry_client_error(void) {
+	int rv;
+	struct SqshMapper mapper = {0};
+	struct SqshConfig config = {0};
+	struct RequestLog log;
+
+	rv = init_mapper(
+			&mapper, &config, "no_retry_client_error",
+			"fail=10&fail_status=404");
+	ASSERT_EQ(-SQSH_ERROR_MAPPER_MAP, rv);
+
+	read_request_log("no_retry_client_error", &log);
+	ASSERT_EQ((size_t)1, log.count);
+
+	sqsh__mapper_cleanup(&mapper);
+}
+
+static void
+curl_mapper__retry_timeout(void) {
+	int rv;
+	struct SqshMapper mapper = {0};
+	struct SqshConfig config = {.mapper_timeout_ms = 200};
+	struct RequestLog log;
+
+	rv = init_mapper(&mapper, &config, "retry_timeout", "stall=2000");
+	ASSERT_EQ(0, rv);
+	assert_block(&mapper, 0);
+
+	read_request_log("retry_timeout", &log);
+	ASSERT_EQ((size_t)2, log.count);
+	assert_request(&log, 0, "stall", 0, 1);
+	assert_request(&log, 1, "ok", 0, 1);
+
+	sqsh__mapper_cleanup(&mapper);
+}
+
+static void
+curl_mapper__hedge(void) {
+	int rv;
+	struct SqshMapper mapper = {0};
+	struct SqshConfig config = {.mapper_hedge_ms = 100, .mapper_retries = -1};
+	struct RequestLog log;
+
+	/* The stalled request would succeed eventually, but the hedged request
+	 * completes first. Retries are disabled, so this only succeeds without
+	 * waiting for the timeout if the hedged request is used. */
+	rv = init_mapper(&mapper, &config, "hedge", "stall=5000");
+	ASSERT_EQ(0, rv);
+	assert_block(&mapper, 0);
+
+	read_request_log("hedge", &log);
+	ASSERT_EQ((size_t)2, log.count);
+	assert_request(&log, 0, "stall", 0, 1);
+	assert_request(&log, 1, "ok", 0, 1);
+
+	sqsh__mapper_cleanup(&mapper);
+}
+
+static void
+curl_mapper__sequential_coalescing(void) {
+	int rv;
+	struct SqshMapper mapper = {0};
+	struct SqshConfig config = {0};
+	struct RequestLog log;
+
+	rv = init_mapper(&mapper, &config, "sequential", "");
+	ASSERT_EQ(0, rv);
+
+	for (uint64_t i = 0; i < 31; i++) {
+		assert_block(&mapper, i);
+	}
+
+	/* Each sequential miss doubles the number of blocks fetched with one
+	 * request. Blocks in between are served from the prefetched chunks. */
+	read_request_log("sequential", &log);
+	ASSERT_EQ((size_t)5, log.count);
+	assert_request(&log, 0, "ok", 0, 1);
+	assert_request(&log, 1, "ok", 1, 2);
+	assert_request(&log, 2, "ok", 3, 4);
+	assert_request(&log, 3, "ok", 7, 8);
+	assert_request(&log, 4, "ok", 15, 16);
+
+	sqsh__mapper_cleanup(&mapper);
+}
+
+static void
+curl_mapper__random_access(void) {
+	int rv;
+	struct SqshMapper mapper = {0};
+	struct SqshConfig config = {0};
+	struct RequestLog log;
+
+	rv = init_mapper(&mapper, &config, "random", "");
+	ASSERT_EQ(0, rv);
+
+	for (uint64_t i = 0; i < 4; i++) {
+		assert_block(&mapper, i);
+	}
+	/* Blocks 4 to 6 are prefetched now. A jump resets the request size to a
+	 * single block. */
+	assert_block(&mapper, 100);
+	assert_block(&mapper, 101);
+	/* Jumping back to a prefetched block does not issue a request. */
+	assert_block(&mapper, 5);
+	assert_block(&mapper, 6);
+	/* Block 7 was never fetched. The jump to block 5 reset the request
+	 * size, so only blocks 7 and 8 are requested. */
+	assert_block(&mapper, 7);
+
+	read_request_log("random", &log);
+	ASSERT_EQ((size_t)6, log.count);
+	assert_request(&log, 0, "ok", 0, 1);
+	assert_request(&log, 1, "ok", 1, 2);
+	assert_request(&log, 2, "ok", 3, 4);
+	assert_request(&log, 3, "ok", 100, 1);
+	assert_request(&log, 4, "ok", 101, 2);
+	assert_request(&log, 5, "ok", 7, 2);
+
+	sqsh__mapper_cleanup(&mapper);
+}
+
+struct StalledMap {
+	struct SqshMapper *mapper;
+	atomic_bool finished;
+};
+
+static void *
+stalled_map(void *data) {
+	struct StalledMap *stalled = data;
+	assert_block(stalled->mapper, 100);
+	atomic_store(&stalled->finished, true);
+	return NULL;
+}
+
+static void
+curl_mapper__parallel_transfers(void) {
+	int rv;
+	struct SqshMapper mapper = {0};
+	struct SqshConfig config = {0};
+	struct RequestLog log;
+	struct StalledMap stalled = {.mapper = &mapper};
+	pthread_t thread;
+	char query[64];
+
+	snprintf(
+			query, sizeof(query), "stall=2000&stall_offset=%d",
+			100 * BLOCK_SIZE);
+	rv = init_mapper(&mapper, &config, "parallel", query);
+	ASSERT_EQ(0, rv);
+
+	atomic_init(&stalled.finished, false);
+	rv = pthread_create(&thread, NULL, stalled_map, &stalled);
+	ASSERT_EQ(0, rv);
+
+	/* Wait until the server received the stalled request. */
+	for (int i = 0; i < 500; i++) {
+		read_request_log("parallel", &log);
+		if (log.count == 2) {
+			break;
+		}
+		usleep(10000);
+	}
+	ASSERT_EQ((size_t)2, log.count);
+
+	/* Another block can be mapped while the stalled transfer is still
+	 * running. */
+	assert_block(&mapper, 200);
+	ASSERT_EQ(false, atomic_load(&stalled.finished));
+
+	rv = pthread_join(thread, NULL);
+	ASSERT_EQ(0, rv);
+	ASSERT_EQ(true, atomic_load(&stalled.finished));
+
+	read_request_log("parallel", &log);
+	ASSERT_EQ((size_t)3, log.count);
+	assert_request(&log, 0, "ok", 0, 1);
+	assert_request(&log, 1, "stall", 100, 1);
+	assert_request(&log, 2, "ok", 200, 1);
+
+	sqsh__mapper_cleanup(&mapper);
+}
+
+DECLARE_TESTS
+TEST(curl_mapper__download)
+TEST(curl_mapper__retry_server_error)
+TEST(curl_mapper__retry_dropped_connection)
+TEST(curl_mapper__retry_exhausted)
+TEST(curl_mapper__no_retry_client_error)
+TEST(curl_mapper__retry_timeout)
+TEST(curl_mapper__hedge)
+TEST(curl_mapper__sequential_coalescing)
+TEST(curl_mapper__random_access)
+TEST(curl_mapper__parallel_transfers)
+END_TESTS
@@ -0,0 +1,169 @@
+/*
+ * BSD 2-Clause License
+ *
+ * Copyright (c) 2023, Enno Boland
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @author       Enno Boland (mail@eboland.de)
+ * @file         disk_cache.c
+ */
+
+#define _DEFAULT_SOURCE
+
+#include "../common.h"
+#include <testlib.h>
+
+#include <sqsh_mapper_private.h>
+
+#include <dirent.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static void
+remove_cache_dir(const char *path) {
+	DIR *dir = opendir(path);
+	struct dirent *dirent;
+	char entry[4096];
+
+	assert(dir != NULL);
+	while ((dirent = readdir(dir)) != NULL) {
+		if (dirent->d_name[0] == '.') {
+			continue;
+		}
+		snprintf(entry, sizeof(entry), "%s/%s", path, dirent->d_name);
+		unlink(entry);
+	}
+	closedir(dir);
+	rmdir(path);
+}
+
+static void
+disk_cache__put_get(void) {
+	int rv;
+	char path[] = "/tmp/sqsh-disk-cache-XXXXXX";
+	struct SqshDiskCache cache = {0};
+	const uint8_t data[] = "THIS IS A TEST STRING";
+	uint8_t target[sizeof(data)] = {0};
+
+	assert(mkdtemp(path) != NULL);
+
+	rv = sqsh__disk_cache_init(&cache, path, "http://example.com/a", 1, 1024);
+	ASSERT_EQ(0, rv);
+
+	ASSERT_EQ(false, sqsh__disk_cache_get(&cache, 0, sizeof(data), target));
+
+	rv = sqsh__disk_cache_put(&cache, 0, sizeof(data), data);
+	ASSERT_EQ(0, rv);
+
+	ASSERT_EQ(true, sqsh__disk_cache_get(&cache, 0, sizeof(data), target));
+	ASSERT_EQ(0, memcmp(data, target, sizeof(data)));
+
+	/* Same offset, different size is a different entry */
+	ASSERT_EQ(false, sqsh__disk_cache_get(&cache, 0, 4, target));
+
+	sqsh__disk_cache_cleanup(&cache);
+	remove_cache_dir(path);
+}
+
+static void
+disk_cache__invalidate_version(void) {
+	int rv;
+	char path[] = "/tmp/sqsh-disk-cache-XXXXXX";
+	struct SqshDiskCache cache = {0};
+	struct SqshDiskCache other = {0};
+	const uint8_t data[] = "THIS IS A TEST STRING";
+	uint8_t target[sizeof(data)] = {0};
+
+	assert(mkdtemp(path) != NULL);
+
+	rv = sqsh__disk_cache_init(&cache, path, "http://example.com/a", 1, 1024);
+	ASSERT_EQ(0, rv);
+	rv = sqsh__disk_cache_put(&cache, 0, sizeof(data), data);
+	ASSERT_EQ(0, rv);
+	sqsh__disk_cache_cleanup(&cache);
+
+	/* Another archive must not see the entry, but must not remove it either */
+	rv = sqsh__disk_cache_init(&other, path, "http://example.com/b", 1, 1024);
+	ASSERT_EQ(0, rv);
+	ASSERT_EQ(false, sqsh__disk_cache_get(&other, 0, sizeof(data), target));
+	sqsh__disk_cache_cleanup(&other);
+
+	rv = sqsh__disk_cache_init(&cache, path, "http://example.com/a", 1, 1024);
+	ASSERT_EQ(0, rv);
+	ASSERT_EQ(true, sqsh__disk_cache_get(&cache, 0, sizeof(data), target));
+	sqsh__disk_cache_cleanup(&cache);
+
+	/* A new version of the archive drops the old entries */
+	rv = sqsh__disk_cache_init(&cache, path, "http://example.com/a", 2, 1024);
+	ASSERT_EQ(0, rv);
+	ASSERT_EQ(false, sqsh__disk_cache_get(&cache, 0, sizeof(data), target));
+	ASSERT_EQ((uint64_t)0, cache.size);
+	sqsh__disk_cache_cleanup(&cache);
+
+	remove_cache_dir(path);
+}
+
+static void
+disk_cache__evict(void) {
+	int rv;
+	char path[] = "/tmp/sqsh-disk-cache-XXXXXX";
+	struct SqshDiskCache cache = {0};
+	uint8_t data[100] = {0};
+
+	assert(mkdtemp(path) != NULL);
+
+	rv = sqsh__disk_cache_init(&cache, path, "http://example.com/a", 1, 250);
+	ASSERT_EQ(0, rv);
+
+	for (uint64_t i = 0; i < 10; i++) {
+		rv = sqsh__disk_cache_put(&cache, i * sizeof(data), sizeof(data), data);
+		ASSERT_EQ(0, rv);
+		ASSERT_LT(cache.size, (uint64_t)251);
+	}
+
+	size_t hits = 0;
+	for (uint64_t i = 0; i < 10; i++) {
+		if (sqsh__disk_cache_get(
+					&cache, i * sizeof(data), sizeof(data), data)) {
+			hits++;
+		}
+	}
+	ASSERT_LT((size_t)0, hits);
+	ASSERT_LT(hits, (size_t)3);
+
+	sqsh__disk_cache_cleanup(&cache);
+	remove_cache_dir(path);
+}
+
+DECLARE_TESTS
+TEST(disk_cache__put_get)
+TEST(disk_cache__invalidate_version)
+TEST(disk_cache__evict)
+END_TESTS
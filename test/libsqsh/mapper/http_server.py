@@ -0,0 +1,165 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) 2023-2024, Enno Boland <g@s01.de>
+#
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions are
+# met:
+#
+# * Redistributions of source code must retain the above copyright notice,
+#   this list of conditions and the following disclaimer.
+# * Redistributions in binary form must reproduce the above copyright
+#   notice, this list of conditions and the following disclaimer in the
+#   documentation and/or other materials provided with the distribution.
+#
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+# IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+# THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+# PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+# CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+# EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+# PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+# PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+# LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+# NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+# SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+#
+# @file         http_server.py
+#
+# Runs a test executable against a local HTTP server that serves range
+# requests and injects faults. The executable finds the server through
+# SQSH_TEST_HTTP_URL. Every request is appended to
+# $SQSH_TEST_HTTP_LOG/<name>.log as "<kind> <first byte> <last byte>", where
+# <name> is the request path and <kind> is one of ok, fail, drop or stall.
+#
+# The query string of a request selects the faults for the first requests on
+# a path:
+#
+#   fail=N         answer the first N requests with fail_status (default 503)
+#   drop=N         close the connection of the next N requests without a
+#                  response
+#   stall=MS       delay the next stall_count (default 1) requests by MS
+#                  milliseconds
+#   stall_offset=B only delay requests that start at byte B, all of them.
+#                  Requests for other ranges are not delayed and not counted
+
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+from email.utils import formatdate
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+from urllib.parse import parse_qs, urlsplit
+
+# Keep in sync with test/libsqsh/mapper/curl_mapper.c
+CONTENT_SIZE = 1024 * 1024
+CONTENT = bytes(i % 251 for i in range(CONTENT_SIZE))
+LAST_MODIFIED = formatdate(1700000000, usegmt=True)
+
+
+class Handler(BaseHTTPRequestHandler):
+    log_dir = None
+    lock = threading.Lock()
+    counters = {}
+
+    def log_message(self, format, *args):
+        pass
+
+    def log_request_kind(self, name, kind, first, last):
+        path = os.path.join(self.log_dir, name + ".log")
+        with self.lock:
+            with open(path, "a") as log:
+                log.write("%s %d %d\n" % (kind, first, last))
+
+    def parse_range(self):
+        value = self.headers.get("Range", "")
+        if not value.startswith("bytes="):
+            return None
+        first, _, last = value[len("bytes="):].partition("-")
+        first = int(first)
+        last = min(int(last), CONTENT_SIZE - 1)
+        if first > last:
+            return None
+        return first, last
+
+    def do_GET(self):
+        url = urlsplit(self.path)
+        name = url.path.strip("/").replace("/", "_")
+        query = {k: int(v[0]) for k, v in parse_qs(url.query).items()}
+        byte_range = self.parse_range()
+        if name == "" or byte_range is None:
+            self.send_error(400)
+            return
+        first, last = byte_range
+
+        if "stall_offset" in query:
+            if first == query["stall_offset"]:
+                self.log_request_kind(name, "stall", first, last)
+                time.sleep(query["stall"] / 1000)
+            else:
+                self.log_request_kind(name, "ok", first, last)
+            self.send_content(first, last)
+            return
+
+        with self.lock:
+            index = self.counters.get(name, 0)
+            self.counters[name] = index + 1
+
+        fail = query.get("fail", 0)
+        drop = fail + query.get("drop", 0)
+        stall = drop + query.get("stall_count", 1 if "stall" in query else 0)
+        if index < fail:
+            self.log_request_kind(name, "fail", first, last)
+            self.send_error(query.get("fail_status", 503))
+            return
+        elif index < drop:
+            self.log_request_kind(name, "drop", first, last)
+            self.close_connection = True
+            return
+        elif index < stall:
+            self.log_request_kind(name, "stall", first, last)
+            time.sleep(query["stall"] / 1000)
+        else:
+            self.log_request_kind(name, "ok", first, last)
+        self.send_content(first, last)
+
+    def send_content(self, first, last):
+        body = CONTENT[first:last + 1]
+        try:
+            self.send_response(206)
+            self.send_header(
+                "Content-Range",
+                "bytes %d-%d/%d" % (first, last, CONTENT_SIZE))
+            self.send_header("Content-Length", str(len(body)))
+            self.send_header("Last-Modified", LAST_MODIFIED)
+            self.end_headers()
+            self.wfile.write(body)
+        except (BrokenPipeError, ConnectionResetError):
+            # The client gave up on a stalled request.
+            pass
+
+
+def main():
+    log_dir = tempfile.mkdtemp(prefix="sqsh-http-")
+    Handler.log_dir = log_dir
+    server = ThreadingHTTPServer(("127.0.0.1", 0), Handler)
+    server.daemon_threads = True
+    thread = threading.Thread(target=server.serve_forever, daemon=True)
+    thread.start()
+
+    env = dict(os.environ)
+    env["SQSH_TEST_HTTP_URL"] = "http://127.0.0.1:%d" % server.server_port
+    env["SQSH_TEST_HTTP_LOG"] = log_dir
+    try:
+        rv = subprocess.call(sys.argv[1:], env=env)
+    finally:
+        server.shutdown()
+        shutil.rmtree(log_dir)
+    sys.exit(rv)
+
+
+if __name__ == "__main__":
+    main()
@@ -166,10 +166,102 @@ map_iterator__map_iterator_out_of_bounds_outside_blocksize(void) {
 	sqsh__map_manager_cleanup(&mapper);
 }
 
+static void
+map_iterator__next_sharded(void) {
+	int rv;
+	struct SqshMapManager mapper = {0};
+	struct SqshMapIterator cursor = {0};
+	static uint8_t buffer[4096];
+	for (size_t i = 0; i < sizeof(buffer); i++) {
+		buffer[i] = (uint8_t)i;
+	}
+	rv = sqsh__map_manager_init(
+			&mapper, buffer,
+			&(struct SqshConfig){.mapper_block_size = 1,
+								 .source_mapper = sqsh_mapper_impl_static,
+								 .source_size = sizeof(buffer)});
+	ASSERT_EQ(0, rv);
+	ASSERT_LT((size_t)1, mapper.shard_count);
+
+	rv = sqsh__map_iterator_init(&cursor, &mapper, 0);
+	ASSERT_EQ(0, rv);
+
+	for (size_t i = 0; i < sizeof(buffer); i++) {
+		bool has_next = sqsh__map_iterator_next(&cursor, &rv);
+		ASSERT_EQ(0, rv);
+		ASSERT_EQ(true, has_next);
+		ASSERT_EQ(&buffer[i], sqsh__map_iterator_data(&cursor));
+		ASSERT_EQ((size_t)1, sqsh__map_iterator_size(&cursor));
+	}
+
+	bool has_next = sqsh__map_iterator_next(&cursor, &rv);
+	ASSERT_EQ(0, rv);
+	ASSERT_EQ(false, has_next);
+
+	sqsh__map_iterator_cleanup(&cursor);
+	sqsh__map_manager_cleanup(&mapper);
+}
+
+static void
+map_iterator__next_direct(void) {
+	int rv;
+	struct SqshMapManager mapper = {0};
+	struct SqshMapIterator cursor = {0};
+	struct SqshMapIterator copy = {0};
+	const uint8_t buffer[] = "THIS IS A TEST STRING";
+	rv = sqsh__map_manager_init(
+			&mapper, buffer,
+			&(struct SqshConfig){.source_mapper = sqsh_mapper_impl_static,
+								 .source_size = sizeof(buffer) - 1});
+	ASSERT_EQ(0, rv);
+	ASSERT_EQ(true, mapper.is_direct);
+	ASSERT_EQ((size_t)0, mapper.shard_count);
+
+	rv = sqsh__map_iterator_init(&cursor, &mapper, 0);
+	ASSERT_EQ(0, rv);
+
+	bool has_next = sqsh__map_iterator_next(&cursor, &rv);
+	ASSERT_EQ(0, rv);
+	ASSERT_EQ(true, has_next);
+	ASSERT_EQ(buffer, sqsh__map_iterator_data(&cursor));
+	ASSERT_EQ(sizeof(buffer) - 1, sqsh__map_iterator_size(&cursor));
+
+	rv = sqsh__map_iterator_copy(&copy, &cursor);
+	ASSERT_EQ(0, rv);
+	sqsh__map_iterator_cleanup(&cursor);
+	ASSERT_EQ(buffer, sqsh__map_iterator_data(&copy));
+
+	has_next = sqsh__map_iterator_next(&copy, &rv);
+	ASSERT_EQ(0, rv);
+	ASSERT_EQ(false, has_next);
+
+	sqsh__map_iterator_cleanup(&copy);
+	sqsh__map_manager_cleanup(&mapper);
+}
+
+static void
+map_iterator__no_direct_without_lru(void) {
+	int rv;
+	struct SqshMapManager mapper = {0};
+	const uint8_t buffer[] = "THIS IS A TEST STRING";
+	rv = sqsh__map_manager_init(
+			&mapper, buffer,
+			&(struct SqshConfig){.source_mapper = sqsh_mapper_impl_static,
+								 .mapper_lru_size = -1,
+								 .source_size = sizeof(buffer) - 1});
+	ASSERT_EQ(0, rv);
+	ASSERT_EQ(false, mapper.is_direct);
+
+	sqsh__map_manager_cleanup(&mapper);
+}
+
 DECLARE_TESTS
 TEST(map_iterator__init_cursor)
 TEST(map_iterator__next_once)
 TEST(map_iterator__next_twice)
 TEST(map_iterator__map_iterator_out_of_bounds_inside_blocksize)
 TEST(map_iterator__map_iterator_out_of_bounds_outside_blocksize)
+TEST(map_iterator__next_sharded)
+TEST(map_iterator__next_direct)
+TEST(map_iterator__no_direct_without_lru)
 END_TESTS
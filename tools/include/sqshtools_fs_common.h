@@ -40,6 +40,7 @@
 
 #include "../include/sqsh.h"
 #include <fuse_opt.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <sys/stat.h>
 
@@ -56,6 +57,31 @@ struct SqshfsOptions {
 	char *offset;
 };
 
+/**
+ * @brief A contiguous part of the data returned by a read. The data stays
+ * valid until the next read on the same handle.
+ */
+struct FsFileSegment {
+	struct SqshFileIterator *iterator;
+	const uint8_t *data;
+	size_t size;
+};
+
+/**
+ * @brief State kept for each open regular file. The iterator is kept open
+ * between reads, so sequential reads continue where the previous read stopped
+ * instead of seeking from the start of the file.
+ */
+struct FsFileHandle {
+	struct SqshFile *file;
+	struct SqshFileIterator *iterator;
+	uint64_t position;
+	struct FsFileSegment *segments;
+	size_t segment_count;
+	size_t segment_capacity;
+	pthread_mutex_t lock;
+};
+
 extern struct fuse_opt fs_common_opts[];
 
 void fs_common_help(void);
@@ -74,14 +100,21 @@ mode_t fs_common_inode_mode(struct SqshFile *file);
 
 int fs_common_map_err(int rv);
 
-int fs_common_read(
-		struct SqshFileReader **reader, struct SqshFile *file, off_t offset,
-		size_t size);
+struct FsFileHandle *fs_common_file_handle_new(struct SqshFile *file, int *err);
+
+int fs_common_file_handle_read(
+		struct FsFileHandle *handle, off_t offset, size_t size);
+
+void fs_common_file_handle_free(struct FsFileHandle *handle);
 
 void fs_common_getattr(
 		struct SqshFile *file, const struct SqshSuperblock *superblock,
 		struct stat *st);
 
+void fs_common_attributes_to_stat(
+		const struct SqshFileAttributes *attributes,
+		const struct SqshSuperblock *superblock, struct stat *st);
+
 int fs_common_listxattr_size(struct SqshFile *file, size_t *size);
 
 int fs_common_listxattr(struct SqshFile *file, char *buf, size_t *size);
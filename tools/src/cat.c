@@ -44,9 +44,19 @@ usage(char *arg0) {
 	return EXIT_FAILURE;
 }
 
+static void
+cat_path_done(const struct SqshFile *file, FILE *stream, void *data, int err) {
+	(void)file;
+	(void)stream;
+	*(int *)data = err;
+}
+
 static int
-cat_path(struct SqshArchive *archive, char *path) {
+cat_path(
+		struct SqshArchive *archive, struct SqshThreadpool *threadpool,
+		char *path) {
 	struct SqshFile *file = NULL;
+	int cat_rv = 0;
 
 	int rv = 0;
 	file = sqsh_open(archive, path, &rv);
@@ -56,7 +66,14 @@ cat_path(struct SqshArchive *archive, char *path) {
 		goto out;
 	}
 
-	rv = sqsh_file_to_stream(file, stdout);
+	rv = sqsh_file_to_stream_ordered_mt(
+			file, threadpool, stdout, cat_path_done, &cat_rv);
+	if (rv == 0) {
+		rv = sqsh_threadpool_wait(threadpool);
+	}
+	if (rv == 0) {
+		rv = cat_rv;
+	}
 	if (rv < 0) {
 		sqsh_perror(rv, path);
 		rv = EXIT_FAILURE;
@@ -82,6 +99,7 @@ main(int argc, char *argv[]) {
 	int opt = 0;
 	const char *image_path;
 	struct SqshArchive *sqsh = NULL;
+	struct SqshThreadpool *threadpool = NULL;
 	uint64_t offset = 0;
 
 	while ((opt = getopt_long(argc, argv, opts, long_opts, NULL)) != -1) {
@@ -111,14 +129,22 @@ main(int argc, char *argv[]) {
 		goto out;
 	}
 
+	threadpool = sqsh_threadpool_new(0, &rv);
+	if (rv < 0) {
+		sqsh_perror(rv, "sqsh_threadpool_new");
+		rv = EXIT_FAILURE;
+		goto out;
+	}
+
 	for (; optind < argc; optind++) {
-		rv = cat_path(sqsh, argv[optind]);
+		rv = cat_path(sqsh, threadpool, argv[optind]);
 		if (rv < 0) {
 			goto out;
 		}
 	}
 
 out:
+	sqsh_threadpool_free(threadpool);
 	sqsh_archive_close(sqsh);
 	return rv;
 }
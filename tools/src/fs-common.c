@@ -133,55 +133,182 @@ fs_common_map_err(int rv) {
 	}
 }
 
-int
-fs_common_read(
-		struct SqshFileReader **reader, struct SqshFile *inode, off_t offset,
-		size_t size) {
+struct FsFileHandle *
+fs_common_file_handle_new(struct SqshFile *file, int *err) {
 	int rv = 0;
-	*reader = sqsh_file_reader_new(inode, &rv);
-	if (rv < 0) {
+	struct FsFileHandle *handle = calloc(1, sizeof(struct FsFileHandle));
+	if (handle == NULL) {
+		rv = -SQSH_ERROR_MALLOC_FAILED;
+		goto out;
+	}
+	rv = pthread_mutex_init(&handle->lock, NULL);
+	if (rv != 0) {
+		free(handle);
+		handle = NULL;
+		rv = -SQSH_ERROR_MUTEX_INIT_FAILED;
 		goto out;
 	}
+	handle->file = file;
+out:
+	if (err != NULL) {
+		*err = rv;
+	}
+	return handle;
+}
 
-	uint64_t file_size = sqsh_file_size(inode);
+static void
+file_handle_release_segments(struct FsFileHandle *handle) {
+	for (size_t i = 0; i < handle->segment_count; i++) {
+		sqsh_file_iterator_free(handle->segments[i].iterator);
+	}
+	handle->segment_count = 0;
+}
+
+static int
+file_handle_add_segment(
+		struct FsFileHandle *handle, const uint8_t *data, size_t size) {
+	if (handle->segment_count == handle->segment_capacity) {
+		size_t capacity = SQSH_MAX(handle->segment_capacity * 2, 4);
+		struct FsFileSegment *segments = realloc(
+				handle->segments, capacity * sizeof(struct FsFileSegment));
+		if (segments == NULL) {
+			return -SQSH_ERROR_MALLOC_FAILED;
+		}
+		handle->segments = segments;
+		handle->segment_capacity = capacity;
+	}
+	struct FsFileSegment *segment = &handle->segments[handle->segment_count];
+	segment->iterator = NULL;
+	segment->data = data;
+	segment->size = size;
+	handle->segment_count++;
+	return 0;
+}
+
+int
+fs_common_file_handle_read(
+		struct FsFileHandle *handle, off_t offset, size_t size) {
+	int rv = 0;
+	struct SqshFile *file = handle->file;
+
+	file_handle_release_segments(handle);
+
+	uint64_t file_size = sqsh_file_size(file);
 	if (offset < 0 || (uint64_t)offset >= file_size) {
 		return 0;
 	} else if (size > file_size - (uint64_t)offset) {
 		size = file_size - (uint64_t)offset;
 	}
-
-	// This works around a bug in sqsh_file_reader_advance:
-	// Reading a 0 size at the end of the file will return
-	// SQSH_ERROR_OUT_OF_BOUNDS. This should succeed instead,
-	// providing an empty buffer.
-	// TODO: Fix this in lib/reader/reader.c
 	if (size == 0) {
 		return 0;
 	}
 
-	rv = sqsh_file_reader_advance2(*reader, offset, size);
+	// The iterator can only move forward. Reads before the current position
+	// restart from the beginning of the file.
+	if (handle->iterator != NULL && (uint64_t)offset < handle->position) {
+		sqsh_file_iterator_free(handle->iterator);
+		handle->iterator = NULL;
+	}
+	if (handle->iterator == NULL) {
+		handle->iterator = sqsh_file_iterator_new(file, &rv);
+		if (rv < 0) {
+			goto out;
+		}
+		handle->position = 0;
+	}
+	struct SqshFileIterator *iterator = handle->iterator;
+
+	uint64_t inner_offset = (uint64_t)offset - handle->position;
+	rv = sqsh_file_iterator_skip2(iterator, &inner_offset, size);
 	if (rv < 0) {
 		goto out;
 	}
-out:
+	handle->position = (uint64_t)offset - inner_offset;
+
+	// Collect the chunks that make up the requested range without copying
+	// them. All chunks but the last one are kept alive by a copy of the
+	// iterator, the last one by the handle's iterator itself.
+	for (;;) {
+		const uint8_t *data = sqsh_file_iterator_data(iterator);
+		const size_t chunk_size = sqsh_file_iterator_size(iterator);
+		const size_t segment_size =
+				SQSH_MIN(chunk_size - (size_t)inner_offset, size);
+
+		rv = file_handle_add_segment(
+				handle, &data[inner_offset], segment_size);
+		if (rv < 0) {
+			goto out;
+		}
+		size -= segment_size;
+		if (size == 0) {
+			break;
+		}
+
+		struct FsFileSegment *segment =
+				&handle->segments[handle->segment_count - 1];
+		segment->iterator = sqsh_file_iterator_dup(iterator, &rv);
+		if (rv < 0) {
+			goto out;
+		}
+		segment->data = &sqsh_file_iterator_data(segment->iterator)[inner_offset];
+
+		bool has_next = sqsh_file_iterator_next(iterator, size, &rv);
+		if (rv < 0) {
+			goto out;
+		} else if (has_next == false) {
+			rv = -SQSH_ERROR_OUT_OF_BOUNDS;
+			goto out;
+		}
+		handle->position += chunk_size;
+		inner_offset = 0;
+	}
 
+out:
+	if (rv < 0) {
+		// The iterator is in an undefined state after a failed read.
+		file_handle_release_segments(handle);
+		sqsh_file_iterator_free(handle->iterator);
+		handle->iterator = NULL;
+	}
 	return rv;
 }
 
+void
+fs_common_file_handle_free(struct FsFileHandle *handle) {
+	if (handle == NULL) {
+		return;
+	}
+	file_handle_release_segments(handle);
+	free(handle->segments);
+	sqsh_file_iterator_free(handle->iterator);
+	sqsh_close(handle->file);
+	pthread_mutex_destroy(&handle->lock);
+	free(handle);
+}
+
 void
 fs_common_getattr(
 		struct SqshFile *inode, const struct SqshSuperblock *superblock,
 		struct stat *st) {
-	const uint64_t inode_number = sqsh_file_inode(inode);
+	struct SqshFileAttributes attributes = {0};
 
+	sqsh_file_attributes(inode, &attributes);
+	fs_common_attributes_to_stat(&attributes, superblock, st);
+}
+
+void
+fs_common_attributes_to_stat(
+		const struct SqshFileAttributes *attributes,
+		const struct SqshSuperblock *superblock, struct stat *st) {
 	st->st_dev = 0;
-	st->st_ino = fs_common_inode_sqsh_to_ino(inode_number);
-	st->st_mode = fs_common_inode_mode(inode);
-	st->st_nlink = sqsh_file_hard_link_count(inode);
-	st->st_uid = sqsh_file_uid(inode);
-	st->st_gid = sqsh_file_gid(inode);
-	st->st_size = sqsh_file_size(inode);
-	st->st_atime = st->st_mtime = st->st_ctime = sqsh_file_modified_time(inode);
+	st->st_ino = fs_common_inode_sqsh_to_ino(attributes->inode_number);
+	st->st_mode = attributes->permission |
+			fs_common_mode_type(attributes->type);
+	st->st_nlink = attributes->hard_link_count;
+	st->st_uid = attributes->uid;
+	st->st_gid = attributes->gid;
+	st->st_size = attributes->size;
+	st->st_atime = st->st_mtime = st->st_ctime = attributes->modified_time;
 	if (superblock != NULL) {
 		st->st_blksize = sqsh_superblock_block_size(superblock);
 	}
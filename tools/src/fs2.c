@@ -155,18 +155,23 @@ out:
 static int
 fs_open(const char *path, struct fuse_file_info *fi) {
 	int rv = 0;
+	struct FsFileHandle *handle = NULL;
 
 	struct SqshFile *file = sqsh_open(context.archive, path, &rv);
 	if (rv < 0) {
 		goto out;
 	}
 
-	fi->fh = (uintptr_t)file;
-
-out:
+	handle = fs_common_file_handle_new(file, &rv);
 	if (rv < 0) {
-		sqsh_close(file);
+		goto out;
 	}
+	file = NULL;
+
+	fi->fh = (uintptr_t)handle;
+
+out:
+	sqsh_close(file);
 	return -fs_common_map_err(rv);
 }
 
@@ -175,21 +180,24 @@ fs_read(const char *path, char *buf, size_t size, off_t offset,
 		struct fuse_file_info *fi) {
 	(void)path;
 	int rv = 0;
-	struct SqshFile *file = (struct SqshFile *)(uintptr_t)fi->fh;
-	struct SqshFileReader *reader = NULL;
+	struct FsFileHandle *handle = (struct FsFileHandle *)(uintptr_t)fi->fh;
+	size_t read_size = 0;
 
-	rv = fs_common_read(&reader, file, offset, size);
+	pthread_mutex_lock(&handle->lock);
+	rv = fs_common_file_handle_read(handle, offset, size);
 	if (rv < 0) {
 		goto out;
 	}
 
-	const uint8_t *data = sqsh_file_reader_data(reader);
-	rv = sqsh_file_reader_size(reader);
-	size = rv;
-	memcpy(buf, data, size);
+	for (size_t i = 0; i < handle->segment_count; i++) {
+		const struct FsFileSegment *segment = &handle->segments[i];
+		memcpy(&buf[read_size], segment->data, segment->size);
+		read_size += segment->size;
+	}
+	rv = (int)read_size;
 
 out:
-	sqsh_file_reader_free(reader);
+	pthread_mutex_unlock(&handle->lock);
 
 	if (rv < 0) {
 		return -fs_common_map_err(rv);
@@ -200,9 +208,9 @@ out:
 static int
 fs_release(const char *path, struct fuse_file_info *fi) {
 	(void)path;
-	struct SqshFile *file = (struct SqshFile *)(uintptr_t)fi->fh;
+	struct FsFileHandle *handle = (struct FsFileHandle *)(uintptr_t)fi->fh;
 
-	sqsh_close(file);
+	fs_common_file_handle_free(handle);
 	return 0;
 }
 
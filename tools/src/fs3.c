@@ -74,6 +74,11 @@ get_dir_handle(struct fuse_file_info *fi) {
 	return (struct FsDirHandle *)(uintptr_t)fi->fh;
 }
 
+static struct FsFileHandle *
+get_file_handle(struct fuse_file_info *fi) {
+	return (struct FsFileHandle *)(uintptr_t)fi->fh;
+}
+
 static void
 fs_init(void *userdata, struct fuse_conn_info *conn) {
 	(void)userdata;
@@ -81,6 +86,11 @@ fs_init(void *userdata, struct fuse_conn_info *conn) {
 	if (conn->capable & FUSE_CAP_PARALLEL_DIROPS) {
 		conn->want |= FUSE_CAP_PARALLEL_DIROPS;
 	}
+	// Allows fuse to send the segments of a read reply through a pipe
+	// instead of copying them into an intermediate buffer.
+	if (conn->capable & FUSE_CAP_SPLICE_WRITE) {
+		conn->want |= FUSE_CAP_SPLICE_WRITE;
+	}
 }
 
 static struct SqshFile *
@@ -92,26 +102,34 @@ fs_file_open(fuse_ino_t ino, int *err) {
 	return sqsh_open_by_ref(context.archive, inode_ref, err);
 }
 
+static int
+fs_file_attributes(fuse_ino_t ino, struct SqshFileAttributes *attributes) {
+	int rv = 0;
+	const uint64_t inode_ref = fs_common_context_inode_ref(ino, &rv);
+	if (rv < 0) {
+		return rv;
+	}
+	return sqsh_file_attributes_by_ref(context.archive, inode_ref, attributes);
+}
+
 static void
 fs_getattr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi) {
 	(void)fi;
 	int rv = 0;
-	struct SqshFile *file = NULL;
+	struct SqshFileAttributes attributes = {0};
 	const struct SqshSuperblock *superblock =
 			sqsh_archive_superblock(context.archive);
 
-	file = fs_file_open(ino, &rv);
+	rv = fs_file_attributes(ino, &attributes);
 	if (rv < 0) {
 		fuse_reply_err(req, fs_common_map_err(rv));
-		goto out;
+		return;
 	}
 
 	struct stat stbuf = {0};
-	fs_common_getattr(file, superblock, &stbuf);
+	fs_common_attributes_to_stat(&attributes, superblock, &stbuf);
 
 	fuse_reply_attr(req, &stbuf, 1.0);
-out:
-	sqsh_close(file);
 }
 
 static void
@@ -119,7 +137,7 @@ fs_lookup(fuse_req_t req, fuse_ino_t parent, const char *name) {
 	int rv = 0;
 	struct SqshDirectoryIterator *iterator = NULL;
 	struct SqshFile *parent_dir = NULL;
-	struct SqshFile *file = NULL;
+	struct SqshFileAttributes attributes = {0};
 	const struct SqshSuperblock *superblock =
 			sqsh_archive_superblock(context.archive);
 
@@ -142,13 +160,13 @@ fs_lookup(fuse_req_t req, fuse_ino_t parent, const char *name) {
 	}
 
 	const uint64_t inode_ref = sqsh_directory_iterator_inode_ref(iterator);
-	file = sqsh_open_by_ref(context.archive, inode_ref, &rv);
+	rv = sqsh_file_attributes_by_ref(context.archive, inode_ref, &attributes);
 	if (rv < 0) {
 		fuse_reply_err(req, fs_common_map_err(rv));
 		goto out;
 	}
 
-	uint32_t inode_number = sqsh_file_inode(file);
+	uint32_t inode_number = attributes.inode_number;
 	if (inode_number > sqsh_superblock_inode_count(superblock)) {
 		fuse_reply_err(req, EIO);
 		goto out;
@@ -166,12 +184,11 @@ fs_lookup(fuse_req_t req, fuse_ino_t parent, const char *name) {
 			.entry_timeout = 1.0,
 			.generation = 1,
 	};
-	fs_common_getattr(file, NULL, &entry.attr);
+	fs_common_attributes_to_stat(&attributes, NULL, &entry.attr);
 
 	fuse_reply_entry(req, &entry);
 
 out:
-	sqsh_close(file);
 	sqsh_directory_iterator_free(iterator);
 	sqsh_close(parent_dir);
 }
@@ -179,19 +196,15 @@ out:
 static void
 fs_access(fuse_req_t req, fuse_ino_t ino, int mask) {
 	int rv = 0;
-	struct SqshFile *file = NULL;
+	struct SqshFileAttributes attributes = {0};
 
-	file = fs_file_open(ino, &rv);
+	rv = fs_file_attributes(ino, &attributes);
 	if (rv < 0) {
 		fuse_reply_err(req, fs_common_map_err(rv));
-		goto out;
+		return;
 	}
 
-	const uint16_t permission = sqsh_file_permission(file);
-	fuse_reply_err(req, permission & mask ? 0 : EACCES);
-
-out:
-	sqsh_close(file);
+	fuse_reply_err(req, attributes.permission & mask ? 0 : EACCES);
 }
 
 static void
@@ -319,6 +332,7 @@ fs_releasedir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi) {
 static void
 fs_open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi) {
 	struct SqshFile *file = NULL;
+	struct FsFileHandle *handle = NULL;
 
 	int rv = 0;
 
@@ -327,8 +341,13 @@ fs_open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi) {
 		fuse_reply_err(req, EIO);
 		goto out;
 	}
-	fi->fh = (uintptr_t)file;
+	handle = fs_common_file_handle_new(file, &rv);
+	if (rv < 0) {
+		fuse_reply_err(req, fs_common_map_err(rv));
+		goto out;
+	}
 	file = NULL;
+	fi->fh = (uintptr_t)handle;
 	fuse_reply_open(req, fi);
 out:
 	sqsh_close(file);
@@ -337,9 +356,9 @@ out:
 static void
 fs_release(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi) {
 	(void)ino;
-	struct SqshFile *file = (struct SqshFile *)(uintptr_t)fi->fh;
+	struct FsFileHandle *handle = get_file_handle(fi);
 
-	sqsh_close(file);
+	fs_common_file_handle_free(handle);
 	fuse_reply_err(req, 0);
 }
 
@@ -347,24 +366,43 @@ static void
 fs_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t offset,
 		struct fuse_file_info *fi) {
 	(void)ino;
-	struct SqshFile *file = (struct SqshFile *)(uintptr_t)fi->fh;
+	struct FsFileHandle *handle = get_file_handle(fi);
+	struct fuse_bufvec *bufvec = NULL;
 	int rv = 0;
-	struct SqshFileReader *reader = NULL;
 
-	rv = fs_common_read(&reader, file, offset, size);
+	pthread_mutex_lock(&handle->lock);
+	rv = fs_common_file_handle_read(handle, offset, size);
 	if (rv < 0) {
 		goto out;
 	}
 
-	const uint8_t *data = sqsh_file_reader_data(reader);
-	const size_t data_size = sqsh_file_reader_size(reader);
-	fuse_reply_buf(req, (const char *)data, data_size);
+	if (handle->segment_count == 0) {
+		fuse_reply_buf(req, NULL, 0);
+		goto out;
+	}
+
+	// Hand the segments to fuse as they are. Uncompressed data points into
+	// the mapped archive, compressed data into the extract cache.
+	bufvec = calloc(
+			1, sizeof(struct fuse_bufvec) +
+					   (handle->segment_count - 1) * sizeof(struct fuse_buf));
+	if (bufvec == NULL) {
+		rv = -SQSH_ERROR_MALLOC_FAILED;
+		goto out;
+	}
+	bufvec->count = handle->segment_count;
+	for (size_t i = 0; i < handle->segment_count; i++) {
+		bufvec->buf[i].mem = (void *)handle->segments[i].data;
+		bufvec->buf[i].size = handle->segments[i].size;
+	}
+	fuse_reply_data(req, bufvec, 0);
 
 out:
+	pthread_mutex_unlock(&handle->lock);
+	free(bufvec);
 	if (rv < 0) {
 		fuse_reply_err(req, fs_common_map_err(rv));
 	}
-	sqsh_file_reader_free(reader);
 }
 
 static void